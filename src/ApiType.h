@@ -44,6 +44,14 @@ api_type const api_output_uses_allocated_or_input_buffer = 0;
 // JackOutput::m_chunk is set in fill_output_buffer() and JackOutput::chunk_ptr() may be called to access it.
 api_type const api_output_provided_buffer = 4;
 
+// JackInput and JackOutput API (of objects that are both, like JackProcessor).
+
+// virtual jack_default_audio_sample_t* inplace_buffer() const
+// The output can be generated in place: generate_output() still works when the input buffer
+// is the output buffer. When our input is the only input connected to a JackOutput, then that
+// JackOutput writes directly to our output buffer.
+api_type const api_inplace = 8;
+
 // Combinations.
 
 api_type const api_input_any = api_input_provided_buffer | api_input_memcpy_zero;
@@ -57,5 +65,6 @@ inline bool has_memcpy_input(api_type mask) { return (mask & api_input_memcpy_ze
 inline bool has_zero_input(api_type mask) { return (mask & api_input_memcpy_zero); }
 inline bool has_provided_input_buffer(api_type mask) { return (mask & api_input_provided_buffer); }
 inline bool has_provided_output_buffer(api_type mask) { return (mask & api_output_provided_buffer); }
+inline bool has_inplace(api_type mask) { return (mask & api_inplace); }
 
 #endif // API_TYPE_H
@@ -0,0 +1,42 @@
+/**
+ * \file AudioSink.h
+ * \brief Declaration of AudioSink.
+ *
+ * Copyright (C) 2016 Aleric Inglewood.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published
+ * by the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef AUDIO_SINK_H
+#define AUDIO_SINK_H
+
+#include <jack/jack.h>
+
+// Something that a take is recorded into: a WAV file or a CompressedTake (see JackDiskWriter).
+//
+// The member functions are only called from one (non-real-time) thread at a time
+// and may throw AIAlert::Error.
+class AudioSink
+{
+  public:
+    virtual ~AudioSink() { }
+
+    // Append nframes frames; channel c of frame f is in[c][f].
+    virtual void write(jack_default_audio_sample_t const* const* in, jack_nframes_t nframes) = 0;
+
+    // The take is complete.
+    virtual void close() = 0;
+};
+
+#endif // AUDIO_SINK_H
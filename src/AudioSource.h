@@ -0,0 +1,48 @@
+/**
+ * \file AudioSource.h
+ * \brief Declaration of AudioSource.
+ *
+ * Copyright (C) 2016 Aleric Inglewood.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published
+ * by the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef AUDIO_SOURCE_H
+#define AUDIO_SOURCE_H
+
+#include <jack/jack.h>
+#include <cstdint>
+
+// Something that JackDiskReader plays back: a WAV file or a CompressedTake.
+//
+// Not thread-safe; read() may throw AIAlert::Error.
+class AudioSource
+{
+  public:
+    virtual ~AudioSource() { }
+
+    // Read up to max_frames interleaved frames into out (max_frames * channels() floats).
+    // Returns the number of frames read, which is only less than max_frames at the end.
+    virtual jack_nframes_t read(float* out, jack_nframes_t max_frames) = 0;
+
+    // Continue reading at the first frame.
+    virtual void rewind() = 0;
+
+    // Accessors.
+    virtual int channels() const = 0;
+    virtual jack_nframes_t sample_rate() const = 0;
+    virtual uint64_t frames() const = 0;
+};
+
+#endif // AUDIO_SOURCE_H
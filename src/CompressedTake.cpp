@@ -0,0 +1,223 @@
+/**
+ * /file CompressedTake.cpp
+ * /brief Implementation of class CompressedTake.
+ *
+ * Copyright (C) 2016 Aleric Inglewood.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published
+ * by the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "sys.h"
+
+#include "CompressedTake.h"
+#include "debug.h"
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+
+namespace {
+
+size_t const group_size = 32;   // The number of samples that are bit-packed with the same width.
+int const float_coding = 255;   // Stored instead of a shift when the samples are coded as float bit patterns.
+float const pcm_scale = 8388608.0f;     // 2^23: the resolution of converted 24-bit (or coarser) ADC data.
+
+// Map the bit pattern of a float onto an integer that sorts like the float (and back).
+uint32_t ordered(uint32_t bits) { return bits ^ ((uint32_t)((int32_t)bits >> 31) >> 1); }
+
+// The largest number of bytes that encode() writes for n samples.
+size_t max_coded_size(size_t n) { return 1 + (n + group_size - 1) / group_size + n * sizeof(float); }
+
+// If every sample is an exact multiple of 2^-23, return the number of trailing zero bits
+// that all of them have as integer PCM value; otherwise return float_coding.
+int pcm_shift(float const* in, size_t n)
+{
+  uint32_t all = 0;
+  for (size_t i = 0; i < n; ++i)
+  {
+    float const scaled = in[i] * pcm_scale;
+    if (!(std::fabs(scaled) < 2147483648.0f) || scaled != (float)(int32_t)scaled || (scaled == 0 && std::signbit(in[i])))
+      return float_coding;      // Not PCM (or -0, NaN, too large); keep the exact bit pattern.
+    all |= (uint32_t)(int32_t)scaled;
+  }
+  return all ? __builtin_ctz(all) : 0;
+}
+
+// Code n samples into out. Returns the number of bytes written.
+//
+// The first byte is the shift returned by pcm_shift(). PCM data is coded as the (shifted)
+// integer values, which only need as many bits as the signal is loud; anything else as the
+// ordered bit patterns of the floats. Either way the difference with the previous value is coded.
+size_t encode(unsigned char* out, float const* in, size_t n)
+{
+  unsigned char* const begin = out;
+  int const shift = pcm_shift(in, n);
+  *out++ = shift;
+  uint32_t previous = 0;
+  uint32_t zigzag[group_size];
+  for (size_t first = 0; first < n; first += group_size)
+  {
+    size_t const count = std::min(group_size, n - first);
+    uint32_t all = 0;
+    for (size_t i = 0; i < count; ++i)
+    {
+      uint32_t value;
+      if (shift == float_coding)
+      {
+        uint32_t bits;
+        std::memcpy(&bits, &in[first + i], sizeof(bits));
+        value = ordered(bits);
+      }
+      else
+        value = (uint32_t)((int32_t)(in[first + i] * pcm_scale) >> shift);
+      uint32_t const delta = value - previous;
+      previous = value;
+      zigzag[i] = (delta << 1) ^ (uint32_t)((int32_t)delta >> 31);
+      all |= zigzag[i];
+    }
+    int const width = all ? 32 - __builtin_clz(all) : 0;
+    *out++ = width;
+    uint64_t bitbuf = 0;
+    int nbits = 0;
+    for (size_t i = 0; i < count; ++i)
+    {
+      bitbuf |= (uint64_t)zigzag[i] << nbits;
+      nbits += width;
+      for (; nbits >= 8; nbits -= 8, bitbuf >>= 8)
+        *out++ = bitbuf;
+    }
+    if (nbits > 0)
+      *out++ = bitbuf;
+  }
+  return out - begin;
+}
+
+// Decode n samples from in into out. Returns the number of bytes used.
+size_t decode(float* out, unsigned char const* in, size_t n)
+{
+  unsigned char const* const begin = in;
+  int const shift = *in++;
+  uint32_t previous = 0;
+  for (size_t first = 0; first < n; first += group_size)
+  {
+    size_t const count = std::min(group_size, n - first);
+    int const width = *in++;
+    uint64_t const mask = ((uint64_t)1 << width) - 1;
+    uint64_t bitbuf = 0;
+    int nbits = 0;
+    for (size_t i = 0; i < count; ++i)
+    {
+      for (; nbits < width; nbits += 8)
+        bitbuf |= (uint64_t)*in++ << nbits;
+      uint32_t const zigzag = bitbuf & mask;
+      bitbuf >>= width;
+      nbits -= width;
+      previous += (zigzag >> 1) ^ -(zigzag & 1);
+      if (shift == float_coding)
+      {
+        uint32_t const bits = ordered(previous);
+        std::memcpy(&out[first + i], &bits, sizeof(bits));
+      }
+      else
+        out[first + i] = (float)(int32_t)(previous << shift) / pcm_scale;
+    }
+  }
+  return in - begin;
+}
+
+} // namespace
+
+CompressedTake::CompressedTake(int channels, jack_nframes_t sample_rate) :
+    m_channels(channels), m_sample_rate(sample_rate), m_frames(0), m_bytes(0),
+    m_pending(channels * s_block_frames), m_pending_frames(0), m_scratch(channels * max_coded_size(s_block_frames)),
+    m_read_block(0), m_decoded(channels * s_block_frames), m_decoded_frames(0), m_decoded_position(0)
+{
+}
+
+void CompressedTake::write(jack_default_audio_sample_t const* const* in, jack_nframes_t nframes)
+{
+  jack_nframes_t done = 0;
+  while (done < nframes)
+  {
+    jack_nframes_t const len = std::min(nframes - done, s_block_frames - m_pending_frames);
+    for (int channel = 0; channel < m_channels; ++channel)
+      std::memcpy(&m_pending[channel * s_block_frames + m_pending_frames], in[channel] + done, len * sizeof(float));
+    m_pending_frames += len;
+    done += len;
+    if (m_pending_frames == s_block_frames)
+      encode_block();
+  }
+}
+
+void CompressedTake::close()
+{
+  if (m_pending_frames > 0)
+    encode_block();
+  Dout(dc::notice, "CompressedTake: " << m_frames << " frames in " << m_bytes << " bytes (" <<
+      (m_bytes ? 100.0 * m_bytes / (m_frames * m_channels * sizeof(float)) : 0.0) << "%).");
+}
+
+void CompressedTake::encode_block()
+{
+  size_t size = 0;
+  for (int channel = 0; channel < m_channels; ++channel)
+    size += encode(m_scratch.data() + size, &m_pending[channel * s_block_frames], m_pending_frames);
+  m_blocks.push_back(Block());
+  Block& block(m_blocks.back());
+  block.m_frames = m_pending_frames;
+  block.m_data.assign(m_scratch.begin(), m_scratch.begin() + size);
+  m_frames += m_pending_frames;
+  m_bytes += size;
+  m_pending_frames = 0;
+}
+
+void CompressedTake::decode_block()
+{
+  Block const& block(m_blocks[m_read_block++]);
+  unsigned char const* in = block.m_data.data();
+  for (int channel = 0; channel < m_channels; ++channel)
+    in += decode(&m_decoded[channel * s_block_frames], in, block.m_frames);
+  m_decoded_frames = block.m_frames;
+  m_decoded_position = 0;
+}
+
+jack_nframes_t CompressedTake::read(float* out, jack_nframes_t max_frames)
+{
+  jack_nframes_t total = 0;
+  while (total < max_frames)
+  {
+    if (m_decoded_position == m_decoded_frames)
+    {
+      if (m_read_block == m_blocks.size())
+        break;
+      decode_block();
+    }
+    jack_nframes_t const len = std::min(max_frames - total, m_decoded_frames - m_decoded_position);
+    for (int channel = 0; channel < m_channels; ++channel)
+    {
+      float const* in = &m_decoded[channel * s_block_frames + m_decoded_position];
+      float* interleaved = out + (size_t)total * m_channels + channel;
+      for (jack_nframes_t frame = 0; frame < len; ++frame, interleaved += m_channels)
+        *interleaved = in[frame];
+    }
+    m_decoded_position += len;
+    total += len;
+  }
+  return total;
+}
+
+void CompressedTake::rewind()
+{
+  m_read_block = 0;
+  m_decoded_frames = m_decoded_position = 0;
+}
@@ -0,0 +1,100 @@
+/**
+ * \file CompressedTake.h
+ * \brief Declaration of CompressedTake.
+ *
+ * Copyright (C) 2016 Aleric Inglewood.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published
+ * by the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef COMPRESSED_TAKE_H
+#define COMPRESSED_TAKE_H
+
+#include "AudioSink.h"
+#include "AudioSource.h"
+#include <jack/jack.h>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+// A take kept in memory, compressed losslessly.
+//
+// The take is stored in blocks of s_block_frames frames, and every channel of a block
+// is coded separately. When every sample is a multiple of 2^-23, as the converted ADC
+// data that JACK delivers is, the samples are turned back into integer PCM values
+// (without the trailing zero bits that all of them have, so 16-bit data is coded as such);
+// otherwise the bit pattern of each float is mapped onto an integer with the same order.
+// The difference with the previous value is zigzag coded, and every group of 32 differences
+// is bit-packed with the width of the largest one. For PCM data the width follows the
+// loudness of the signal, so quiet passages need few bits and silence costs one byte
+// per group; the float fallback saves little (deltas of float bit patterns stay close to
+// the mantissa width). Decoding takes a few integer operations per sample.
+//
+// A take is written by the thread that records it (JackDiskWriter) and, once it is closed,
+// read by the thread that plays it back (JackDiskReader). Not thread-safe otherwise.
+class CompressedTake : public AudioSink, public AudioSource
+{
+  public:
+    static jack_nframes_t const s_block_frames = 4096;  // The number of frames per block.
+
+  private:
+    struct Block
+    {
+      jack_nframes_t m_frames;
+      std::vector<unsigned char> m_data;        // The coded channels, one after another.
+    };
+
+    int m_channels;
+    jack_nframes_t m_sample_rate;
+    std::vector<Block> m_blocks;
+    uint64_t m_frames;                          // The number of frames in m_blocks.
+    size_t m_bytes;                             // The size of the coded data in m_blocks.
+
+    // Writing.
+    std::vector<float> m_pending;               // The frames of the block being filled (channel after channel).
+    jack_nframes_t m_pending_frames;
+    std::vector<unsigned char> m_scratch;       // Room for the largest coded block.
+
+    // Reading.
+    size_t m_read_block;                        // The index of the next block to decode.
+    std::vector<float> m_decoded;               // The last decoded block (channel after channel).
+    jack_nframes_t m_decoded_frames;            // The number of frames in m_decoded.
+    jack_nframes_t m_decoded_position;          // The number of frames of m_decoded that were read.
+
+  public:
+    CompressedTake(int channels, jack_nframes_t sample_rate);
+
+    // Inherited from AudioSink.
+    /*virtual*/ void write(jack_default_audio_sample_t const* const* in, jack_nframes_t nframes);
+    /*virtual*/ void close();
+
+    // Inherited from AudioSource.
+    /*virtual*/ jack_nframes_t read(float* out, jack_nframes_t max_frames);
+    /*virtual*/ void rewind();
+    /*virtual*/ int channels() const { return m_channels; }
+    /*virtual*/ jack_nframes_t sample_rate() const { return m_sample_rate; }
+    /*virtual*/ uint64_t frames() const { return m_frames; }
+
+    // The number of bytes that the coded audio takes.
+    size_t bytes() const { return m_bytes; }
+
+  private:
+    void encode_block();
+    void decode_block();
+
+  private:
+    CompressedTake(CompressedTake const&);
+};
+
+#endif // COMPRESSED_TAKE_H
@@ -25,8 +25,22 @@
 void Configuration::xml(xml::Bridge& xml)
 {
   xml.node_name("configuration");
-  xml.children_stream("capture", m_capture_ports, xml::insert);
-  xml.children_stream("playback", m_playback_ports, xml::insert);
+  // The first channel uses the same element names as before there were multiple channels.
+  for (int channel = 0; channel < max_channels; ++channel)
+  {
+    std::string const suffix = channel ? std::to_string(channel + 1) : std::string();
+    xml.children_stream(("capture" + suffix).c_str(), m_capture_ports[channel], xml::insert);
+    xml.children_stream(("playback" + suffix).c_str(), m_playback_ports[channel], xml::insert);
+  }
+  xml.child_stream("crossfade_duration", m_crossfade_duration);
+  int crossfade_curve = m_crossfade_curve;
+  xml.child_stream("crossfade_curve", crossfade_curve);
+  // Fall back to the default for a value that isn't a shape (for example, from a newer version).
+  if (crossfade_curve >= CrossfadeCurve::linear && crossfade_curve <= CrossfadeCurve::s_curve)
+    m_crossfade_curve = static_cast<CrossfadeCurve::shape_type>(crossfade_curve);
+  else
+    m_crossfade_curve = CrossfadeCurve::equal_power;
+  xml.child_stream("crossfade_sources", m_crossfade_sources);
 }
 
 void Configuration::set_path(boost::filesystem::path const& path)
@@ -38,16 +52,34 @@ void Configuration::set_path(boost::filesystem::path const& path)
     read_from_disk();
 }
 
-void Configuration::set_capture_ports(std::set<std::string> const& capture_ports)
+void Configuration::set_capture_ports(int channel, std::set<std::string> const& capture_ports)
 {
-  m_changed |= capture_ports != m_capture_ports;
-  m_capture_ports = capture_ports;
+  m_changed |= capture_ports != m_capture_ports[channel];
+  m_capture_ports[channel] = capture_ports;
 }
 
-void Configuration::set_playback_ports(std::set<std::string> const& playback_ports)
+void Configuration::set_playback_ports(int channel, std::set<std::string> const& playback_ports)
 {
-  m_changed |= playback_ports != m_playback_ports;
-  m_playback_ports = playback_ports;
+  m_changed |= playback_ports != m_playback_ports[channel];
+  m_playback_ports[channel] = playback_ports;
+}
+
+void Configuration::set_crossfade_duration(int milliseconds)
+{
+  m_changed |= milliseconds != m_crossfade_duration;
+  m_crossfade_duration = milliseconds;
+}
+
+void Configuration::set_crossfade_curve(CrossfadeCurve::shape_type curve)
+{
+  m_changed |= curve != m_crossfade_curve;
+  m_crossfade_curve = curve;
+}
+
+void Configuration::set_crossfade_sources(int sources)
+{
+  m_changed |= sources != m_crossfade_sources;
+  m_crossfade_sources = sources;
 }
 
 static SingletonInstance<Configuration> dummy __attribute__ ((__unused__));
@@ -22,6 +22,7 @@
 #define CONFIGURATION_H
 
 #include "Persist.h"
+#include "CrossfadeCurve.h"
 #include "utils/Singleton.h"
 #include <string>
 #include <set>
@@ -30,7 +31,7 @@ class Configuration : public Persist, Singleton<Configuration>
 {
     friend_Instance;
   private:
-    Configuration() : m_changed(false) { }
+    Configuration() : m_changed(false), m_crossfade_duration(10), m_crossfade_curve(CrossfadeCurve::equal_power), m_crossfade_sources(16) { }
     ~Configuration() { update(); }
     Configuration(Configuration const&);
 
@@ -38,18 +39,29 @@ class Configuration : public Persist, Singleton<Configuration>
     /*virtual*/ void xml(xml::Bridge& xml);
 
   public:
+    static int const max_channels = 16;         //!< The maximum number of channels that port connections are remembered for.
+
     void set_path(boost::filesystem::path const& path);
-    void set_capture_ports(std::set<std::string> const& capture_ports);
-    void set_playback_ports(std::set<std::string> const& playback_ports);
+    void set_capture_ports(int channel, std::set<std::string> const& capture_ports);
+    void set_playback_ports(int channel, std::set<std::string> const& playback_ports);
+    void set_crossfade_duration(int milliseconds);
+    void set_crossfade_curve(CrossfadeCurve::shape_type curve);
+    void set_crossfade_sources(int sources);
     void update() { if (m_changed) write_to_disk(); }
 
-    std::set<std::string> const& get_capture_ports() const { return m_capture_ports; }
-    std::set<std::string> const& get_playback_ports() const { return m_playback_ports; }
+    std::set<std::string> const& get_capture_ports(int channel) const { return m_capture_ports[channel]; }
+    std::set<std::string> const& get_playback_ports(int channel) const { return m_playback_ports[channel]; }
+    int get_crossfade_duration() const { return m_crossfade_duration; }
+    CrossfadeCurve::shape_type get_crossfade_curve() const { return m_crossfade_curve; }
+    int get_crossfade_sources() const { return m_crossfade_sources; }
 
   private:
     bool m_changed;
-    std::set<std::string> m_playback_ports;     //!< Name of the jack playback ports.
-    std::set<std::string> m_capture_ports;      //!< Name of the jack capture ports.
+    std::set<std::string> m_playback_ports[max_channels];       //!< Name of the jack playback ports, per channel.
+    std::set<std::string> m_capture_ports[max_channels];        //!< Name of the jack capture ports, per channel.
+    int m_crossfade_duration;                                   //!< The duration of a crossfade between two sources, in milliseconds.
+    CrossfadeCurve::shape_type m_crossfade_curve;               //!< The shape of the crossfade.
+    int m_crossfade_sources;                                    //!< The maximum number of sources that a crossfader mixes at the same time.
 };
 
 #endif // CONFIGURATION_H
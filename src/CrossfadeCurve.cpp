@@ -0,0 +1,57 @@
+/**
+ * /file CrossfadeCurve.cpp
+ * /brief Implementation of class CrossfadeCurve.
+ *
+ * Copyright (C) 2016 Aleric Inglewood.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published
+ * by the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "sys.h"
+
+#include "CrossfadeCurve.h"
+#include "NoAllocationScope.h"
+#include "debug.h"
+#include <cmath>
+
+void CrossfadeCurve::build(shape_type shape, jack_nframes_t nframes)
+{
+  DoutEntering(dc::notice, "CrossfadeCurve::build(" << shape << ", " << nframes << ")");
+  NoAllocationScope::check();
+  ASSERT(nframes > 0);
+  m_nframes = nframes;
+  m_gain.resize(2 * (nframes + 1));
+  double const pi = 3.14159265358979323846;
+  for (jack_nframes_t frame = 0; frame <= nframes; ++frame)
+  {
+    double const x = static_cast<double>(frame) / nframes;
+    double gain = x;
+    switch (shape)
+    {
+      case linear:
+        break;
+      case equal_power:
+        gain = std::sin(0.5 * pi * x);
+        break;
+      case s_curve:
+        gain = 0.5 - 0.5 * std::cos(pi * x);
+        break;
+    }
+    m_gain[frame] = gain;
+    m_gain[2 * nframes + 1 - frame] = gain;
+  }
+  // Make sure that the end points are exact.
+  m_gain[0] = m_gain[2 * nframes + 1] = 0.0f;
+  m_gain[nframes] = m_gain[nframes + 1] = 1.0f;
+}
@@ -0,0 +1,71 @@
+/**
+ * \file CrossfadeCurve.h
+ * \brief Declaration of CrossfadeCurve.
+ *
+ * Copyright (C) 2016 Aleric Inglewood.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published
+ * by the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef CROSSFADE_CURVE_H
+#define CROSSFADE_CURVE_H
+
+#include <jack/jack.h>
+#include <vector>
+
+// The gain of a crossfade, precalculated for every frame of the fade.
+//
+// The gain of a source at crossfade frame f (0 <= f <= N) is g(f / N), where g rises from 0 to 1.
+// A source that fades in walks up the curve while the one that fades out walks down,
+// so at any moment the two gains are g(x) and g(1 - x). All shapes are chosen such
+// that the crossfade keeps either the amplitude (g(x) + g(1 - x) = 1) or the power
+// (g(x)^2 + g(1 - x)^2 = 1) constant.
+//
+// The table is stored twice: once for rising and once for falling frames,
+// so that both directions can be processed as a plain multiplication.
+//
+// A curve is built outside the real-time thread and not changed afterwards;
+// CrossfadeProcessor hands a new curve over to the real-time thread instead.
+class CrossfadeCurve
+{
+  public:
+    enum shape_type {
+      linear,           // g(x) = x; constant amplitude, for correlated sources.
+      equal_power,      // g(x) = sin(x pi/2); constant power, for uncorrelated sources.
+      s_curve           // g(x) = (1 - cos(x pi)) / 2; constant amplitude, but starts and ends smoothly.
+                        // Keep s_curve last: Configuration checks that the value read from the configuration file is in range.
+    };
+
+  private:
+    std::vector<float> m_gain;          // g(0) ... g(1) followed by g(1) ... g(0) (2 x (N + 1) values).
+    jack_nframes_t m_nframes;           // The number of frames of the fade (N).
+
+  public:
+    CrossfadeCurve* m_next_retired;     // Used by CrossfadeProcessor for the list of curves that the real-time thread no longer uses.
+
+  public:
+    CrossfadeCurve() : m_nframes(0), m_next_retired(NULL) { }
+
+    // Calculate the gain table. Allocates memory; do not call this from the real-time thread.
+    void build(shape_type shape, jack_nframes_t nframes);
+
+    // Accessors.
+    jack_nframes_t nframes() const { return m_nframes; }
+    // The gains of crossfade frames crossfade_frame, crossfade_frame + 1, ..., N.
+    float const* rising(jack_nframes_t crossfade_frame) const { return &m_gain[crossfade_frame]; }
+    // The gains of crossfade frames crossfade_frame, crossfade_frame - 1, ..., 0.
+    float const* falling(jack_nframes_t crossfade_frame) const { return &m_gain[2 * m_nframes + 1 - crossfade_frame]; }
+};
+
+#endif // CROSSFADE_CURVE_H
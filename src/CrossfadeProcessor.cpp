@@ -22,25 +22,148 @@
 
 #include "JackSwitch.h"
 #include "JackRecorder.h"
+#include "JackSchedule.h"
 #include "Events.h"
+#include "Configuration.h"
+#include "SpectralKernels.h"
 #include "utils/macros.h"
 #include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <algorithm>
 
 CrossfadeProcessor::CrossfadeProcessor(JackSwitch& owner) :
     JackProcessor(DEBUG_ONLY(owner.input().m_name + " \e[48;5;14mCrossfadeProcessor\e[0m")),
-    m_switch(owner), m_active_inputs(0), m_sample_rate(0)
+    m_switch(owner), m_number_of_live_sources(0), m_free_sources(NULL), m_active_inputs(0), m_sample_rate(0),
+    m_crossfade_nframes(0), m_crossfade_curve(NULL), m_next_crossfade_curve(NULL), m_retired_crossfade_curves(NULL), m_inplace_source(NULL)
 {
+  // We need at least room for the new and the previous source.
+  int const pool_size = std::max(2, Singleton<Configuration>::instance().get_crossfade_sources());
+  m_pool.reset(new CrossfadeInput[pool_size]);
+  m_live_sources.reset(new CrossfadeInput*[pool_size]);
+  for (int i = pool_size - 1; i >= 0; --i)
+  {
+    m_pool[i].m_owner = this;
+    m_pool[i].m_next_free = m_free_sources;
+    m_free_sources = &m_pool[i];
+  }
+}
+
+CrossfadeProcessor::~CrossfadeProcessor() noexcept
+{
+  free_retired_crossfade_curves();
+  delete m_next_crossfade_curve.load();
+  delete m_crossfade_curve;
+}
+
+CrossfadeInput* CrossfadeProcessor::acquire_source()
+{
+  CrossfadeInput* source = m_free_sources;
+  if (AI_UNLIKELY(!source))
+    return NULL;
+  m_free_sources = source->m_next_free;
+  source->m_live_index = m_number_of_live_sources;
+  m_live_sources[m_number_of_live_sources++] = source;
+  return source;
+}
+
+void CrossfadeProcessor::release_source(CrossfadeInput* source)
+{
+  ASSERT(source->m_live_index >= 0 && m_live_sources[source->m_live_index] == source);
+  if (source->connected_output())
+    source->disconnect();
+  if (m_inplace_source == source)
+    m_inplace_source = NULL;
+  m_active_inputs -= std::abs(source->m_direction);
+  source->m_direction = 0;
+  source->m_crossfade_frame = 0;
+  // Move the last live source into the hole.
+  CrossfadeInput* last = m_live_sources[--m_number_of_live_sources];
+  m_live_sources[source->m_live_index] = last;
+  last->m_live_index = source->m_live_index;
+  source->m_live_index = -1;
+  source->m_next_free = m_free_sources;
+  m_free_sources = source;
+}
+
+jack_default_audio_sample_t* CrossfadeInput::inplace_buffer() const
+{
+  return m_owner->inplace_buffer_for(this);
+}
+
+jack_nframes_t CrossfadeInput::nframes_inplace_buffer() const
+{
+  return m_owner->JackOutput::nframes();
+}
+
+jack_default_audio_sample_t* CrossfadeProcessor::inplace_buffer_for(CrossfadeInput const* source)
+{
+  jack_default_audio_sample_t* const buffer = JackOutput::chunk_ptr();
+  // Only one source at a time can write to our output buffer.
+  JackOutput const* output = m_inplace_source ? m_inplace_source->connected_output() : NULL;
+  if (m_inplace_source != source && output && output->chunk_ptr() == buffer)
+    return NULL;
+  m_inplace_source = buffer ? source : NULL;
+  return buffer;
+}
+
+void CrossfadeProcessor::buffer_changed()
+{
+  // Let the sources negotiate again about who may write to our output buffer.
+  m_inplace_source = NULL;
+  for (int i = 0; i < m_number_of_live_sources; ++i)
+    if (m_live_sources[i]->connected_output())
+      m_live_sources[i]->connected_output()->update_buffer();
 }
 
 void CrossfadeProcessor::sample_rate_changed(jack_nframes_t sample_rate)
 {
   m_sample_rate = sample_rate;
-  m_crossfade_nframes = m_sample_rate / 50 * 100;     // Suppress output in 20 ms.
-  m_crossfade_frame_normalization = 1.0f / m_crossfade_nframes;
+  Configuration const& configuration(Singleton<Configuration>::instance());
+  jack_nframes_t const crossfade_nframes = std::max((jack_nframes_t)1, std::max(1, configuration.get_crossfade_duration()) * sample_rate / 1000);
+  free_retired_crossfade_curves();
+  CrossfadeCurve* curve = new CrossfadeCurve;
+  curve->build(configuration.get_crossfade_curve(), crossfade_nframes);
+  Dout(dc::notice, "Crossfade curve of " << crossfade_nframes << " frames.");
 
-  Dout(dc::notice, "m_crossfade_nframes set to " << m_crossfade_nframes);
-  // sample_rate_changed() should have been called before this point.
-  ASSERT(m_crossfade_nframes != 0);
+  if (!m_crossfade_curve)
+  {
+    // Not processing yet.
+    m_crossfade_curve = curve;
+    m_crossfade_nframes = crossfade_nframes;
+    return;
+  }
+
+  // Hand the new curve over to the real-time thread. If it didn't pick up the previous one yet then that one was never used.
+  delete m_next_crossfade_curve.exchange(curve, std::memory_order_acq_rel);
+}
+
+// Called from the real-time thread when sample_rate_changed() handed over a new curve.
+void CrossfadeProcessor::adopt_next_crossfade_curve()
+{
+  CrossfadeCurve* old_curve = m_crossfade_curve;
+  m_crossfade_curve = m_next_crossfade_curve.exchange(NULL, std::memory_order_acquire);
+  jack_nframes_t const old_nframes = m_crossfade_nframes;
+  m_crossfade_nframes = m_crossfade_curve->nframes();
+  // Keep inputs that are being crossfaded at the same relative position on the new curve; the end points stay end points.
+  for (int i = 0; i < m_number_of_live_sources; ++i)
+    m_live_sources[i]->m_crossfade_frame = static_cast<uint64_t>(m_live_sources[i]->m_crossfade_frame) * m_crossfade_nframes / old_nframes;
+
+  // We may not free memory in the real-time thread; push the old curve onto the retired list instead.
+  old_curve->m_next_retired = m_retired_crossfade_curves.load(std::memory_order_relaxed);
+  while (!m_retired_crossfade_curves.compare_exchange_weak(old_curve->m_next_retired, old_curve, std::memory_order_release, std::memory_order_relaxed))
+    ;
+}
+
+void CrossfadeProcessor::free_retired_crossfade_curves()
+{
+  CrossfadeCurve* curve = m_retired_crossfade_curves.exchange(NULL, std::memory_order_acquire);
+  while (curve)
+  {
+    CrossfadeCurve* next = curve->m_next_retired;
+    delete curve;
+    curve = next;
+  }
 }
 
 void CrossfadeProcessor::begin(JackOutput& new_source, JackOutput* prev_source)
@@ -51,18 +174,20 @@ void CrossfadeProcessor::begin(JackOutput& new_source, JackOutput* prev_source)
 
   ASSERT(m_active_inputs == 0);
   // Add the new source.
-  ASSERT(!current_source());
-  m_sources[0].m_crossfade_frame = 0;
-  m_sources[0].m_direction = 1;
+  ASSERT(!current_source() && m_number_of_live_sources == 0);
+  CrossfadeInput* source = acquire_source();
+  source->m_crossfade_frame = 0;
+  source->m_direction = 1;
   m_active_inputs = 1;
-  new_source.connect(m_sources[0]);
+  new_source.connect(*source);
   // Add the previous source, if any.
   if (prev_source)
   {
-    m_sources[1].m_crossfade_frame = m_crossfade_nframes;
-    m_sources[1].m_direction = -1;
+    source = acquire_source();
+    source->m_crossfade_frame = m_crossfade_nframes;
+    source->m_direction = -1;
     ++m_active_inputs;
-    prev_source->connect(m_sources[1]);
+    prev_source->connect(*source);
   }
 
   Debug(libcw_do.marker().assign(": ` "));
@@ -76,46 +201,44 @@ void CrossfadeProcessor::add(JackOutput& new_source)
   Debug(libcw_do.push_marker());
   Debug(libcw_do.marker().assign(": | "));
 
-  int index = -1;                                               // new_source wasn't found yet and no place to insert it was determined yet.
-  jack_nframes_t volume = m_crossfade_nframes + 1;              // Larger than any real volume.
-  for (int i = s_max_sources - 1; i >= 0; --i)
+  bool found = false;                                            // Set when new_source is already connected.
+  CrossfadeInput* quietest = NULL;                              // The live source with the lowest volume.
+  for (int i = 0; i < m_number_of_live_sources; ++i)
   {
-    int direction = m_sources[i].m_direction;
+    CrossfadeInput& source(*m_live_sources[i]);
+    int direction = source.m_direction;
     // Set the current input that is fade-in to fade-out.
-    if (direction == 1 || m_sources[i].m_crossfade_frame > 0)
+    if (direction == 1 || source.m_crossfade_frame > 0)
     {
       m_active_inputs += 1 - std::abs(direction);
-      direction = m_sources[i].m_direction = -1;                // Because we do this first, direction == 0 now means that the input is unused.
+      direction = source.m_direction = -1;
     }
-    if (index >= -1)     // new_source wasn't found (yet)?
+    // Check if new_source is already connected.
+    if (source.connected_output() == &new_source)
     {
-      // Look for a place to insert new_source.
-      if (direction == 0 || m_sources[i].m_crossfade_frame < volume)
-      {
-        index = i;                                              // Remember where we found it.
-        volume = m_sources[i].m_crossfade_frame;                // Possibly overwrite an input that has the lowest volume.
-        ASSERT(direction != 0 || volume == 0);                  // If direction == 0 then volume must be zero to prevent us from overwriting index because we find a lower volume.
-      }
-      // Check if new_source is already connected.
-      if (m_sources[i].connected_output() == &new_source)
-      {
-        index = -2;                                             // Mark that we found new_source to be already connected.
-        int const not_max_volume = m_sources[i].m_crossfade_frame < m_crossfade_nframes ? 1 : 0;
-        m_sources[i].m_direction = not_max_volume;              // Start fading it in, if not already at the maximum volume.
-        m_active_inputs += not_max_volume - std::abs(direction);
-      }
+      found = true;
+      int const not_max_volume = source.m_crossfade_frame < m_crossfade_nframes ? 1 : 0;
+      source.m_direction = not_max_volume;                      // Start fading it in, if not already at the maximum volume.
+      m_active_inputs += not_max_volume - std::abs(direction);
     }
+    else if (!quietest || source.m_crossfade_frame < quietest->m_crossfade_frame)
+      quietest = &source;
   }
-  // The first pass through the loop already sets index.
-  ASSERT(index != -1);
   // Connect the new source when it was really new.
-  if (index >= 0)
+  if (!found)
   {
     ASSERT(!current_source());                                  // All sources should be fading down now.
-    m_sources[index].m_crossfade_frame = 0;
-    m_active_inputs += 1 - std::abs(m_sources[index].m_direction);
-    m_sources[index].m_direction = 1;
-    new_source.connect(m_sources[index]);                       // If m_sources[index] is already in use then this will disconnect it first.
+    CrossfadeInput* source = acquire_source();
+    if (AI_UNLIKELY(!source))
+    {
+      // The pool is exhausted; overwrite the input that has the lowest volume.
+      Dout(dc::notice, "CrossfadeProcessor::add: no free inputs left; replacing the quietest source.");
+      source = quietest;
+    }
+    source->m_crossfade_frame = 0;
+    m_active_inputs += 1 - std::abs(source->m_direction);
+    source->m_direction = 1;
+    new_source.connect(*source);                                // If source is already in use then this will disconnect it first.
   }
 
   Debug(libcw_do.marker().assign(": ` "));
@@ -129,60 +252,64 @@ void CrossfadeProcessor::stop_crossfading()
   Debug(libcw_do.push_marker());
   Debug(libcw_do.marker().assign(": | "));
   JackOutput* current_source = NULL;
-  for (int i = 0; i < s_max_sources; ++i)
+  for (int i = 0; i < m_number_of_live_sources; ++i)
   {
-    if (m_sources[i].m_crossfade_frame > 0)
+    CrossfadeInput* source = m_live_sources[i];
+    if (source->m_crossfade_frame > 0)
     {
-      ASSERT(m_sources[i].m_direction == 0 && m_sources[i].m_crossfade_frame == m_crossfade_nframes);
-      current_source = m_sources[i].connected_output();
-      m_sources[i].disconnect();
-      m_sources[i].m_crossfade_frame = 0;
+      ASSERT(source->m_direction == 0 && source->m_crossfade_frame == m_crossfade_nframes);
+      current_source = source->connected_output();
+      release_source(source);
       break;
     }
   }
+  // Every other input was already released by end_of_cycle().
+  ASSERT(m_number_of_live_sources == 0);
   m_switch.stop_crossfading(current_source);
   Debug(libcw_do.marker().assign(": ` "));
   Dout(dc::notice, "Leaving CrossfadeProcessor::stop_crossfading.");
   Debug(libcw_do.pop_marker());
 }
 
-event_type CrossfadeProcessor::fill_output_buffer(int sequence_number)
+void CrossfadeProcessor::add_sources_to(JackSchedule& schedule)
 {
-  if (m_sequence_number == sequence_number)
-    return 0;
-  m_sequence_number = sequence_number;
+  for (int i = 0; i < m_number_of_live_sources; ++i)
+  {
+    JackOutput* source = m_live_sources[i]->connected_output();
+    if (source)
+      schedule.add(*source);
+  }
+}
 
+event_type CrossfadeProcessor::fill_output_buffer()
+{
   event_type events = 0;
 
   // We shouldn't get here when there aren't any active inputs remaining.
   ASSERT(m_active_inputs > 0);
 
-  // Try to fill the input buffer of the active inputs.
-  for (int i = 0; i < s_max_sources; ++i)
+  // The input buffers of the active inputs were already filled; check that none of them failed.
+  for (int i = 0; i < m_number_of_live_sources; ++i)
   {
-    int const direction = m_sources[i].m_direction;
-    if (direction == 0 && m_sources[i].m_crossfade_frame == 0)
+    CrossfadeInput& source(*m_live_sources[i]);
+    int const direction = source.m_direction;
+    if (direction == 0 && source.m_crossfade_frame == 0)
       continue;
-    try
-    {
-      events |= m_sources[i].fill_input_buffer(sequence_number);
-    }
-    catch (BrokenPipe const& error)
+    event_type const broken = source.connected_output()->broken();
+    if (AI_UNLIKELY(broken))
     {
-      Dout(dc::notice, "CrossfadeProcessor::fill_output_buffer: caught BrokenPipe for input \"" << m_sources[i].m_name << "\".");
-      // Disconnect the failed input and mark it as unused.
-      m_sources[i].disconnect();
+      Dout(dc::notice, "CrossfadeProcessor::fill_output_buffer: broken pipe for input \"" << source.m_name << "\".");
+      // Mark the failed input as unused; it is released by end_of_cycle().
       m_active_inputs -= std::abs(direction);
-      m_sources[i].m_direction = 0;
-      m_sources[i].m_crossfade_frame = 0;
-      // An input failed; if this was the last input then stop.
+      source.m_direction = 0;
+      source.m_crossfade_frame = 0;
+      // An input failed; if this was the last input then stop (end_of_cycle() will call stop_crossfading()).
       if (m_active_inputs == 0)
       {
-        Dout(dc::notice, "No active inputs left: abort crossfading and rethrow.");
-        stop_crossfading();
-        throw;
+        Dout(dc::notice, "No active inputs left: abort crossfading.");
+        return broken;
       }
-      events |= error.mask();
+      events |= broken & ~event_bit_broken_pipe;
     }
   }
 
@@ -192,8 +319,20 @@ event_type CrossfadeProcessor::fill_output_buffer(int sequence_number)
   return events;
 }
 
+void CrossfadeProcessor::end_of_cycle()
+{
+  // Release the inputs that became unused (backwards, because release_source() moves the last live source).
+  for (int i = m_number_of_live_sources - 1; i >= 0; --i)
+    if (m_live_sources[i]->m_direction == 0 && m_live_sources[i]->m_crossfade_frame == 0)
+      release_source(m_live_sources[i]);
+  if (m_active_inputs == 0 && m_switch.is_crossfading())  // Did the crossfading finish?
+    stop_crossfading();
+}
+
 void CrossfadeProcessor::generate_output()
 {
+  if (AI_UNLIKELY(m_next_crossfade_curve.load(std::memory_order_relaxed)))
+    adopt_next_crossfade_curve();
   jack_default_audio_sample_t* out = JackOutput::chunk_ptr();
   jack_nframes_t nframes = JackOutput::nframes();
 
@@ -202,16 +341,16 @@ void CrossfadeProcessor::generate_output()
   JackOutput* new_source = NULL;
   Dout(dc::notice|continued_cf, "\e[48;5;5mCrossfading from\e[0m ");
   int count = 0;
-  for (int i = 0; i < s_max_sources; ++i)
+  for (int i = 0; i < m_number_of_live_sources; ++i)
   {
-    if (m_sources[i].m_direction == 0 && m_sources[i].m_crossfade_frame == 0)
+    CrossfadeInput const& source(*m_live_sources[i]);
+    if (source.m_direction == 0 && source.m_crossfade_frame == 0)
     {
-      // An input that has m_direction and m_crossfade_frame set to zero is disconnected.
-      ASSERT(!m_sources[i].connected_output());
+      // An input that has m_direction and m_crossfade_frame set to zero is unused (it is released by end_of_cycle()).
     }
-    else if (m_sources[i].m_direction == -1)
+    else if (source.m_direction == -1)
     {
-      JackOutput* prev_source = m_sources[i].connected_output();
+      JackOutput* prev_source = source.connected_output();
       // An input that is being faded down must be connected.
       ASSERT(prev_source);
       Dout(dc::continued, "[" << prev_source->m_name  << "] ");
@@ -219,10 +358,10 @@ void CrossfadeProcessor::generate_output()
     }
     else
     {
-      ASSERT(m_sources[i].m_direction == 1 || (m_sources[i].m_direction == 0 && m_sources[i].m_crossfade_frame == m_crossfade_nframes));
+      ASSERT(source.m_direction == 1 || (source.m_direction == 0 && source.m_crossfade_frame == m_crossfade_nframes));
       // Only one source can be faded up at a time.
       ASSERT(!new_source);
-      new_source = m_sources[i].connected_output();
+      new_source = source.connected_output();
       // An input that is being faded up must be connected.
       ASSERT(new_source);
     }
@@ -236,57 +375,86 @@ void CrossfadeProcessor::generate_output()
 #endif
 #endif // DEBUG_PROCESS
 
-  // Crossfade. Written slightly hackish because here is where the CPU counts.
-  jack_nframes_t end[3] = { m_crossfade_nframes, 0, 0 };
-
-  // For each frame;
-  jack_nframes_t frame = 0;
-  while (frame < nframes)
+  // Crossfade, one block per source.
+  //
+  // A source that is being faded up (down) has m_crossfade_nframes - m_crossfade_frame (m_crossfade_frame)
+  // frames left before it reaches its end; up to that point its gain is read from m_crossfade_curve, after
+  // that it is constant (one, or zero for an input that is now unused). That way all the real work is done
+  // by the SIMD kernels and the state transitions happen at most once per source per block.
+  //
+  // The source that shares our output buffer (see inplace_buffer_for()) is written first,
+  // before any other source overwrites the samples that it still has to read.
+  bool out_written = false;
+  for (int n = -1; n < m_number_of_live_sources; ++n)
   {
-    // Calculate the output sample from,
-    jack_default_audio_sample_t sample = 0;
-    // all input sources...
-    CrossfadeInput* sourcep = m_sources;
-    for (int i = 0; i < s_max_sources; ++i, ++sourcep)
+    CrossfadeInput* sourcep;
+    if (n == -1)
     {
-      // Cache m_sources[i].
-      jack_nframes_t crossfade_frame = sourcep->m_crossfade_frame;
-      int const direction = sourcep->m_direction;
-
-      // ...that are relevant.
-      if (crossfade_frame == 0 && direction == 0)
+      if (!m_inplace_source)
         continue;
+      sourcep = const_cast<CrossfadeInput*>(m_inplace_source);
+    }
+    else
+    {
+      sourcep = m_live_sources[n];
+      if (sourcep == m_inplace_source)
+        continue;
+    }
+    jack_nframes_t crossfade_frame = sourcep->m_crossfade_frame;
+    int const direction = sourcep->m_direction;
 
-      sample += sourcep->chunk_ptr()[frame] * crossfade_frame;
-      crossfade_frame += direction;
+    // Skip unused inputs.
+    if (crossfade_frame == 0 && direction == 0)
+      continue;
+
+    jack_default_audio_sample_t const* in = sourcep->chunk_ptr();
 
-      // Note that for a fully faded-in current input, direction == 0 and m_crossfade_frame == m_crossfade_nframes
-      // so that the following boolean expression will be false because end[1] is 0 != m_crossfade_nframes.
-      if (AI_UNLIKELY(crossfade_frame == end[1 - direction]))
+    // The number of frames before this source reaches the end of its fade.
+    jack_nframes_t const frames_left = direction == 1 ? m_crossfade_nframes - crossfade_frame : direction == -1 ? crossfade_frame : 0;
+    jack_nframes_t const ramp_nframes = std::min(frames_left, nframes);
+    if (ramp_nframes > 0)
+    {
+      float const* gain = direction == 1 ? m_crossfade_curve->rising(crossfade_frame) : m_crossfade_curve->falling(crossfade_frame);
+      if (out_written)
+        SpectralKernels::multiply_add(out, in, gain, ramp_nframes);
+      else
+        SpectralKernels::multiply(out, in, gain, ramp_nframes);
+      crossfade_frame += direction * static_cast<int>(ramp_nframes);
+      if (ramp_nframes == frames_left)
       {
-        ASSERT(direction != 0);
-        m_sources[i].m_direction = 0;
+        sourcep->m_direction = 0;
         --m_active_inputs;
-        if (direction == -1)
-          m_sources[i].disconnect();
+        // If direction == -1 then the input is now unused and will be released by end_of_cycle().
         Dout(dc::notice, m_active_inputs << " active inputs left.");
       }
+      sourcep->m_crossfade_frame = crossfade_frame;
+    }
 
-      // Store value back.
-      m_sources[i].m_crossfade_frame = crossfade_frame;
+    // The rest of the block has a constant gain.
+    // Note that for a fully faded-in current input, direction == 0 and m_crossfade_frame == m_crossfade_nframes.
+    jack_nframes_t const rest = nframes - ramp_nframes;
+    if (rest > 0)
+    {
+      if (crossfade_frame == m_crossfade_nframes)
+      {
+        if (out_written)
+          SpectralKernels::add(out + ramp_nframes, in + ramp_nframes, rest);
+        else if (out != in)
+          std::memcpy(out + ramp_nframes, in + ramp_nframes, rest * sizeof(jack_default_audio_sample_t));
+      }
+      else if (!out_written)
+        std::memset(out + ramp_nframes, 0, rest * sizeof(jack_default_audio_sample_t));
     }
-    // Store the result.
-    out[frame] = sample * m_crossfade_frame_normalization;
-    ++frame;
+    out_written = true;
   }
+  // Output silence when there are no sources.
+  if (!out_written)
+    std::memset(out, 0, nframes * sizeof(jack_default_audio_sample_t));
 
-  if (m_active_inputs == 0)  // Did the crossfading finish?
-  {
 #if DEBUG_PROCESS
+  if (m_active_inputs == 0)  // Did the crossfading finish?
     Dout(dc::notice, "Crossfading finished!");
 #endif // DEBUG_PROCES
-    stop_crossfading();
-  }
 #if DEBUG_PROCESS
 #ifdef CWDEBUG
   if (!debug_on) LIBCWD_DEBUGCHANNELS::dc::notice.off();
@@ -23,6 +23,9 @@
 
 #include "JackProcessor.h"
 #include "JackSilenceOutput.h"
+#include "CrossfadeCurve.h"
+#include <atomic>
+#include <memory>
 
 class JackSwitch;
 class CrossfadeProcessor;
@@ -31,33 +34,53 @@ class CrossfadeInput : public JackInput
 {
   private:
     friend class CrossfadeProcessor;
-    jack_nframes_t m_crossfade_frame;                   // Volume fraction of previous source (m_crossfade_frame / m_crossfade_nframes), runs from m_crossfade_nframes to 0.
+    CrossfadeProcessor* m_owner;                        // The crossfader that this input belongs to.
+    jack_nframes_t m_crossfade_frame;                   // Position on the crossfade curve (from 0 to m_crossfade_nframes), see CrossfadeCurve.
     int m_direction;                                    // Plus or minus one for respectively fading in or out (zero when we reached the limit or when the input is disconnected).
+    int m_live_index;                                   // Index into CrossfadeProcessor::m_live_sources, or -1 when this input is in the free list.
+    CrossfadeInput* m_next_free;                        // The next input in the free list.
 
   public:
     // Construct a JackInput that represents the input of CrossfadeProcessor.
-    CrossfadeInput() : JackInput(DEBUG_ONLY("\e[48;5;14mCrossfadeProcessor\e[0m")), m_crossfade_frame(0), m_direction(0) { }
+    CrossfadeInput() : JackInput(DEBUG_ONLY("\e[48;5;14mCrossfadeProcessor\e[0m")), m_owner(NULL), m_crossfade_frame(0), m_direction(0), m_live_index(-1), m_next_free(NULL) { }
+
+    // One of the sources may write directly to the output buffer of the crossfader.
+    /*virtual*/ jack_default_audio_sample_t* inplace_buffer() const;
+    /*virtual*/ jack_nframes_t nframes_inplace_buffer() const;
 };
 
 class CrossfadeProcessor : public JackProcessor
 {
   private:
-    static int const s_max_sources = 4;                 // Maximum number of simultaneous inputs.
     JackSwitch& m_switch;                               // Reference to the switch that owns this crossfader.
-    CrossfadeInput m_sources[s_max_sources];            // Array with old inputs that we crossfade away from.
+    std::unique_ptr<CrossfadeInput[]> m_pool;           // All inputs, allocated once (see Configuration::get_crossfade_sources()).
+    std::unique_ptr<CrossfadeInput*[]> m_live_sources;  // The inputs that are in use, in no particular order.
+    int m_number_of_live_sources;                       // The number of elements in m_live_sources.
+    CrossfadeInput* m_free_sources;                     // Singly linked list of the inputs that are not in use.
     int m_active_inputs;                                // The number of inputs that are fading up or down (still changing volume).
-                                                        // Should be equal at all times with the sum of the absolute values of m_direction of all s_max_sources inputs in m_sources.
+                                                        // Should be equal at all times with the sum of the absolute values of m_direction of all live sources.
     jack_nframes_t m_sample_rate;                       // Copy of the sample rate.
     jack_nframes_t m_crossfade_nframes;                 // Number of frames used to crossfade between 0% and 100%.
-    jack_default_audio_sample_t m_crossfade_frame_normalization;        // Precalculated normalization factor.
+    CrossfadeCurve* m_crossfade_curve;                  // The gain of every frame of the crossfade. Only used by the real-time thread.
+    std::atomic<CrossfadeCurve*> m_next_crossfade_curve;        // A new curve built by sample_rate_changed(), or NULL.
+    std::atomic<CrossfadeCurve*> m_retired_crossfade_curves;    // Curves that the real-time thread no longer uses, to be freed by sample_rate_changed().
+    CrossfadeInput const* m_inplace_source;             // The source whose output writes to our output buffer, if any.
 
   private:
+    friend class CrossfadeInput;
     void stop_crossfading();
+    CrossfadeInput* acquire_source();
+    void release_source(CrossfadeInput* source);
+    jack_default_audio_sample_t* inplace_buffer_for(CrossfadeInput const* source);
+    void adopt_next_crossfade_curve();
+    void free_retired_crossfade_curves();
 
   public:
     CrossfadeProcessor(JackSwitch& owner);
-    ~CrossfadeProcessor() noexcept { }
+    ~CrossfadeProcessor() noexcept;
 
+    // Build the crossfade curve for sample_rate and hand it over to the real-time thread.
+    // Can be called while the real-time thread is processing (but not from it).
     void sample_rate_changed(jack_nframes_t sample_rate);
 
     // Accessor.
@@ -65,19 +88,29 @@ class CrossfadeProcessor : public JackProcessor
 
     JackOutput* current_source()
     {
-      for (int i = 0; i < s_max_sources; ++i)
-        if (m_sources[i].m_direction == 1 ||
-            (m_sources[i].m_direction == 0 && m_sources[i].m_crossfade_frame == m_crossfade_nframes))
-          return m_sources[i].connected_output();
+      for (int i = 0; i < m_number_of_live_sources; ++i)
+      {
+        CrossfadeInput const& source(*m_live_sources[i]);
+        if (source.m_direction == 1 || (source.m_direction == 0 && source.m_crossfade_frame == m_crossfade_nframes))
+          return source.connected_output();
+      }
       return NULL;
     }
 
     void begin(JackOutput& new_source, JackOutput* prev_source);
     void add(JackOutput& new_source);
 
+    // Every output sample is calculated from the input samples with the same index, so we can work in place.
+    /*virtual*/ api_type type() const { return api_input_uses_output_buffer | api_output_uses_allocated_or_input_buffer | api_inplace; }
+
     // Read input, process, write output.
-    /*virtual*/ event_type fill_output_buffer(int sequence_number);
+    /*virtual*/ event_type fill_output_buffer();
+    /*virtual*/ void add_sources_to(JackSchedule& schedule);
+    /*virtual*/ void end_of_cycle();
     /*virtual*/ void generate_output();
+
+  protected:
+    /*virtual*/ void buffer_changed();
 };
 
 #endif // CROSSFADE_PROCESSOR_H
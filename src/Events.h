@@ -1,6 +1,6 @@
 /**
  * \file Events.h
- * \brief Declaration of BrokenPipe, event_type and constants.
+ * \brief Declaration of event_type and constants.
  *
  * Copyright (C) 2016 Aleric Inglewood.
  *
@@ -21,23 +21,12 @@
 #ifndef EVENTS_H
 #define EVENTS_H
 
-#include <exception>
-
 typedef int event_type;
 
 event_type const event_bit_try_again = 0x1;
 event_type const event_bit_stop_playback = 0x2;
 event_type const event_bit_stop_recording = 0x4;
-
-class BrokenPipe : public std::exception
-{
-  private:
-    event_type m_event_mask;
-
-  public:
-    BrokenPipe(event_type mask) : m_event_mask(mask) { }
-
-    event_type mask() const { return m_event_mask; }
-};
+event_type const event_bit_broken_pipe = 0x8;           // Returned by JackOutput::fill_output_buffer() when it could not generate output;
+                                                        // the other bits returned with it tell why.
 
 #endif // EVENTS_H
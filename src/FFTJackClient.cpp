@@ -24,97 +24,351 @@
 #include "FFTJackClient.h"
 #include "JackProcessor.h"
 #include "JackChunkAllocator.h"
+#include "RTMemory.h"
+#include "FFTPlanCache.h"
+#include "SpectralKernels.h"
 #include "Events.h"
+#include "Configuration.h"
+#include "WaveFileReader.h"
 #include "utils/macros.h"
+#include "utils/AIAlert.h"
 
 #include <iostream>
 #include <cmath>
+#include <cstring>
 #ifdef PROFILING
 #include <chrono>
 #endif
 
-FFTJackClient::FFTJackClient(char const* name, double period) : JackClient(name), RecordingDeviceState(passthrough),
-  m_fft_buffer_size(0), m_playback_state(0), m_sequence_number(0),
-  m_recorder(m_client, period),
-  m_recording_switch(m_recorder), m_test_switch(m_fft_processor), m_output_switch(m_jack_server_input)
+// m_silence is connected to the output switch of every channel.
+static_assert(JackOutput::s_max_connected_inputs >= Configuration::max_channels, "JackOutput::s_max_connected_inputs is too small.");
+
+FFTJackClient::FFTJackClient(char const* name, double period, int number_of_channels, int number_of_workers) :
+  JackClient(name, number_of_channels), RecordingDeviceState(passthrough),
+  m_fft_buffer_size(0), m_playback_state(0), m_fft_processor(number_of_channels), m_worker_pool(m_client, number_of_workers),
+  m_recorders_in_schedule(false), m_play_takes(false), m_slot_names(1), m_has_preroll(false), m_persist_recordings(false)
 {
-  // Set the size of the FFT buffer, in samples.
-  set_fft_buffer_size(256);
+  m_schedule.set_worker_pool(&m_worker_pool);
+  for (int channel = 0; channel < number_of_channels; ++channel)
+    m_channels.emplace_back(new Channel(m_client, period, m_fft_processor.channel(channel)));
+
+  Dout(dc::notice, "Using " << SpectralKernels::instruction_set() << " spectral kernels.");
+
+  // Let FFTPlanCache make FFTW_PATIENT plans for all sizes in the background, so that switching is instant.
+  // This is done first, so that set_fft_buffer_size doesn't wait for the worker thread to finish a plan.
+  Singleton<FFTPlanCache>::instance().prefetch(256, FFTJackProcessor::s_max_fft_size, number_of_channels, 0);
+  // Set the size of the FFT buffer, in samples. This is independent of the JACK buffer size.
+  set_fft_buffer_size(1024);
 
   // Initialize the switches.
   sample_rate_changed(m_sample_rate);
+
+  // Everything that the real-time thread touches comes from RTMemory. Refuse to start if we can't lock it all:
+  // what is allocated now, plus the chunk pool and two STFT states (the old and the new one while switching).
+  RTMemory& rt_memory(Singleton<RTMemory>::instance());
+  rt_memory.reserve(rt_memory.allocated() +
+      JackChunkAllocator::memory_budget(jack_get_buffer_size(m_client)) +
+      2 * FFTJackProcessor::memory_budget(number_of_channels, FFTJackProcessor::s_max_fft_size));
+}
+
+FFTJackClient::~FFTJackClient()
+{
+  // process() uses the disk writer, m_schedule and the threads of m_worker_pool, which are all destroyed
+  // before ~JackClient closes the client; stop the real-time thread before destroying any of them.
+  deactivate();
+  // The disk writer goes next: its helper thread drains the recording buffers of m_channels, and finishing
+  // the last take calls the take_finished callback of record_compressed(), which uses m_takes, m_takes_mutex,
+  // m_play_takes and m_disk_reader. All of those are still alive until this destructor returns.
+  m_disk_writer.reset();
+}
+
+void FFTJackClient::record_to_disk(std::string const& directory, bool direct_io)
+{
+  DoutEntering(dc::notice, "FFTJackClient::record_to_disk(\"" << directory << "\", " << direct_io << ")");
+  if (m_has_preroll)
+    THROW_ALERT("Recording to disk or compressed is not possible when there is a pre-roll.");
+  std::vector<JackFIFOBuffer*> buffers;
+  for (auto& channel : m_channels)
+  {
+    channel->m_recorder.set_streaming(true);
+    buffers.push_back(&channel->m_recorder.recording_buffer());
+  }
+  m_disk_writer.reset(new JackDiskWriter(buffers, JackDiskWriter::wave_files(directory, direct_io)));
+  m_disk_writer->sample_rate_changed(m_sample_rate);
+}
+
+void FFTJackClient::record_compressed(double prefetch_seconds)
+{
+  DoutEntering(dc::notice, "FFTJackClient::record_compressed(" << prefetch_seconds << ")");
+  if (m_has_preroll)
+    THROW_ALERT("Recording to disk or compressed is not possible when there is a pre-roll.");
+  std::vector<JackFIFOBuffer*> buffers;
+  for (auto& channel : m_channels)
+  {
+    channel->m_recorder.set_streaming(true);
+    buffers.push_back(&channel->m_recorder.recording_buffer());
+  }
+  m_disk_writer.reset(new JackDiskWriter(buffers,
+      [](int channels, jack_nframes_t sample_rate) -> std::shared_ptr<AudioSink>
+      {
+        return std::make_shared<CompressedTake>(channels, sample_rate);
+      },
+      // Called by the helper thread of the disk writer.
+      [this](std::shared_ptr<AudioSink> const& take)
+      {
+        std::shared_ptr<CompressedTake> compressed_take(std::static_pointer_cast<CompressedTake>(take));
+        std::lock_guard<std::mutex> lock(m_takes_mutex);
+        m_takes.push_back(compressed_take);
+        // Holding m_takes_mutex, so that play_from_disk() can't start playing a file in between.
+        if (m_play_takes.load(std::memory_order_acquire))
+          m_disk_reader->set_source(compressed_take);
+        // Let the GUI add the take to its list.
+        if (m_wakeup_gui)
+          m_wakeup_gui();
+      }));
+  m_disk_writer->sample_rate_changed(m_sample_rate);
+  // There is nothing to play until the first take is finished.
+  play_from(std::shared_ptr<AudioSource>(), prefetch_seconds);
+  m_play_takes.store(true, std::memory_order_release);  // m_disk_reader exists now.
+}
+
+size_t FFTJackClient::number_of_takes()
+{
+  std::lock_guard<std::mutex> lock(m_takes_mutex);
+  return m_takes.size();
 }
 
-int FFTJackClient::process(jack_default_audio_sample_t* left, jack_default_audio_sample_t* right, jack_nframes_t nframes)
+void FFTJackClient::play_take(size_t index)
 {
-  DoutEntering(dc::notice, "FFTJackClient::process(" << left << ", " << right << ", " << nframes << ")");
+  DoutEntering(dc::notice, "FFTJackClient::play_take(" << index << ")");
+  std::shared_ptr<CompressedTake> take;
+  {
+    std::lock_guard<std::mutex> lock(m_takes_mutex);
+    if (index >= m_takes.size())
+      return;
+    take = m_takes[index];
+  }
+  m_disk_reader->set_source(take);
+}
+
+void FFTJackClient::set_recording_slots(std::vector<std::string> const& names)
+{
+  DoutEntering(dc::notice, "FFTJackClient::set_recording_slots(" << names.size() << " names)");
+  if (names.empty() || names.size() > (size_t)max_slots)
+    THROW_ALERT("The number of recording slots must be between 1 and [MAX].", AIArgs("[MAX]", max_slots));
+  m_slot_names = names;
+  // The slots are locked in memory too.
+  RTMemory& rt_memory(Singleton<RTMemory>::instance());
+  size_t const allocated = rt_memory.allocated();
+  for (auto& channel : m_channels)
+    channel->m_recorder.set_number_of_slots(names.size());
+  rt_memory.reserve(rt_memory.budget() + rt_memory.allocated() - allocated);
+}
+
+void FFTJackClient::set_preroll(double seconds)
+{
+  DoutEntering(dc::notice, "FFTJackClient::set_preroll(" << seconds << ")");
+  // The disk writer empties the recording buffers and a store is a file; they can't be swapped with the pre-roll ring.
+  if (m_disk_writer)
+    THROW_ALERT("A pre-roll is not possible when recording to disk or compressed.");
+  if (m_persist_recordings)
+    THROW_ALERT("A pre-roll is not possible when the recordings are persisted.");
+  RTMemory& rt_memory(Singleton<RTMemory>::instance());
+  size_t const allocated = rt_memory.allocated();
+  for (auto& channel : m_channels)
+    channel->m_recorder.set_preroll(seconds);
+  rt_memory.reserve(rt_memory.budget() + rt_memory.allocated() - allocated);
+  m_has_preroll = true;
+}
+
+void FFTJackClient::persist_recordings(std::string const& directory)
+{
+  DoutEntering(dc::notice, "FFTJackClient::persist_recordings(\"" << directory << "\")");
+  if (m_has_preroll)
+    THROW_ALERT("The recordings can't be persisted when there is a pre-roll.");
+  m_persist_recordings = true;
+  for (size_t slot = 0; slot < m_slot_names.size(); ++slot)
+  {
+    std::string const prefix = directory + "/recording-" + (m_slot_names[slot].empty() ? std::string() : m_slot_names[slot] + "-");
+    for (size_t channel = 0; channel < m_channels.size(); ++channel)
+    {
+      std::string const path = prefix + std::to_string(channel) + ".fifo";
+      if (m_channels[channel]->m_recorder.recording_buffer(slot).use_store(path))
+        Dout(dc::notice, "Channel " << channel << ": restored the last recording from \"" << path << "\".");
+    }
+  }
+}
+
+void FFTJackClient::play_from_disk(std::string const& filename, double prefetch_seconds)
+{
+  DoutEntering(dc::notice, "FFTJackClient::play_from_disk(\"" << filename << "\", " << prefetch_seconds << ")");
+  std::shared_ptr<WaveFileReader> file(std::make_shared<WaveFileReader>());
+  file->open(filename);
+  if (file->sample_rate() != m_sample_rate)
+    std::cerr << "Warning: \"" << filename << "\" has a sample rate of " << file->sample_rate() << " Hz, but JACK runs at " << m_sample_rate << " Hz." << std::endl;
+  {
+    std::lock_guard<std::mutex> lock(m_takes_mutex);
+    m_play_takes.store(false, std::memory_order_relaxed);
+  }
+  play_from(file, prefetch_seconds);
+}
+
+void FFTJackClient::play_from(std::shared_ptr<AudioSource> const& source, double prefetch_seconds)
+{
+  if (m_disk_reader)
+  {
+    m_disk_reader->set_source(source);
+    return;
+  }
+  jack_nframes_t const nframes = jack_get_buffer_size(m_client);
+  // The prefetch rings are locked in memory too.
+  RTMemory& rt_memory(Singleton<RTMemory>::instance());
+  rt_memory.reserve(rt_memory.budget() + JackDiskReader::memory_budget(m_channels.size(), prefetch_seconds, m_sample_rate, nframes));
+  m_disk_reader.reset(new JackDiskReader(source, m_channels.size(), prefetch_seconds, m_sample_rate, nframes));
+  for (size_t channel = 0; channel < m_channels.size(); ++channel)
+    m_channels[channel]->m_recorder.play_from_disk(m_disk_reader.get(), channel);
+}
+
+// Connect the switches of channel according to statebits.
+void FFTJackClient::route(Channel& channel, int statebits)
+{
+  bool const actually_playback_to_input = (statebits & (playback | playback_to_input)) == (playback | playback_to_input);
+  bool const direct_or_playback_to_input = (statebits & direct) || actually_playback_to_input;
+
+#if 0
+  Dout(dc::notice, "record_input = " << (statebits & record_input) << ", record_output = " << (statebits & record_output) <<
+                   ", playback_to_input = " << (statebits & playback_to_input) << ", direct_or_playback_to_input = " << (direct_or_playback_to_input) <<
+                   " (direct = " << (statebits & direct) <<
+                   "), playback = " << (statebits & playback) << ", passthrough = " << (statebits & passthrough));
+#endif
+
+  if ((statebits & record_input))
+    channel.m_recording_switch << channel.m_jack_server_output;
+  else if ((statebits & record_output))
+    channel.m_recording_switch << channel.m_fft_processor;
+  else if (m_has_preroll)
+    channel.m_recording_switch << channel.m_jack_server_output;    // Keep feeding the pre-roll; no crossfade when recording starts.
+  else
+    channel.m_recording_switch.disconnect();
+
+  if (actually_playback_to_input)
+    channel.m_test_switch << channel.m_recorder;
+  else
+    channel.m_test_switch << channel.m_jack_server_output;
+
+  if (direct_or_playback_to_input)
+    channel.m_output_switch << channel.m_fft_processor;
+  else if ((statebits & playback))
+    channel.m_output_switch << channel.m_recorder;
+  else if ((statebits & passthrough))
+    channel.m_output_switch << channel.m_jack_server_output;
+  else
+    channel.m_output_switch << m_silence;
+}
+
+// Rebuild m_schedule from the inputs that need data with the current routing.
+void FFTJackClient::compile_schedule(int statebits)
+{
+  m_schedule.clear_sinks();
+  bool recording = false;
+  for (auto& channel : m_channels)
+  {
+    bool const still_recording = (statebits & record_mask) || channel->m_recording_switch.is_crossfading();   // (Still) recording?
+    if (still_recording)
+    {
+      m_schedule.add_sink(channel->m_recorder);
+      recording = true;
+    }
+    else if (m_has_preroll)
+      m_schedule.add_sink(channel->m_recorder);
+    // Only go back to the pre-roll ring once the fade out of the take was recorded
+    // (the schedule is compiled again when the crossfade finishes).
+    channel->m_recorder.set_pre_rolling(!still_recording);
+    m_schedule.add_sink(channel->m_jack_server_input);
+  }
+  m_schedule.compile();
+  // The take ends when the recorders stop getting chunks (after the fade out).
+  if (m_disk_writer && m_recorders_in_schedule && !recording)
+    m_disk_writer->end_take();
+  m_recorders_in_schedule = recording;
+}
+
+int FFTJackClient::process(jack_default_audio_sample_t* const* in, jack_default_audio_sample_t* const* out, jack_nframes_t nframes)
+{
+  DoutEntering(dc::notice, "FFTJackClient::process(" << in << ", " << out << ", " << nframes << ")");
 #ifdef PROFILING
   auto start = std::chrono::system_clock::now();
 #endif
 
-  m_jack_server_input.initialize(right, nframes);      // right is the input from the jack server perspective.
-  m_jack_server_output.initialize(left, nframes);
-
-  // So we can jump back on a routing error.
-  while (true)
+  for (size_t n = 0; n < m_channels.size(); ++n)
   {
-    // Starting a new process sequence
-    ++m_sequence_number;
+    m_channels[n]->m_jack_server_input.initialize(out[n], nframes);     // out is the input from the jack server perspective.
+    m_channels[n]->m_jack_server_output.initialize(in[n], nframes);
+  }
 
+  // So we can jump back on a routing error. Every retry stops playback or recording,
+  // so more than two retries is a bug; nevertheless, bound the time spent here.
+  int const max_attempts = 4;
+  for (int attempt = 1;; ++attempt)
+  {
     // Read the state bits.
     int statebits = get_state();
+    bool const state_changed = statebits != m_last_state;
 
-    if (statebits != m_last_state)
+    if (state_changed)
     {
+      // The commands below apply to the selected slots.
+      for (auto& channel : m_channels)
+        channel->m_recorder.select_slots(record_slot(statebits), playback_slot(statebits));
       if (AI_UNLIKELY(statebits & commands_mask))
       {
         if ((statebits & clear_buffer))
         {
-          m_recorder.clear();
+          if (m_disk_writer)
+            m_disk_writer->begin_take();        // The recording buffers belong to the disk writer; a new take is a new file.
+          else if (m_has_preroll && (statebits & record_input))
+            for (auto& channel : m_channels)
+              channel->m_recorder.take_preroll();       // Begin with what was captured before record was pressed.
+          else
+            for (auto& channel : m_channels)
+              channel->m_recorder.clear();
+        }
+        if ((statebits & playback_seek))
+        {
+          // Pairs with the fence in RecordingDeviceState::seek() and set_loop().
+          std::atomic_thread_fence(std::memory_order_acquire);
+          size_t const loop_begin = m_loop_begin.load(std::memory_order_relaxed);
+          size_t const loop_end = m_loop_end.load(std::memory_order_relaxed);
+          size_t const frame = m_seek_frame.exchange(SIZE_MAX, std::memory_order_relaxed);
+          for (auto& channel : m_channels)
+          {
+            channel->m_recorder.set_loop(loop_begin, loop_end);
+            if (frame != SIZE_MAX)
+              channel->m_recorder.seek(frame);
+          }
         }
         if ((statebits & playback_reset))
         {
-          m_recorder.reset_readptr();
+          if (m_disk_reader)
+            m_disk_reader->rewind();
+          else if (!m_disk_writer)
+            for (auto& channel : m_channels)
+              channel->m_recorder.reset_readptr();
         }
         clear_and_set(commands_mask, 0);
       }
-      m_recorder.set_repeat(is_repeat(statebits));
-
-      bool const actually_playback_to_input = (statebits & (playback | playback_to_input)) == (playback | playback_to_input);
-      bool const direct_or_playback_to_input = (statebits & direct) || actually_playback_to_input;
+      for (auto& channel : m_channels)
+        channel->m_recorder.set_repeat(is_repeat(statebits));
+      if (m_disk_reader)
+        m_disk_reader->set_repeat(is_repeat(statebits));
 
 #if DEBUG_PROCESS
       Debug(if (!dc::notice.is_on()) dc::notice.on());
       ASSERT(libcwd::channels::dc::notice.is_on());
 #endif // DEBUG_PROCESS
       Dout(dc::notice, "-----------------------------------------------");
-#if 0
-      Dout(dc::notice, "record_input = " << (statebits & record_input) << ", record_output = " << (statebits & record_output) <<
-                       ", playback_to_input = " << (statebits & playback_to_input) << ", direct_or_playback_to_input = " << (direct_or_playback_to_input) <<
-                       " (direct = " << (statebits & direct) <<
-                       "), playback = " << (statebits & playback) << ", passthrough = " << (statebits & passthrough));
-#endif
-
-      if ((statebits & record_input))
-        m_recording_switch << m_jack_server_output;
-      else if ((statebits & record_output))
-        m_recording_switch << m_fft_processor;
-      else
-        m_recording_switch.disconnect();
-
-      if (actually_playback_to_input)
-        m_test_switch << m_recorder;
-      else
-        m_test_switch << m_jack_server_output;
-
-      if (direct_or_playback_to_input)
-        m_output_switch << m_fft_processor;
-      else if ((statebits & playback))
-        m_output_switch << m_recorder;
-      else if ((statebits & passthrough))
-        m_output_switch << m_jack_server_output;
-      else
-        m_output_switch << m_silence;
+      for (auto& channel : m_channels)
+        route(*channel, statebits);
 
       m_last_state = statebits;
     }
@@ -125,26 +379,14 @@ int FFTJackClient::process(jack_default_audio_sample_t* left, jack_default_audio
     }
 #endif // DEBUG_PROCESS
 
-    // Attempt to fill the input buffers that we have.
-    event_type events = 0;
-    try
-    {
-      // Fill recorder.
-      if ((statebits & record_mask) || m_recording_switch.is_crossfading()) // (Still) recording?
-      {
-        events |= m_recorder.fill_input_buffer(m_sequence_number);
-      }
+    // Connections change when a crossfade finishes, so the schedule can also be outdated when statebits didn't change.
+    if (state_changed || m_schedule.is_outdated())
+      compile_schedule(statebits);
 
-      // Fill JACK server.
-      events |= m_jack_server_input.fill_input_buffer(m_sequence_number);
-    }
-    catch (BrokenPipe const& error)
-    {
-      Dout(dc::notice, "FFTJackClient::process: caught BrokenPipe");
-      // With the current position of the switches we cannot create the necessary output!
-      events |= event_bit_try_again;    // If the pipe broke then the code below should change the routing,
-      events |= error.mask();           // using these events, after which we need to try again.
-    }
+    // Attempt to fill the input buffers that we have. If a pipe broke then event_bit_try_again is set:
+    // with the current position of the switches we cannot create the necessary output. The code
+    // below should change the routing, using these events, after which we need to try again.
+    event_type events = m_schedule.run();
 
     if (AI_UNLIKELY(events))
     {
@@ -157,6 +399,9 @@ int FFTJackClient::process(jack_default_audio_sample_t* left, jack_default_audio
 #endif // DEBUG_PROCESS
         // Recording buffer is empty, mute the output.
         set_playback_state(statebits & (direct | passthrough));
+        // The next playback starts at the beginning of the file again.
+        if (m_disk_reader)
+          m_disk_reader->rewind();
       }
       if ((events & event_bit_stop_recording))
       {
@@ -175,12 +420,19 @@ int FFTJackClient::process(jack_default_audio_sample_t* left, jack_default_audio
       {
         // Routing should be changed now.
         ASSERT(get_state() != m_last_state);
-        continue;                       // Retry filling the output buffer.
+        if (AI_LIKELY(attempt < max_attempts))
+          continue;                     // Retry filling the output buffer.
+        // Give up for this cycle: output silence.
+        for (size_t n = 0; n < m_channels.size(); ++n)
+          std::memset(out[n], 0, nframes * sizeof(jack_default_audio_sample_t));
       }
     }
     break;
   }
 
+  if (m_disk_writer && m_recorders_in_schedule)
+    m_disk_writer->recorded(nframes);
+
 #ifdef PROFILING
   auto duration = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::system_clock::now() - start);
 #ifdef CWDEBUG
@@ -199,33 +451,45 @@ int FFTJackClient::process(jack_default_audio_sample_t* left, jack_default_audio
 
 void FFTJackClient::calculate_delay(jack_latency_range_t& range)
 {
-  range.min = range.max = m_fft_buffer_size - m_input_buffer_size;
+  range.min = range.max = m_fft_processor.latency(m_input_buffer_size);
 }
 
-void FFTJackClient::set_fft_buffer_size(jack_nframes_t nframes)
+void FFTJackClient::set_fft_buffer_size(jack_nframes_t nframes, jack_nframes_t hop_size)
 {
-  m_fft_buffer_size = std::max(m_input_buffer_size, nframes);
-  Dout(dc::notice, "FFT buffer size: " << m_fft_buffer_size << " samples.");
+  m_fft_buffer_size = nframes;
+  m_fft_processor.set_fft_size(nframes, hop_size ? hop_size : nframes / 4);
+  Dout(dc::notice, "FFT buffer size: " << m_fft_buffer_size << " samples; hop size: " << m_fft_processor.hop_size() << " samples.");
+  // The latency depends on the FFT size.
+  jack_recompute_total_latencies(m_client);
 }
 
 void FFTJackClient::buffer_size_changed()
 {
-  // The FFT buffer must be at least as large as the input buffer.
-  if (m_fft_buffer_size < m_input_buffer_size)
-  {
-    set_fft_buffer_size(m_input_buffer_size);
-  }
-
+  // Write out what is still in the recording buffers before they are reallocated.
+  std::unique_lock<std::mutex> disk_writer_lock;
+  if (m_disk_writer)
+    disk_writer_lock = m_disk_writer->flush();
   // Make sure that our internal buffers are large enough.
-  m_recorder.buffer_size_changed(m_input_buffer_size);
+  for (auto& channel : m_channels)
+    channel->m_recorder.buffer_size_changed(m_input_buffer_size);
+  if (m_disk_reader)
+    m_disk_reader->buffer_size_changed(m_input_buffer_size);
+  m_fft_processor.buffer_size_changed(m_input_buffer_size);
   JackChunkAllocator::instance().buffer_size_changed(m_input_buffer_size);
   m_silence.buffer_size_changed(m_input_buffer_size);      // Must be called after JackChunkAllocator::buffer_size_changed.
+  // Compiling the schedule replaces the buffers of the old size.
+  m_schedule.invalidate();
 }
 
 int FFTJackClient::sample_rate_changed(jack_nframes_t sample_rate)
 {
-  m_recording_switch.sample_rate_changed(sample_rate);
-  m_test_switch.sample_rate_changed(sample_rate);
-  m_output_switch.sample_rate_changed(sample_rate);
+  for (auto& channel : m_channels)
+  {
+    channel->m_recording_switch.sample_rate_changed(sample_rate);
+    channel->m_test_switch.sample_rate_changed(sample_rate);
+    channel->m_output_switch.sample_rate_changed(sample_rate);
+  }
+  if (m_disk_writer)
+    m_disk_writer->sample_rate_changed(sample_rate);
   return 0;
 }
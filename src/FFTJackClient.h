@@ -30,41 +30,114 @@
 #include "JackServerInput.h"
 #include "JackServerOutput.h"
 #include "JackSilenceOutput.h"
+#include "JackSchedule.h"
+#include "JackWorkerPool.h"
+#include "JackDiskWriter.h"
+#include "JackDiskReader.h"
+#include "CompressedTake.h"
 
 #include <fftw3.h>
 #include <atomic>
 #include <cassert>
 #include <memory>
+#include <mutex>
+#include <vector>
 #include <complex>
+#include <string>
 
 class FFTJackClient : public JackClient, public RecordingDeviceState
 {
   protected:
+    // The processing graph of a single channel. All channels are routed the same way.
+    struct Channel
+    {
+      JackServerInput m_jack_server_input;
+      JackServerOutput m_jack_server_output;
+      JackRecorder m_recorder;
+      FFTJackProcessor::Channel& m_fft_processor;       // This channel of FFTJackClient::m_fft_processor.
+      JackSwitch m_recording_switch;
+      JackSwitch m_test_switch;
+      JackSwitch m_output_switch;
+
+      Channel(jack_client_t* client, double period, FFTJackProcessor::Channel& fft_processor) :
+          m_recorder(client, period), m_fft_processor(fft_processor),
+          m_recording_switch(m_recorder), m_test_switch(m_fft_processor), m_output_switch(m_jack_server_input) { }
+    };
+
     jack_nframes_t m_fft_buffer_size;
     int m_playback_state;
-    int m_sequence_number;
-    JackServerInput m_jack_server_input;
-    JackServerOutput m_jack_server_output;
-    JackRecorder m_recorder;
-    FFTJackProcessor m_fft_processor;
-    JackSilenceOutput m_silence;
-    JackSwitch m_recording_switch;
-    JackSwitch m_test_switch;
-    JackSwitch m_output_switch;
+    JackSilenceOutput m_silence;                // Shared by all channels.
+    FFTJackProcessor m_fft_processor;           // Processes all channels at once.
+    std::vector<std::unique_ptr<Channel>> m_channels;
+    JackWorkerPool m_worker_pool;               // Threads that run independent parts of m_schedule in parallel.
+    JackSchedule m_schedule;                    // The outputs to fill every cycle, in order.
+    // Destroyed explicitly by ~FFTJackClient, after deactivate(), because its helper thread uses the members around it.
+    std::unique_ptr<JackDiskWriter> m_disk_writer;      // Non-NULL when recordings are streamed to disk.
+    bool m_recorders_in_schedule;               // Set when the recorders are sinks of m_schedule.
+    std::unique_ptr<JackDiskReader> m_disk_reader;      // Non-NULL when playing back a file or the compressed takes.
+    std::vector<std::shared_ptr<CompressedTake>> m_takes;       // The compressed takes, oldest first.
+    std::mutex m_takes_mutex;                   // Protects m_takes, to which the disk writer adds.
+    std::atomic<bool> m_play_takes;             // Set when m_disk_reader plays the last compressed take. Only cleared with m_takes_mutex locked.
+    std::vector<std::string> m_slot_names;      // The names of the recording slots of every channel.
+    bool m_has_preroll;                         // Set when the recorders are fed a pre-roll while not recording.
+    bool m_persist_recordings;                  // Set when persist_recordings() was called.
 
   public:
-    FFTJackClient(char const* name, double period);
-    virtual ~FFTJackClient() { }
+    // The graph is processed by the JACK process thread plus number_of_workers worker threads.
+    FFTJackClient(char const* name, double period, int number_of_channels = 1, int number_of_workers = 0);
+    virtual ~FFTJackClient();
+
+    // Set the FFT size and hop size (in samples) of the test processor.
+    // A hop_size of zero means a quarter of the FFT size (75% overlap).
+    // Can be called while the client is active (but not from the real-time thread).
+    void set_fft_buffer_size(jack_nframes_t nframes, jack_nframes_t hop_size = 0);
+
+    // Stream every take to a new WAV file in directory, instead of keeping it in memory.
+    // The recording buffer then only needs to cover the longest disk stall. Must be called before activate().
+    void record_to_disk(std::string const& directory, bool direct_io);
+
+    // Keep every take in memory, compressed losslessly, instead of only the last recording in the recording buffer.
+    // The last take is played back with prefetch_seconds of read-ahead. Must be called before activate().
+    void record_compressed(double prefetch_seconds);
+
+    // The number of compressed takes.
+    size_t number_of_takes();
+
+    // Play back compressed take index (zero is the oldest) instead of the last one, for comparison.
+    // The next take that is finished is played back again.
+    void play_take(size_t index);
 
-    void set_fft_buffer_size(jack_nframes_t nframes);
+    // Give every channel a recording slot for each name (at most max_slots); select them with set_record_slot() and set_playback_slot().
+    // Must be called before activate() and persist_recordings().
+    void set_recording_slots(std::vector<std::string> const& names);
+
+    // Start every take with the last seconds of input before record was pressed. Not possible together with record_to_disk(),
+    // record_compressed() or persist_recordings(): throws AIAlert::Error when one of those was called. Must be called before activate().
+    void set_preroll(double seconds);
+
+    // Keep the recording buffers in files in directory, so that the last recording is still there after a restart.
+    // Must be called before activate().
+    void persist_recordings(std::string const& directory);
+
+    // Play back filename, streamed from disk with prefetch_seconds of read-ahead, instead of the recording buffer.
+    // Must be called before activate().
+    void play_from_disk(std::string const& filename, double prefetch_seconds);
+
+    // Accessor.
+    std::vector<std::string> const& slot_names() const { return m_slot_names; }
 
   protected:
     // Inherited from JackClient.
     /*virtual*/ void calculate_delay(jack_latency_range_t& range);
-    /*virtual*/ int process(jack_default_audio_sample_t* in, jack_default_audio_sample_t* out, jack_nframes_t nframes);
+    /*virtual*/ int process(jack_default_audio_sample_t* const* in, jack_default_audio_sample_t* const* out, jack_nframes_t nframes);
     /*virtual*/ void buffer_size_changed();
     /*virtual*/ int sample_rate_changed(jack_nframes_t sample_rate);
 
+  private:
+    void route(Channel& channel, int statebits);
+    void compile_schedule(int statebits);
+    void play_from(std::shared_ptr<AudioSource> const& source, double prefetch_seconds);
+
   private:
     FFTJackClient(FFTJackClient const&);
     FFTJackClient(FFTJackClient&&);
@@ -21,42 +21,356 @@
 #include "sys.h"
 
 #include "FFTJackProcessor.h"
+#include "SpectralKernels.h"
+#include "JackSchedule.h"
+#include "NoAllocationScope.h"
+#include "RTMemory.h"
+#include "utils/AIAlert.h"
+#include "utils/macros.h"
 #include <fftw3.h>
+#include <algorithm>
+#include <cstring>
+#include <cmath>
 
-FFTJackProcessor::FFTJackProcessor() DEBUG_ONLY(: JackProcessor("FFTJackProcessor"))
+namespace {
+
+jack_nframes_t greatest_common_divisor(jack_nframes_t a, jack_nframes_t b)
+{
+  while (b)
+  {
+    jack_nframes_t r = a % b;
+    a = b;
+    b = r;
+  }
+  return a;
+}
+
+jack_nframes_t round_up_to_power_of_two(jack_nframes_t n)
+{
+  jack_nframes_t result = 1;
+  while (result < n)
+    result <<= 1;
+  return result;
+}
+
+// Return locked, prefaulted and zeroed memory for size floats.
+float* alloc_real(jack_nframes_t size)
+{
+  return Singleton<RTMemory>::instance().allocate_array<float>(size);
+}
+
+void free_real(float* array, jack_nframes_t size)
+{
+  Singleton<RTMemory>::instance().deallocate_array(array, size);
+}
+
+} // namespace
+
+//-----------------------------------------------------------------------------
+// FFTJackProcessor::STFTState
+
+FFTJackProcessor::STFTState::STFTState(int channels, jack_nframes_t fft_size, jack_nframes_t hop_size) :
+  m_channels(channels), m_fft_size(fft_size), m_hop_size(hop_size), m_hop_fill(0), m_output_read(0), m_output_write(0), m_next_retired(NULL)
+{
+  // Calculate the windows. The overlap-add of N / H Hann windows that are H apart sums to N / (2 H),
+  // and FFTW's backward transform scales by N; compensate for both in the synthesis window.
+  m_analysis_window = alloc_real(fft_size);
+  m_synthesis_window = alloc_real(fft_size);
+  float const synthesis_normalization = 2.0f * hop_size / fft_size / fft_size;
+  for (jack_nframes_t i = 0; i < fft_size; ++i)
+  {
+    float const sqrt_hann = std::sqrt(0.5f - 0.5f * std::cos(2.0f * static_cast<float>(M_PI) * i / fft_size));
+    m_analysis_window[i] = sqrt_hann;
+    m_synthesis_window[i] = sqrt_hann * synthesis_normalization;
+  }
+
+  m_input_frame = alloc_real(channels * fft_size);
+  m_overlap_add = alloc_real(channels * fft_size);
+
+  // Between two reads of B samples, at most B + H - gcd(B, H) samples are queued.
+  jack_nframes_t const capacity = round_up_to_power_of_two(s_max_buffer_size + hop_size);
+  m_output_queue = alloc_real(channels * capacity);
+  m_output_queue_mask = capacity - 1;
+
+  // Prepare FFTW. All channels are transformed with a single plan.
+  m_fftwf_real_array = alloc_real(channels * fft_size);
+  m_fftwf_complex_array = Singleton<RTMemory>::instance().allocate_array<fftwf_complex>(channels * (fft_size / 2 + 1));
+  FFTPlanCache& plan_cache(Singleton<FFTPlanCache>::instance());
+  int const alignment = fftwf_alignment_of(m_fftwf_real_array);
+  m_r2c_plan = &plan_cache.plan(fft_size, channels, FFTPlanCache::real_to_complex, alignment);
+  m_c2r_plan = &plan_cache.plan(fft_size, channels, FFTPlanCache::complex_to_real, alignment);
+}
+
+FFTJackProcessor::STFTState::~STFTState()
+{
+  free_real(m_analysis_window, m_fft_size);
+  free_real(m_synthesis_window, m_fft_size);
+  free_real(m_input_frame, m_channels * m_fft_size);
+  free_real(m_overlap_add, m_channels * m_fft_size);
+  free_real(m_output_queue, m_channels * (m_output_queue_mask + 1));
+  free_real(m_fftwf_real_array, m_channels * m_fft_size);
+  Singleton<RTMemory>::instance().deallocate_array(m_fftwf_complex_array, m_channels * (m_fft_size / 2 + 1));
+}
+
+void FFTJackProcessor::STFTState::prime(jack_nframes_t buffer_size)
+{
+  // Put H - gcd(B, H) samples of silence in the output queue so that it never runs dry between two hops.
+  // The queue must be empty and zeroed.
+  m_output_read = 0;
+  m_output_write = m_hop_size - greatest_common_divisor(buffer_size, m_hop_size);
+}
+
+void FFTJackProcessor::STFTState::reset(jack_nframes_t buffer_size)
+{
+  std::memset(m_input_frame, 0, m_channels * m_fft_size * sizeof(float));
+  std::memset(m_overlap_add, 0, m_channels * m_fft_size * sizeof(float));
+  std::memset(m_output_queue, 0, m_channels * (m_output_queue_mask + 1) * sizeof(float));
+  m_hop_fill = 0;
+  prime(buffer_size);
+}
+
+void FFTJackProcessor::STFTState::process_frame()
+{
+  jack_nframes_t const fft_size = m_fft_size;
+  jack_nframes_t const hop_size = m_hop_size;
+  jack_nframes_t const queue_size = m_output_queue_mask + 1;
+
+  // Window the last N input samples of every channel and slide the analysis buffers by one hop.
+  for (int channel = 0; channel < m_channels; ++channel)
+  {
+    float* input_frame = m_input_frame + channel * fft_size;
+    SpectralKernels::multiply(m_fftwf_real_array + channel * fft_size, input_frame, m_analysis_window, fft_size);
+    std::memmove(input_frame, input_frame + hop_size, (fft_size - hop_size) * sizeof(float));
+  }
+
+  // Perform test operation.
+  fftwf_execute_dft_r2c(m_r2c_plan->get(), m_fftwf_real_array, m_fftwf_complex_array);
+  SpectralKernels::replace_by_magnitude(m_complex_array, m_channels * (fft_size / 2 + 1));
+  fftwf_execute_dft_c2r(m_c2r_plan->get(), m_fftwf_complex_array, m_fftwf_real_array);
+
+  ASSERT(m_output_write - m_output_read + hop_size <= queue_size);
+  jack_nframes_t const write = m_output_write & m_output_queue_mask;
+  jack_nframes_t const len = std::min(hop_size, queue_size - write);
+  for (int channel = 0; channel < m_channels; ++channel)
+  {
+    // Overlap-add. The synthesis window also normalizes.
+    float* overlap_add = m_overlap_add + channel * fft_size;
+    SpectralKernels::multiply_add(overlap_add, m_fftwf_real_array + channel * fft_size, m_synthesis_window, fft_size);
+
+    // The first hop of the accumulator is now complete; move it to the output queue.
+    float* output_queue = m_output_queue + channel * queue_size;
+    std::memcpy(output_queue + write, overlap_add, len * sizeof(float));
+    std::memcpy(output_queue, overlap_add + len, (hop_size - len) * sizeof(float));
+    std::memmove(overlap_add, overlap_add + hop_size, (fft_size - hop_size) * sizeof(float));
+    std::memset(overlap_add + fft_size - hop_size, 0, hop_size * sizeof(float));
+  }
+  m_output_write += hop_size;
+}
+
+void FFTJackProcessor::STFTState::process(jack_default_audio_sample_t const* const* in, jack_default_audio_sample_t* const* out, jack_nframes_t nframes)
+{
+  // Feed the input to the analysis buffers, processing a frame every time a hop is complete.
+  jack_nframes_t frame = 0;
+  while (frame < nframes)
+  {
+    jack_nframes_t const len = std::min(nframes - frame, m_hop_size - m_hop_fill);
+    for (int channel = 0; channel < m_channels; ++channel)
+    {
+      float* current_hop = m_input_frame + (channel + 1) * m_fft_size - m_hop_size;
+      if (in[channel])
+        std::memcpy(current_hop + m_hop_fill, in[channel] + frame, len * sizeof(float));
+      else
+        std::memset(current_hop + m_hop_fill, 0, len * sizeof(float));
+    }
+    m_hop_fill += len;
+    frame += len;
+    if (m_hop_fill == m_hop_size)
+    {
+      process_frame();
+      m_hop_fill = 0;
+    }
+  }
+
+  // Write nframes finished samples of every channel to the output.
+  ASSERT(m_output_write - m_output_read >= nframes);
+  jack_nframes_t const queue_size = m_output_queue_mask + 1;
+  jack_nframes_t const read = m_output_read & m_output_queue_mask;
+  jack_nframes_t const len = std::min(nframes, queue_size - read);
+  for (int channel = 0; channel < m_channels; ++channel)
+  {
+    if (!out[channel])
+      continue;
+    float const* output_queue = m_output_queue + channel * queue_size;
+    std::memcpy(out[channel], output_queue + read, len * sizeof(float));
+    std::memcpy(out[channel] + len, output_queue, (nframes - len) * sizeof(float));
+  }
+  m_output_read += nframes;
+}
+
+//-----------------------------------------------------------------------------
+// FFTJackProcessor::Channel
+
+void FFTJackProcessor::Channel::add_sources_to(JackSchedule& schedule)
+{
+  Channel& first(m_owner.channel(0));
+  if (this != &first)
+  {
+    // The output of all channels is written by the first channel.
+    schedule.add(first);
+    return;
+  }
+  for (auto& channel : m_owner.m_channel_nodes)
+    if (channel->connected_output())
+      schedule.add(*channel->connected_output());
+}
+
+event_type FFTJackProcessor::Channel::fill_output_buffer()
+{
+  Channel& first(m_owner.channel(0));
+  if (this == &first)
+    return m_owner.fill_output_buffers();
+  // Our output was already written when the first channel was filled.
+  if (AI_UNLIKELY(first.broken()))
+    return first.broken();
+  return 0;
+}
+
+//-----------------------------------------------------------------------------
+// FFTJackProcessor
+
+FFTJackProcessor::FFTJackProcessor(int number_of_channels) :
+  m_input_chunks(number_of_channels), m_output_chunks(number_of_channels),
+  m_fft_size(0), m_hop_size(0), m_buffer_size(0), m_state(NULL), m_next_state(NULL), m_retired_states(NULL)
+{
+  for (int channel = 0; channel < number_of_channels; ++channel)
+    m_channel_nodes.emplace_back(new Channel(*this));
+  // Nothing is allocated or planned until set_fft_size() is called.
+}
+
+//static
+size_t FFTJackProcessor::memory_budget(int number_of_channels, jack_nframes_t fft_size)
+{
+  // The two windows, the input frame, the overlap-add accumulator, the output queue and the FFTW arrays; the largest hop size is fft_size / 2.
+  size_t const output_queue_size = round_up_to_power_of_two(s_max_buffer_size + fft_size / 2);
+  size_t const floats = 2 * fft_size + number_of_channels * (3 * fft_size + output_queue_size + 2 * (fft_size / 2 + 1));
+  size_t const page_rounding = 7 * Singleton<RTMemory>::instance().page_size();
+  return floats * sizeof(float) + page_rounding;
+}
+
+FFTJackProcessor::~FFTJackProcessor()
+{
+  free_retired_states();
+  delete m_next_state.load();
+  delete m_state;
+}
+
+void FFTJackProcessor::set_fft_size(jack_nframes_t fft_size, jack_nframes_t hop_size)
 {
-  // Prepare FFTW.
-  m_fftwf_real_array = fftwf_alloc_real(256);
-  m_fftwf_complex_array = fftwf_alloc_complex(256);
-  Dout(dc::notice, "Calling fftwf_plan_dft_r2c_1d()");
-  m_r2c_plan = fftwf_plan_dft_r2c_1d(256, m_fftwf_real_array, m_fftwf_complex_array, FFTW_PATIENT);
-  Dout(dc::notice, "Calling fftwf_plan_dft_c2r_1d()");
-  m_c2r_plan = fftwf_plan_dft_c2r_1d(256, m_fftwf_complex_array, m_fftwf_real_array, FFTW_PATIENT | FFTW_DESTROY_INPUT);
-  Dout(dc::notice, "Done()");
+  DoutEntering(dc::notice, "FFTJackProcessor::set_fft_size(" << fft_size << ", " << hop_size << ")");
+  NoAllocationScope::check();
+
+  // The product of the two square-root Hann windows only sums to a constant when the hop size divides N / 2.
+  if (hop_size == 0 || fft_size % 2 != 0 || (fft_size / 2) % hop_size != 0)
+  {
+    THROW_ALERT("Invalid STFT parameters: the hop size ([HOP]) must divide half the FFT size ([FFT]).",
+        AIArgs("[HOP]", hop_size)("[FFT]", fft_size));
+  }
+
+  free_retired_states();
+  STFTState* state = new STFTState(number_of_channels(), fft_size, hop_size);
+  m_fft_size = fft_size;
+  m_hop_size = hop_size;
+
+  if (!m_state)
+  {
+    // The real-time thread never processes without a state.
+    state->prime(m_buffer_size);
+    m_state = state;
+    return;
+  }
+
+  // Hand the new state over to the real-time thread. If it didn't pick up the previous one yet then that one was never used.
+  delete m_next_state.exchange(state, std::memory_order_acq_rel);
+}
+
+void FFTJackProcessor::buffer_size_changed(jack_nframes_t nframes)
+{
+  if (nframes > s_max_buffer_size)
+  {
+    THROW_ALERT("The JACK buffer size ([NFRAMES]) is larger than the supported maximum of [MAX] frames.",
+        AIArgs("[NFRAMES]", nframes)("[MAX]", s_max_buffer_size));
+  }
+  m_buffer_size = nframes;
+  // A pending m_next_state is primed when it is adopted.
+  if (m_state)
+    m_state->reset(nframes);
+  Dout(dc::notice, "FFTJackProcessor latency: " << latency(nframes) << " samples.");
+}
+
+jack_nframes_t FFTJackProcessor::latency(jack_nframes_t nframes) const
+{
+  if (!m_fft_size || !nframes)
+    return 0;
+  // The input is delayed N - H samples by the analysis buffer, and another H - gcd(B, H) samples
+  // of silence are put in the output queue so that it never runs dry between two hops.
+  return m_fft_size - greatest_common_divisor(nframes, m_hop_size);
 }
 
-void FFTJackProcessor::generate_output()
+// Called from fill_output_buffers() when set_fft_size() handed over a new state.
+void FFTJackProcessor::adopt_next_state()
 {
-  jack_default_audio_sample_t const* test_in = this->JackInput::chunk_ptr();
-  jack_default_audio_sample_t* test_out = this->JackOutput::chunk_ptr();
-  jack_nframes_t const nframes = this->JackInput::nframes();
-  ASSERT(nframes == this->JackOutput::nframes());
+  STFTState* old_state = m_state;
+  m_state = m_next_state.exchange(NULL, std::memory_order_acquire);
+  m_state->prime(m_buffer_size);
 
-  // Make sure the arrays are properly aligned.
-  assert(fftwf_alignment_of(const_cast<jack_default_audio_sample_t*>(test_in)) == fftwf_alignment_of(m_fftwf_real_array));
-  assert(fftwf_alignment_of(test_out) == fftwf_alignment_of(m_fftwf_real_array));
+  // We may not free memory in the real-time thread; push the old state onto the retired list instead.
+  old_state->m_next_retired = m_retired_states.load(std::memory_order_relaxed);
+  while (!m_retired_states.compare_exchange_weak(old_state->m_next_retired, old_state, std::memory_order_release, std::memory_order_relaxed))
+    ;
+}
 
-  // Perform test operation. The const_cast is allowed because we are not using FFTW_DESTROY_INPUT for m_r2c_plan.
-  fftwf_execute_dft_r2c(m_r2c_plan, const_cast<jack_default_audio_sample_t*>(test_in), m_fftwf_complex_array);
-  for (jack_nframes_t freq = 0; freq <= nframes / 2; ++freq)
+void FFTJackProcessor::free_retired_states()
+{
+  STFTState* state = m_retired_states.exchange(NULL, std::memory_order_acquire);
+  while (state)
   {
-    m_complex_array[freq] = std::abs(m_complex_array[freq]);
+    STFTState* next = state->m_next_retired;
+    delete state;
+    state = next;
   }
-  fftwf_execute_dft_c2r(m_c2r_plan, m_fftwf_complex_array, test_out);
+}
+
+event_type FFTJackProcessor::fill_output_buffers()
+{
+  event_type events = 0;
 
-  // Normalize.
-  for (jack_nframes_t frame = 0; frame < nframes; ++frame)
+  // The input buffers of all channels were already filled. Channels without input are processed as silence.
+  int const number_of_channels = m_channel_nodes.size();
+  for (int n = 0; n < number_of_channels; ++n)
   {
-    test_out[frame] /= nframes;
+    Channel& channel(*m_channel_nodes[n]);
+    JackOutput* source = channel.connected_output();
+    if (source)
+    {
+      if (AI_UNLIKELY(source->broken()))
+        return source->broken();
+      m_input_chunks[n] = channel.JackInput::chunk_ptr();
+      ASSERT(channel.JackInput::nframes() == m_buffer_size);
+    }
+    else
+      m_input_chunks[n] = NULL;
+    m_output_chunks[n] = channel.JackOutput::chunk_ptr();
+    ASSERT(!m_output_chunks[n] || channel.JackOutput::nframes() == m_buffer_size);
   }
+  ASSERT(m_state);
+
+  // Switch to the new FFT size as soon as set_fft_size() built its state.
+  if (AI_UNLIKELY(m_next_state.load(std::memory_order_relaxed)))
+    adopt_next_state();
+
+  m_state->process(m_input_chunks.data(), m_output_chunks.data(), m_buffer_size);
+
+  for (auto& channel : m_channel_nodes)
+    events |= channel->handle_memcpys();
+  return events;
 }
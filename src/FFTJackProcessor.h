@@ -21,26 +21,156 @@
 #ifndef FFT_JACK_PROCESSOR_H
 #define FFT_JACK_PROCESSOR_H
 
-#include "JackProcessor.h"
+#include "JackInput.h"
+#include "JackOutput.h"
+#include "FFTPlanCache.h"
 #include <complex>
+#include <atomic>
+#include <memory>
+#include <vector>
 #include <fftw3.h>
 
-class FFTJackProcessor : public JackProcessor
+// Streaming short-time Fourier transform.
+//
+// The FFT size (N) and hop size (H) are independent of the JACK buffer size (B).
+// Input is appended to a sliding analysis buffer of N samples; every H samples
+// that buffer is windowed, transformed, processed in the frequency domain,
+// transformed back, windowed again and overlap-added into an accumulator.
+// The first H samples of the accumulator are then complete and are moved
+// to the output queue, from which B samples are written every period.
+//
+//     m_input_frame:  [ previous N - H samples | current hop (m_hop_fill samples so far) ]
+//     m_overlap_add:  [ finished hop | partially summed N - H samples ]
+//
+// Both windows are a square-root (periodic) Hann window, so that their product
+// is a Hann window which sums to a constant for any H that divides N / 2.
+//
+// All channels are processed in lockstep: every JACK period each channel gets
+// B new samples, so the hops of all channels complete at the same moment and
+// are transformed together with a single batched FFTW plan. The per-channel
+// arrays are stored one after another (channel c of a per-channel array of
+// size S starts at c * S).
+//
+// Each channel is a separate node in the graph (see channel()). The first
+// channel depends on the input of all channels, and writes the output of all
+// channels; the other channels depend on the first one and do nothing.
+//
+// Everything that depends on N lives in an STFTState, which is built outside
+// the real-time thread (getting its plans from FFTPlanCache) and then handed
+// to the real-time thread with an atomic pointer swap. The output queue is
+// large enough for any JACK buffer size up to s_max_buffer_size, so a change
+// of buffer size never allocates memory or plans an FFT.
+class FFTJackProcessor
 {
+  public:
+    static jack_nframes_t const s_max_buffer_size = 8192;       // The largest JACK buffer size that we support.
+    static jack_nframes_t const s_max_fft_size = 8192;          // The largest FFT size that we use.
+
+    // The graph node of one channel.
+    class Channel : public JackInput, public JackOutput
+    {
+      private:
+        friend class FFTJackProcessor;
+        FFTJackProcessor& m_owner;
+
+      public:
+        Channel(FFTJackProcessor& owner) :
+            DEBUG_ONLY(JackInput("FFTJackProcessor"), JackOutput("FFTJackProcessor"),) m_owner(owner) { }
+
+        // The input of all channels is read before any output is written, so we can work in place.
+        /*virtual*/ api_type type() const { return api_input_uses_output_buffer | api_output_uses_allocated_or_input_buffer | api_inplace; }
+
+        // JackInput
+        /*virtual*/ jack_default_audio_sample_t* inplace_buffer() const { return JackOutput::chunk_ptr(); }
+        /*virtual*/ jack_nframes_t nframes_inplace_buffer() const { return JackOutput::nframes(); }
+
+        // JackOutput
+        /*virtual*/ event_type fill_output_buffer();
+        /*virtual*/ void add_sources_to(JackSchedule& schedule);
+
+      protected:
+        /*virtual*/ void buffer_changed() { if (m_connected_output) m_connected_output->update_buffer(); }
+    };
+
   private:
-    float* m_fftwf_real_array;
-    union {
-      fftwf_complex* m_fftwf_complex_array;
-      std::complex<float>* m_complex_array;
+    struct STFTState
+    {
+      int const m_channels;                     // Number of channels (C).
+      jack_nframes_t const m_fft_size;          // Number of samples per FFT frame (N).
+      jack_nframes_t const m_hop_size;          // Number of samples between the start of two consecutive frames (H).
+
+      float* m_analysis_window;                 // Window applied before the forward FFT (N samples).
+      float* m_synthesis_window;                // Window applied after the backward FFT, including all normalization (N samples).
+      float* m_input_frame;                     // Sliding window over the last N input samples (C x N samples).
+      jack_nframes_t m_hop_fill;                // Number of input samples of the current hop that are already in m_input_frame.
+      float* m_overlap_add;                     // Overlap-add accumulator (C x N samples).
+
+      float* m_output_queue;                    // Circular buffer with finished output samples (C x (m_output_queue_mask + 1) samples).
+      jack_nframes_t m_output_queue_mask;       // The size of the output queue of one channel minus one (the size is a power of two).
+      jack_nframes_t m_output_read;             // Read index into the output queue of every channel (not masked).
+      jack_nframes_t m_output_write;            // Write index into the output queue of every channel (not masked).
+
+      float* m_fftwf_real_array;                // C x N samples.
+      union {
+        fftwf_complex* m_fftwf_complex_array;   // C x (N / 2 + 1) bins.
+        std::complex<float>* m_complex_array;
+      };
+      FFTPlanCache::Plan const* m_r2c_plan;     // Owned by FFTPlanCache.
+      FFTPlanCache::Plan const* m_c2r_plan;     // Owned by FFTPlanCache.
+
+      STFTState* m_next_retired;                // Next state in the list of retired states.
+
+      STFTState(int channels, jack_nframes_t fft_size, jack_nframes_t hop_size);
+      ~STFTState();
+
+      void prime(jack_nframes_t buffer_size);   // Put the silence in the (empty) output queue.
+      void reset(jack_nframes_t buffer_size);   // Forget all history and prime again.
+      // Process nframes samples of every channel; in[c] may be NULL for silence and out[c] may be NULL to discard the output.
+      void process(jack_default_audio_sample_t const* const* in, jack_default_audio_sample_t* const* out, jack_nframes_t nframes);
+      void process_frame();
     };
-    fftwf_plan m_r2c_plan;
-    fftwf_plan m_c2r_plan;
+
+    std::vector<std::unique_ptr<Channel>> m_channel_nodes;
+    std::vector<jack_default_audio_sample_t const*> m_input_chunks;     // Scratch space for process(); one pointer per channel.
+    std::vector<jack_default_audio_sample_t*> m_output_chunks;          // Scratch space for process(); one pointer per channel.
+
+    jack_nframes_t m_fft_size;                  // The FFT size of the last call to set_fft_size().
+    jack_nframes_t m_hop_size;                  // The hop size of the last call to set_fft_size().
+    jack_nframes_t m_buffer_size;               // The JACK buffer size (B) that the output queue is primed for.
+
+    STFTState* m_state;                         // The state used by the real-time thread.
+    std::atomic<STFTState*> m_next_state;       // A new state that the real-time thread should switch to, or NULL.
+    std::atomic<STFTState*> m_retired_states;   // States that the real-time thread stopped using, freed by set_fft_size().
 
   public:
-    FFTJackProcessor();
+    FFTJackProcessor(int number_of_channels = 1);
+    ~FFTJackProcessor();
 
-    // Read input, process, write output.
-    /*virtual*/ void generate_output();
+    // Set the FFT size and hop size, in samples. The hop size must divide fft_size / 2.
+    // Never call this from the real-time thread, but it is safe to call while processing.
+    void set_fft_size(jack_nframes_t fft_size, jack_nframes_t hop_size);
+
+    // Prime the output queue for a new JACK buffer size. Does not allocate memory.
+    // Must not be called while the real-time thread might be processing.
+    void buffer_size_changed(jack_nframes_t nframes);
+
+    // An upper limit for the memory used by one STFT state of fft_size samples, with any hop size.
+    static size_t memory_budget(int number_of_channels, jack_nframes_t fft_size);
+
+    // The delay, in samples, between input and output when running with a JACK buffer size of nframes.
+    jack_nframes_t latency(jack_nframes_t nframes) const;
+
+    // Accessors.
+    int number_of_channels() const { return m_channel_nodes.size(); }
+    Channel& channel(int channel) { return *m_channel_nodes[channel]; }
+    jack_nframes_t fft_size() const { return m_fft_size; }
+    jack_nframes_t hop_size() const { return m_hop_size; }
+
+  private:
+    // Read the input of all channels, process, write the output of all channels.
+    event_type fill_output_buffers();
+    void adopt_next_state();
+    void free_retired_states();
 };
 
 #endif // FFT_JACK_PROCESSOR_H
@@ -0,0 +1,222 @@
+/**
+ * /file FFTPlanCache.cpp
+ * /brief Implementation of class FFTPlanCache.
+ *
+ * Copyright (C) 2016 Aleric Inglewood.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published
+ * by the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "sys.h"
+
+#include "FFTPlanCache.h"
+#include "FFTWisdom.h"
+#include "NoAllocationScope.h"
+#include "debug.h"
+#include <algorithm>
+#include <utility>
+#include <vector>
+
+namespace {
+
+// Scratch arrays to plan on, with the real array at the requested alignment.
+struct ScratchArrays
+{
+  float* block;
+  float* real;
+  fftwf_complex* complex;
+
+  ScratchArrays(int size, int howmany, int alignment) :
+      block(fftwf_alloc_real(howmany * size + 16)),
+      real(reinterpret_cast<float*>(reinterpret_cast<char*>(block) + alignment)),
+      complex(fftwf_alloc_complex(howmany * (size / 2 + 1))) { }
+  ~ScratchArrays() { fftwf_free(block); fftwf_free(complex); }
+};
+
+} // namespace
+
+//static
+fftwf_plan FFTPlanCache::make_plan(Key const& key, unsigned flags)
+{
+  // The caller must hold the planner mutex.
+  // FFTW_PATIENT overwrites the arrays while measuring, which is why we never plan on the arrays that are in use.
+  ScratchArrays arrays(key.size, key.howmany, key.alignment);
+  int const real_distance = key.size;
+  int const complex_distance = key.size / 2 + 1;
+  if (key.direction == real_to_complex)
+    return fftwf_plan_many_dft_r2c(1, &key.size, key.howmany,
+        arrays.real, NULL, 1, real_distance, arrays.complex, NULL, 1, complex_distance, flags | FFTW_DESTROY_INPUT);
+  return fftwf_plan_many_dft_c2r(1, &key.size, key.howmany,
+      arrays.complex, NULL, 1, complex_distance, arrays.real, NULL, 1, real_distance, flags | FFTW_DESTROY_INPUT);
+}
+
+FFTPlanCache::~FFTPlanCache()
+{
+  {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_terminate = true;
+  }
+  m_queue_not_empty.notify_one();
+  if (m_worker.joinable())
+    m_worker.join();
+
+  std::lock_guard<std::mutex> lock(Singleton<FFTWisdom>::instance().planner_mutex());
+  for (auto& entry : m_plans)
+  {
+    Plan& plan(*entry.second);
+    fftwf_plan const best_plan = plan.get();
+    if (best_plan)
+      fftwf_destroy_plan(best_plan);
+    if (plan.m_estimate_plan && plan.m_estimate_plan != best_plan)
+      fftwf_destroy_plan(plan.m_estimate_plan);
+  }
+}
+
+void FFTPlanCache::start_worker()
+{
+  // Called with m_mutex locked.
+  if (!m_worker.joinable())
+    m_worker = std::thread(&FFTPlanCache::worker, this);
+}
+
+FFTPlanCache::Plan const& FFTPlanCache::plan(int size, int howmany, direction_type direction, int alignment)
+{
+  NoAllocationScope::check();
+  Key const key = { size, howmany, direction, alignment };
+  Plan* plan;
+  bool is_new;
+  {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    auto iter = m_plans.find(key);
+    is_new = iter == m_plans.end();
+    if (is_new)
+      plan = m_plans.emplace(key, std::unique_ptr<Plan>(new Plan)).first->second.get();
+    else
+    {
+      plan = iter->second.get();
+      // Still waiting for the FFTW_PATIENT plan? Then that became the most urgent one.
+      auto queued = std::find_if(m_queue.begin(), m_queue.end(), [&key](Key const& k){ return !(k < key) && !(key < k); });
+      if (queued != m_queue.end())
+      {
+        m_queue.erase(queued);
+        m_queue.push_front(key);
+      }
+    }
+  }
+  // Prefetched keys already have (at least) an FFTW_ESTIMATE plan; don't wait for the worker thread.
+  if (plan->get())
+    return *plan;
+
+  {
+    FFTWisdom& wisdom(Singleton<FFTWisdom>::instance());
+    std::lock_guard<std::mutex> planner_lock(wisdom.planner_mutex());
+    if (plan->get())          // Only changes while holding the planner mutex.
+      return *plan;
+    // If we have wisdom for this size then making an FFTW_PATIENT plan is fast.
+    // FFTW_WISDOM_ONLY returns NULL instead of measuring when there is no wisdom.
+    fftwf_plan result = wisdom.load(size) ? make_plan(key, FFTW_PATIENT | FFTW_WISDOM_ONLY) : NULL;
+    if (!result)
+    {
+      // FFTW_ESTIMATE takes next to no time.
+      Dout(dc::notice, "FFTPlanCache: using FFTW_ESTIMATE plan for size " << size << " x " << howmany << " (direction " << direction << ", alignment " << alignment << ")");
+      result = plan->m_estimate_plan = make_plan(key, FFTW_ESTIMATE);
+    }
+    plan->m_plan.store(result, std::memory_order_release);
+    if (!plan->m_estimate_plan || !is_new)
+      return *plan;     // Either we're done, or the key is already queued (or being worked on).
+  }
+
+  {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_queue.push_front(key);
+    start_worker();
+  }
+  m_queue_not_empty.notify_one();
+  return *plan;
+}
+
+void FFTPlanCache::prefetch(int min_size, int max_size, int howmany, int alignment)
+{
+  DoutEntering(dc::notice, "FFTPlanCache::prefetch(" << min_size << ", " << max_size << ", " << howmany << ", " << alignment << ")");
+  std::vector<std::pair<Key, Plan*>> added;
+  {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    for (int size = min_size; size <= max_size; size *= 2)
+    {
+      for (direction_type direction : { real_to_complex, complex_to_real })
+      {
+        Key const key = { size, howmany, direction, alignment };
+        if (m_plans.find(key) == m_plans.end())
+          added.emplace_back(key, m_plans.emplace(key, std::unique_ptr<Plan>(new Plan)).first->second.get());
+      }
+    }
+  }
+
+  // Give every new key an FFTW_ESTIMATE plan now, so that plan() never has to wait for the planner for them.
+  {
+    std::lock_guard<std::mutex> planner_lock(Singleton<FFTWisdom>::instance().planner_mutex());
+    for (auto& entry : added)
+    {
+      Plan& plan(*entry.second);
+      if (plan.get())
+        continue;       // plan() got there first.
+      plan.m_estimate_plan = make_plan(entry.first, FFTW_ESTIMATE);
+      plan.m_plan.store(plan.m_estimate_plan, std::memory_order_release);
+    }
+  }
+
+  {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    for (auto& entry : added)
+      m_queue.push_back(entry.first);
+    start_worker();
+  }
+  m_queue_not_empty.notify_one();
+}
+
+// Runs in m_worker.
+void FFTPlanCache::worker()
+{
+  Debug(debug::init_thread());
+  FFTWisdom& wisdom(Singleton<FFTWisdom>::instance());
+  std::unique_lock<std::mutex> lock(m_mutex);
+  while (true)
+  {
+    m_queue_not_empty.wait(lock, [this]{ return m_terminate || !m_queue.empty(); });
+    if (m_terminate)
+      break;            // Checked between plans; the destructor only waits for the plan that is being made.
+    Key const key = m_queue.front();
+    m_queue.pop_front();
+    Plan& plan(*m_plans[key]);
+    lock.unlock();
+
+    {
+      std::lock_guard<std::mutex> planner_lock(wisdom.planner_mutex());
+      // Skip the plan if plan() already made an FFTW_PATIENT plan from wisdom.
+      if (!plan.get() || plan.m_estimate_plan)
+      {
+        Dout(dc::notice, "FFTPlanCache: making FFTW_PATIENT plan for size " << key.size << " x " << key.howmany << " (direction " << key.direction << ", alignment " << key.alignment << ")");
+        wisdom.load(key.size);
+        fftwf_plan patient_plan = make_plan(key, FFTW_PATIENT);
+        wisdom.save(key.size);
+        // The FFTW_ESTIMATE plan (if any) is kept, because the real-time thread might be executing it right now.
+        plan.m_plan.store(patient_plan, std::memory_order_release);
+      }
+    }
+
+    lock.lock();
+  }
+}
+
+static SingletonInstance<FFTPlanCache> dummy __attribute__ ((__unused__));
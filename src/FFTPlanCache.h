@@ -0,0 +1,121 @@
+/**
+ * \file FFTPlanCache.h
+ * \brief Declaration of FFTPlanCache.
+ *
+ * Copyright (C) 2016 Aleric Inglewood.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published
+ * by the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef FFT_PLAN_CACHE_H
+#define FFT_PLAN_CACHE_H
+
+#include "utils/Singleton.h"
+#include <fftw3.h>
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <thread>
+
+// A cache of FFTW plans, keyed by (size, howmany, direction, alignment).
+//
+// Plans are never destroyed before the cache itself, so a pointer to a Plan
+// can be used by the real-time thread without any locking. A plan that is
+// requested before an FFTW_PATIENT plan exists starts out as an FFTW_ESTIMATE
+// plan; a worker thread then makes the FFTW_PATIENT plan (using and updating
+// FFTWisdom) and atomically replaces it.
+//
+// The plans are made on scratch arrays and must be executed with the new-array
+// execute functions (fftwf_execute_dft_r2c and fftwf_execute_dft_c2r).
+// The complex array must be SIMD aligned (fftwf_alloc_complex or RTMemory); the alignment
+// in the key is that of the real array, as returned by fftwf_alignment_of().
+//
+// The destructor waits for the FFTW_PATIENT plan that the worker thread is
+// making, if any; plans that are still queued are skipped.
+//
+// A plan with howmany > 1 transforms that many channels in one call. The
+// channels are stored one after another: channel c starts at real + c * size
+// and at complex + c * (size / 2 + 1).
+class FFTPlanCache : public Singleton<FFTPlanCache>
+{
+    friend_Instance;
+  public:
+    enum direction_type { real_to_complex, complex_to_real };
+
+    class Plan
+    {
+      private:
+        friend class FFTPlanCache;
+        std::atomic<fftwf_plan> m_plan;         // The best plan that we have.
+        fftwf_plan m_estimate_plan;             // Kept alive because the real-time thread might still be using it.
+
+      public:
+        Plan() : m_plan(NULL), m_estimate_plan(NULL) { }
+
+        // The plan to execute. May change at any moment, but stays valid until the cache is destroyed.
+        fftwf_plan get() const { return m_plan.load(std::memory_order_acquire); }
+    };
+
+  private:
+    struct Key
+    {
+      int size;
+      int howmany;
+      direction_type direction;
+      int alignment;
+
+      bool operator<(Key const& key) const
+      {
+        if (size != key.size)
+          return size < key.size;
+        if (howmany != key.howmany)
+          return howmany < key.howmany;
+        if (direction != key.direction)
+          return direction < key.direction;
+        return alignment < key.alignment;
+      }
+    };
+
+    std::mutex m_mutex;                         // Protects m_plans, m_queue and m_terminate.
+    std::condition_variable m_queue_not_empty;  // Signalled when something is added to m_queue, or m_terminate is set.
+    std::map<Key, std::unique_ptr<Plan>> m_plans;
+    std::deque<Key> m_queue;                    // The plans that still need an FFTW_PATIENT version, most urgent first.
+    bool m_terminate;
+    std::thread m_worker;
+
+  private:
+    FFTPlanCache() : m_terminate(false) { }
+    ~FFTPlanCache();
+    FFTPlanCache(FFTPlanCache const&);
+
+    void worker();
+    void start_worker();
+    static fftwf_plan make_plan(Key const& key, unsigned flags);
+
+  public:
+    // Return the plan for the given size, number of channels, direction and alignment.
+    // Returns right away for keys that were prefetched. For any other key it makes an FFTW_ESTIMATE plan,
+    // which might wait until the worker thread finishes the FFTW_PATIENT plan that it is making;
+    // so never call this from the real-time thread.
+    Plan const& plan(int size, int howmany, direction_type direction, int alignment);
+
+    // Make FFTW_ESTIMATE plans for howmany channels, in both directions, for all powers of two from min_size up to and including max_size,
+    // and let the worker thread replace them with FFTW_PATIENT plans. Call this before plan(), so that it doesn't wait for the worker thread.
+    void prefetch(int min_size, int max_size, int howmany, int alignment);
+};
+
+#endif // FFT_PLAN_CACHE_H
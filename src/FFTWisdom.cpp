@@ -0,0 +1,96 @@
+/**
+ * /file FFTWisdom.cpp
+ * /brief Implementation of class FFTWisdom.
+ *
+ * Copyright (C) 2016 Aleric Inglewood.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published
+ * by the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "sys.h"
+
+#include "FFTWisdom.h"
+#include "debug.h"
+#include <fftw3.h>
+#include <fstream>
+#include <sstream>
+#include <functional>
+
+namespace {
+
+// Return a string that changes when the wisdom measured on this machine is no longer valid.
+std::string cpu_fingerprint()
+{
+  std::string model_name;
+  std::string flags;
+  std::ifstream cpuinfo("/proc/cpuinfo");
+  std::string line;
+  while (std::getline(cpuinfo, line) && (model_name.empty() || flags.empty()))
+  {
+    if (model_name.empty() && line.compare(0, 10, "model name") == 0)
+      model_name = line;
+    else if (flags.empty() && line.compare(0, 5, "flags") == 0)
+      flags = line;
+  }
+  std::ostringstream fingerprint;
+  fingerprint << std::hex << std::hash<std::string>()(model_name + flags + fftwf_version);
+  return fingerprint.str();
+}
+
+} // namespace
+
+void FFTWisdom::set_path(boost::filesystem::path const& config_directory)
+{
+  m_cpu_fingerprint = cpu_fingerprint();
+  m_directory = config_directory;
+  m_directory /= "fftw";
+  m_directory /= m_cpu_fingerprint;
+  if (!boost::filesystem::exists(m_directory))
+  {
+    boost::filesystem::create_directories(m_directory);
+  }
+  Dout(dc::notice, "FFTW wisdom directory: " << m_directory);
+}
+
+boost::filesystem::path FFTWisdom::wisdom_path(int fft_size) const
+{
+  return m_directory / ("wisdom-" + std::to_string(fft_size) + ".dat");
+}
+
+bool FFTWisdom::load(int fft_size)
+{
+  if (m_directory.empty())
+    return false;
+  boost::filesystem::path const path = wisdom_path(fft_size);
+  if (!boost::filesystem::exists(path))
+    return false;
+  bool success = fftwf_import_wisdom_from_filename(path.c_str());
+  Dout(dc::notice, (success ? "Imported" : "Failed to import") << " FFTW wisdom from " << path);
+  return success;
+}
+
+void FFTWisdom::save(int fft_size)
+{
+  if (m_directory.empty())
+    return;
+  boost::filesystem::path const path = wisdom_path(fft_size);
+  if (!fftwf_export_wisdom_to_filename(path.c_str()))
+  {
+    Dout(dc::warning, "Failed to write FFTW wisdom to " << path);
+    return;
+  }
+  Dout(dc::notice, "Exported FFTW wisdom to " << path);
+}
+
+static SingletonInstance<FFTWisdom> dummy __attribute__ ((__unused__));
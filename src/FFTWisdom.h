@@ -0,0 +1,71 @@
+/**
+ * \file FFTWisdom.h
+ * \brief Declaration of FFTWisdom.
+ *
+ * Copyright (C) 2016 Aleric Inglewood.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published
+ * by the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef FFT_WISDOM_H
+#define FFT_WISDOM_H
+
+#include "utils/Singleton.h"
+#include <boost/filesystem.hpp>
+#include <mutex>
+#include <string>
+
+// Persistent FFTW wisdom.
+//
+// Wisdom is stored in one file per FFT size, in a directory per CPU fingerprint:
+//
+//   ~/.config/speech/fftw/<fingerprint>/wisdom-<fft size>.dat
+//
+// so that copying the configuration directory to another machine doesn't
+// feed FFTW wisdom that was measured on different hardware.
+//
+// The FFTW planner (and wisdom import/export) is not thread-safe;
+// every call into it must be done while holding planner_mutex().
+class FFTWisdom : public Singleton<FFTWisdom>
+{
+    friend_Instance;
+  private:
+    FFTWisdom() { }
+    ~FFTWisdom() { }
+    FFTWisdom(FFTWisdom const&);
+
+  private:
+    boost::filesystem::path m_directory;        //!< Directory with the wisdom files for this CPU, or empty if not set.
+    std::string m_cpu_fingerprint;              //!< Hash of the CPU model, its flags and the FFTW version.
+    std::mutex m_planner_mutex;                 //!< Serializes all access to the FFTW planner.
+
+  public:
+    // Set the configuration directory (the directory that contains config.xml).
+    void set_path(boost::filesystem::path const& config_directory);
+
+    // Import previously stored wisdom for fft_size, if any. Returns true if wisdom was imported.
+    // The caller must hold planner_mutex().
+    bool load(int fft_size);
+
+    // Store all accumulated wisdom as the wisdom for fft_size.
+    // The caller must hold planner_mutex().
+    void save(int fft_size);
+
+    std::mutex& planner_mutex() { return m_planner_mutex; }
+
+  private:
+    boost::filesystem::path wisdom_path(int fft_size) const;
+};
+
+#endif // FFT_WISDOM_H
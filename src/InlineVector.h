@@ -0,0 +1,84 @@
+/**
+ * \file InlineVector.h
+ * \brief Declaration of InlineVector.
+ *
+ * Copyright (C) 2016 Aleric Inglewood.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published
+ * by the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef INLINE_VECTOR_H
+#define INLINE_VECTOR_H
+
+#include <algorithm>
+#include "debug.h"
+
+// A vector with a fixed capacity, stored inside the object itself.
+//
+// Inserting and erasing never touches the heap, so this can be used in the
+// real-time thread. Exceeding the capacity is a bug (asserted in debug mode).
+// Only meant for small, trivially copyable elements.
+template<typename T, int capacity>
+class InlineVector
+{
+  public:
+    typedef T value_type;
+    typedef T* iterator;
+    typedef T const* const_iterator;
+
+  private:
+    T m_elements[capacity];
+    int m_size;
+
+  public:
+    InlineVector() : m_size(0) { }
+
+    static int max_size() { return capacity; }
+    int size() const { return m_size; }
+    bool empty() const { return m_size == 0; }
+    bool full() const { return m_size == capacity; }
+
+    iterator begin() { return m_elements; }
+    iterator end() { return m_elements + m_size; }
+    const_iterator begin() const { return m_elements; }
+    const_iterator end() const { return m_elements + m_size; }
+
+    T& operator[](int index) { ASSERT(0 <= index && index < m_size); return m_elements[index]; }
+    T const& operator[](int index) const { ASSERT(0 <= index && index < m_size); return m_elements[index]; }
+
+    // Insert value before pos.
+    iterator insert(iterator pos, T const& value)
+    {
+      ASSERT(!full());
+      std::copy_backward(pos, end(), end() + 1);
+      *pos = value;
+      ++m_size;
+      return pos;
+    }
+
+    void push_back(T const& value) { insert(end(), value); }
+
+    // Remove the element at pos.
+    iterator erase(iterator pos)
+    {
+      ASSERT(begin() <= pos && pos < end());
+      std::copy(pos + 1, end(), pos);
+      --m_size;
+      return pos;
+    }
+
+    void clear() { m_size = 0; }
+};
+
+#endif // INLINE_VECTOR_H
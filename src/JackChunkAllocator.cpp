@@ -22,8 +22,12 @@
 
 #include "JackChunkAllocator.h"
 #include "utils/Singleton.h"
-#include "fftw3.h"
+#include "RTMemory.h"
+#include "NoAllocationScope.h"
 #include "debug.h"
+#include <cerrno>
+#include <algorithm>
+#include <new>
 
 //                                                         .--- m_start + m_initial_size
 //                                                         V
@@ -47,73 +51,261 @@
 //              NULL                    NULL
 
 // Allocate a new block (size is a multiple of m_chunk_size * sizeof(jack_default_audio_sample_t)).
-// Begin and end of this block are stored in m_begin and m_end respectively.
+// Begin and end of this block are stored in m_current->m_begin and m_current->m_end respectively.
 inline JackChunkAllocator::chunk* JackChunkAllocator::allocate_new_block(size_t size)
 {
-  m_begin = reinterpret_cast<chunk*>(fftwf_malloc(size));
-  m_end = &m_begin->data[0] + size;
-  return m_begin;
+  // Only called from buffer_size_changed(); the real-time thread never allocates memory.
+  NoAllocationScope::check();
+  m_current->m_begin = allocate_block(size);
+  m_current->m_end = reinterpret_cast<char*>(m_current->m_begin) + size;
+  return m_current->m_begin;
 }
 
-JackChunkAllocator::JackChunkAllocator() : m_begin(NULL), m_start(NULL)
+JackChunkAllocator::JackChunkAllocator() :
+    m_current(NULL), m_spare_blocks(NULL), m_refill_requested(false), m_refilled_blocks(NULL), m_refilled_chunks(0),
+    m_drained_blocks(NULL), m_refill_done(false), m_reserve_block(NULL), m_emergency_allocations(0), m_failed_allocations(0), m_terminate(false)
 {
+  sem_init(&m_refill_wakeup, 0, 0);
 }
 
 int JackChunkAllocator::s_increment_chunks = 64;
 int JackChunkAllocator::s_initial_chunks = 64;
+int JackChunkAllocator::s_low_watermark = 32;
+int JackChunkAllocator::s_high_watermark = 128;
 
 void JackChunkAllocator::buffer_size_changed(jack_nframes_t nframes)
 {
-  m_chunk_size = nframes;
-  m_initial_size = nframes * sizeof(jack_default_audio_sample_t) * s_initial_chunks;
-  m_increment_size = nframes * sizeof(jack_default_audio_sample_t) * s_increment_chunks;
+  DoutEntering(dc::notice, "JackChunkAllocator::buffer_size_changed(" << nframes << ")");
 
-  // (Re)initialize the chunk pool.
-  if (m_begin)
-    fftwf_free(m_begin);
-  m_begin = allocate_new_block(m_initial_size);
-  m_start = m_begin;
+  // Stop the refill thread from allocating blocks of the old size.
+  std::lock_guard<std::mutex> lock(m_refill_mutex);
 
-  ASSERT(s_increment_chunks > 1 && s_initial_chunks > 1);                       // Otherwise increment(m_begin) would already be outside the block
+  if (m_current && m_current->m_chunk_size == nframes)
+    return;
+
+  // Throw away the spare blocks of the old size.
+  free_blocks(m_spare_blocks);
+  m_spare_blocks = NULL;
+  free_blocks(m_refilled_blocks.exchange(NULL));
+  m_refilled_chunks = 0;
+  free_blocks(m_reserve_block.exchange(NULL));
+
+  SizeClass* const prev = m_current;
+  // Chunks of this size might still be in use from before the previous change.
+  m_current = find_size_class(nframes);
+  if (!m_current)
+  {
+    for (int i = 0; i < s_max_size_classes && !m_current; ++i)
+      if (m_size_classes[i].m_chunk_size == 0)
+        m_current = &m_size_classes[i];
+    // Too many different buffer sizes are still in use (JackOutput::reacquire_allocated_buffer() wasn't called?).
+    ASSERT(m_current);
+    m_current->m_chunk_size = nframes;
+    m_initial_size = m_current->chunk_bytes() * s_initial_chunks;
+    ASSERT(s_increment_chunks > 1 && s_initial_chunks > 1);                     // Otherwise increment(m_begin) would already be outside the block
                                                                                 // (seriously though, these two sizes should be MUCH larger than 1).
-  ASSERT(nframes * sizeof(jack_default_audio_sample_t) >= sizeof(chunk));       // struct chunk must fit inside it.
-  ASSERT((nframes * sizeof(jack_default_audio_sample_t)) % 16 == 0);            // Must be a multiple of 16.
-  m_begin->meta.next = NULL;                            // No next block yet.
-  find_free_chunk_after(m_begin);
+    ASSERT(m_current->chunk_bytes() >= sizeof(chunk));                          // struct chunk must fit inside it.
+    ASSERT(m_current->chunk_bytes() % 16 == 0);                                 // Must be a multiple of 16.
+    m_current->m_start = allocate_new_block(m_initial_size);
+    m_current->m_begin->meta.next = NULL;               // No next block yet.
+    m_current->m_free_chunk = next_fresh_chunk(m_current->m_begin);
+    m_current->m_outstanding = 0;
+    m_current->m_available = s_initial_chunks - 1;      // The first chunk of every block is not used.
+  }
+  m_increment_size = m_current->chunk_bytes() * s_increment_chunks;
+  m_reserve_block = allocate_block(m_increment_size);
+  m_reserve_block.load()->meta.next = NULL;
+
+  // Free the previous size class right away if it isn't used anymore.
+  if (prev && prev->m_outstanding == 0)
+  {
+    free_blocks(prev->m_start);
+    prev->clear();
+  }
+
+  // Let the refill thread top up the pool to the high watermark.
+  m_refill_requested = false;
+  m_refill_done = false;
+  if (!m_refill_thread.joinable())
+    m_refill_thread = std::thread(&JackChunkAllocator::refill_thread, this);
+  request_refill();
 }
 
 JackChunkAllocator::~JackChunkAllocator()
 {
+  m_terminate = true;
+  sem_post(&m_refill_wakeup);
+  if (m_refill_thread.joinable())
+    m_refill_thread.join();
+  sem_destroy(&m_refill_wakeup);
+  Dout(dc::notice, "JackChunkAllocator: " << m_emergency_allocations << " emergency allocations, " << m_failed_allocations << " failed allocations.");
+
   // Free all blocks.
-  chunk const* block = m_start;
-  while(block)
+  for (int i = 0; i < s_max_size_classes; ++i)
+    free_blocks(m_size_classes[i].m_start);
+  free_blocks(m_spare_blocks);
+  free_blocks(m_refilled_blocks.exchange(NULL));
+  free_blocks(m_drained_blocks.exchange(NULL));
+  free_blocks(m_reserve_block.exchange(NULL));
+}
+
+//static
+JackChunkAllocator::chunk* JackChunkAllocator::allocate_block(size_t size)
+{
+  chunk* block = static_cast<chunk*>(Singleton<RTMemory>::instance().allocate(size));
+  block->meta.block_size = size;
+  return block;
+}
+
+//static
+void JackChunkAllocator::free_blocks(chunk* block)
+{
+  RTMemory& rt_memory(Singleton<RTMemory>::instance());
+  while (block)
   {
-    chunk const* ptr = block;
+    chunk* ptr = block;
     block = block->meta.next;
-    fftwf_free(const_cast<chunk*>(ptr));
+    rt_memory.deallocate(ptr, ptr->meta.block_size);
   }
 }
 
-// This function sets m_free_chunk to point to the next, never used before, chunk after last_chunk.
-void JackChunkAllocator::find_free_chunk_after(chunk* last_chunk)
+//static
+size_t JackChunkAllocator::memory_budget(jack_nframes_t nframes)
 {
+  // The first block, the high watermark worth of refilled blocks, and the reserve block.
+  size_t const blocks = 1 + (s_high_watermark + s_increment_chunks - 2) / (s_increment_chunks - 1) + 1;
+  return blocks * std::max(s_initial_chunks, s_increment_chunks) * nframes * sizeof(jack_default_audio_sample_t);
+}
+
+JackChunkAllocator::SizeClass* JackChunkAllocator::find_size_class(size_t nframes)
+{
+  for (int i = 0; i < s_max_size_classes; ++i)
+    if (m_size_classes[i].m_chunk_size == nframes)
+      return &m_size_classes[i];
+  return NULL;
+}
+
+void JackChunkAllocator::drained(SizeClass* size_class)
+{
+  // Hand the blocks over to the refill thread, freeing memory is not something we want to do in the real-time thread.
+  chunk* last_block = size_class->m_start;
+  while (last_block->meta.next)
+    last_block = last_block->meta.next;
+  last_block->meta.next = m_drained_blocks.load(std::memory_order_relaxed);
+  while (!m_drained_blocks.compare_exchange_weak(last_block->meta.next, size_class->m_start, std::memory_order_release, std::memory_order_relaxed))
+    ;
+  size_class->clear();
+  sem_post(&m_refill_wakeup);
+}
+
+// Return the next, never used before, chunk after last_chunk.
+// If last_chunk is the last chunk of the block then the next block is linked in first; if there is no block
+// available then NULL is returned and nothing is changed. Memory is never allocated here.
+JackChunkAllocator::chunk* JackChunkAllocator::next_fresh_chunk(chunk* last_chunk)
+{
+  SizeClass& size_class(*m_current);
   ASSERT(last_chunk->meta.next == NULL);
   // A value of NULL in `next' means the next chunk in the block (this is so that we can
   // avoid having to initialize all of the next values at once).
-  m_free_chunk = increment(last_chunk);
-  // However, if this was the last chunk in the allocated block then we need to allocate more memory.
-  if (AI_UNLIKELY(m_free_chunk == m_end))
+  chunk* fresh_chunk = size_class.increment(last_chunk);
+  // However, if this was the last chunk in the allocated block then we need another block.
+  if (AI_UNLIKELY(fresh_chunk == size_class.m_end))
   {
-    // Store reference to the next pointer in m_begin because the call to allocate_new_block changes the value of m_begin.
-    chunk*& next_block = m_begin->meta.next;
-    assert(next_block == NULL);
-    next_block = allocate_new_block(m_increment_size);  // Updates m_begin and m_end for a newly allocated block and return m_begin.
-    ASSERT(next_block == m_begin);
-    m_begin->meta.next = NULL;            // No next block yet.
-    m_free_chunk = increment(m_begin);
+    ASSERT(size_class.m_begin->meta.next == NULL);
+    chunk* block = take_refilled_block();
+    if (AI_UNLIKELY(!block))
+    {
+      // The refill thread didn't keep up; increase s_low_watermark (or s_initial_chunks).
+      block = m_reserve_block.exchange(NULL, std::memory_order_acquire);
+      if (AI_UNLIKELY(!block))
+      {
+        ++m_failed_allocations;
+        Dout(dc::warning, "JackChunkAllocator: out of chunks in the real-time thread!");
+        // The refill thread might have failed to allocate memory itself; let it try again.
+        sem_post(&m_refill_wakeup);
+        return NULL;
+      }
+      ++m_emergency_allocations;
+      Dout(dc::warning, "JackChunkAllocator: emergency: using the reserve block in the real-time thread!");
+      // Let the refill thread replace the reserve block. Bypass request_refill() because
+      // the refill thread might be past the point where it checks m_reserve_block.
+      sem_post(&m_refill_wakeup);
+    }
+    size_class.m_begin->meta.next = block;
+    size_class.m_begin = block;
+    size_class.m_end = reinterpret_cast<char*>(size_class.m_begin) + m_increment_size;
+    size_class.m_begin->meta.next = NULL;       // No next block yet.
+    fresh_chunk = size_class.increment(size_class.m_begin);
+    size_class.m_available.store(size_class.m_available.load(std::memory_order_relaxed) + s_increment_chunks - 1, std::memory_order_relaxed);
   }
   // Initialize the new chunk.
-  m_free_chunk->meta.next = NULL;
+  fresh_chunk->meta.next = NULL;
+  return fresh_chunk;
+}
+
+JackChunkAllocator::chunk* JackChunkAllocator::take_refilled_block()
+{
+  // We are the only consumer and take the whole stack at once, so there is no ABA problem.
+  if (!m_spare_blocks)
+    m_spare_blocks = m_refilled_blocks.exchange(NULL, std::memory_order_acquire);
+  chunk* block = m_spare_blocks;
+  if (block)
+  {
+    m_spare_blocks = block->meta.next;
+    m_refilled_chunks.fetch_sub(s_increment_chunks - 1, std::memory_order_relaxed);
+  }
+  return block;
+}
+
+void JackChunkAllocator::request_refill()
+{
+  // The refill thread sets m_refill_done when it reached the high watermark.
+  if (m_refill_requested && !m_refill_done.exchange(false, std::memory_order_relaxed))
+    return;
+  m_refill_requested = true;
+  sem_post(&m_refill_wakeup);
+}
+
+// Runs in m_refill_thread.
+void JackChunkAllocator::refill_thread()
+{
+  Debug(debug::init_thread());
+  while (true)
+  {
+    if (sem_wait(&m_refill_wakeup) == -1)
+    {
+      ASSERT(errno == EINTR);
+      continue;
+    }
+    if (m_terminate)
+      break;
+    free_blocks(m_drained_blocks.exchange(NULL, std::memory_order_acquire));
+    std::lock_guard<std::mutex> lock(m_refill_mutex);
+    try
+    {
+      while (m_current->m_available.load(std::memory_order_relaxed) + m_refilled_chunks.load(std::memory_order_relaxed) < (size_t)s_high_watermark)
+      {
+        chunk* block = allocate_block(m_increment_size);
+        m_refilled_chunks.fetch_add(s_increment_chunks - 1, std::memory_order_relaxed);
+        block->meta.next = m_refilled_blocks.load(std::memory_order_relaxed);
+        while (!m_refilled_blocks.compare_exchange_weak(block->meta.next, block, std::memory_order_release, std::memory_order_relaxed))
+          ;
+      }
+      if (!m_reserve_block.load(std::memory_order_relaxed))
+      {
+        chunk* block = allocate_block(m_increment_size);
+        block->meta.next = NULL;
+        m_reserve_block.store(block, std::memory_order_release);
+      }
+    }
+    catch (std::bad_alloc const&)
+    {
+      // Leave m_refill_done unset; we'll try again on the next wakeup (next_fresh_chunk() posts one for every failed allocation).
+      Dout(dc::warning, "JackChunkAllocator: the refill thread failed to allocate a block.");
+      continue;
+    }
+    m_refill_done.store(true, std::memory_order_relaxed);
+  }
 }
 
 static SingletonInstance<JackChunkAllocator> dummy __attribute__ ((__unused__));
@@ -23,9 +23,33 @@
 
 #include "utils/macros.h"
 #include "utils/Singleton.h"
+#include "debug.h"
 #include <cstddef>
+#include <atomic>
+#include <mutex>
+#include <thread>
+#include <semaphore.h>
 #include <jack/jack.h>
 
+// Pool of audio buffers (chunks) of the JACK buffer size.
+//
+// The blocks come from RTMemory, so they are locked and prefaulted.
+//
+// Chunks are grouped in size classes: one per buffer size that is still in use.
+// allocate() always returns a chunk of the current buffer size, but chunks of a previous
+// buffer size stay valid until they are released, so that every JackOutput can move to
+// the new size at its own pace (see JackOutput::reacquire_allocated_buffer()). Once the last
+// chunk of an old size class is released its blocks are freed, by the helper thread.
+//
+// allocate() and release() are called by one thread at a time (normally the JACK process thread).
+// To keep memory allocation out of that thread, a helper thread keeps a stock of spare blocks:
+// when the number of available chunks drops below s_low_watermark, allocate() posts a semaphore
+// and the helper thread allocates new blocks until at least s_high_watermark chunks are available.
+// The blocks are handed over through a lock-free stack (m_refilled_blocks) that the real-time
+// thread empties in one go. When that stack is empty too, allocate() takes the reserve block
+// (a block that the helper thread keeps aside for exactly this case) and wakes up the helper
+// thread to replace it; such emergency allocations are counted. If the reserve block was
+// already used up as well then allocate() fails and returns NULL; it never allocates memory itself.
 class JackChunkAllocator : public Singleton<JackChunkAllocator>
 {
     friend_Instance;
@@ -38,66 +62,138 @@ class JackChunkAllocator : public Singleton<JackChunkAllocator>
         jack_default_audio_sample_t data[16];   // Audio data - the real size being m_chunk_size, not 16.
         struct
         {
-          chunk* next;                          // Points to next free chunk in the chain, or NULL (call find_free_chunk_after(this)).
+          chunk* next;                          // Points to next free chunk in the chain, or NULL (call next_fresh_chunk(this)).
+          size_t block_size;                    // Only valid for the first chunk of a block: the size of the block in bytes.
         } meta;                                 // Only valid for free (unused) chunks.
       };
     };
 
-    size_t m_chunk_size;        // Size of one chunk in samples. Must be a multiple of 16 (is likely a power of 2 anyway).
-    size_t m_initial_size;      // Size of the first allocated block in bytes.
-    size_t m_increment_size;    // Size of subsequent blocks in bytes.
-    chunk* m_free_chunk;        // Pointer to the first chunk in the free list.
-    chunk* m_begin;             // Start of last allocated block.
-    void const* m_end;          // One past the end of last allocated block.
-    chunk const* m_start;       // Start of first allocated block.
+    // All chunks of one size.
+    struct SizeClass
+    {
+      size_t m_chunk_size;                      // Size of one chunk in samples. Must be a multiple of 16 (is likely a power of 2 anyway). Zero when unused.
+      chunk* m_free_chunk;                      // Pointer to the first chunk in the free list.
+      chunk* m_begin;                           // Start of last allocated block.
+      void const* m_end;                        // One past the end of last allocated block.
+      chunk* m_start;                           // Start of first allocated block.
+      size_t m_outstanding;                     // The number of chunks that were allocated and not released yet.
+      std::atomic<size_t> m_available;          // The number of chunks that can be allocated without allocating a new block (only written by the real-time thread).
+
+      SizeClass() : m_chunk_size(0), m_free_chunk(NULL), m_begin(NULL), m_end(NULL), m_start(NULL), m_outstanding(0), m_available(0) { }
+      void clear() { m_chunk_size = 0; m_free_chunk = m_begin = m_start = NULL; m_end = NULL; m_outstanding = 0; m_available = 0; }
+
+      size_t chunk_bytes() const { return m_chunk_size * sizeof(jack_default_audio_sample_t); }
+      // Return the next chunk in the block (or a pointer that points one past the end of it).
+      chunk* increment(chunk* ptr) const { return reinterpret_cast<chunk*>(&ptr->data[m_chunk_size]); }
+    };
+
+    static int const s_max_size_classes = 8;    // The maximum number of buffer sizes that can be in use at the same time.
+
+    SizeClass m_size_classes[s_max_size_classes];
+    SizeClass* m_current;       // The size class of the current buffer size, or NULL before the first call to buffer_size_changed().
+    size_t m_initial_size;      // Size of the first allocated block of m_current in bytes.
+    size_t m_increment_size;    // Size of subsequent blocks of m_current in bytes.
+    chunk* m_spare_blocks;      // Blocks taken from m_refilled_blocks that weren't used yet, linked through the meta.next of their first chunk.
+    bool m_refill_requested;    // Set when the refill thread was woken up and didn't finish yet (only accessed by the real-time thread).
+
+    std::atomic<chunk*> m_refilled_blocks;      // Stack of blocks (of the size of m_current) allocated by the refill thread.
+    std::atomic<size_t> m_refilled_chunks;      // The number of usable chunks in m_refilled_blocks.
+    std::atomic<chunk*> m_drained_blocks;       // Blocks of size classes that drained, to be freed by the refill thread.
+    std::atomic<bool> m_refill_done;            // Set by the refill thread when it reached the high watermark.
+    std::atomic<chunk*> m_reserve_block;        // A block (of the size of m_current) for when m_refilled_blocks is empty, or NULL when it was used.
+    std::atomic<int> m_emergency_allocations;   // The number of times that the real-time thread had to use the reserve block.
+    std::atomic<int> m_failed_allocations;      // The number of times that allocate() returned NULL.
+
+    std::mutex m_refill_mutex;  // Protects m_current and the block sizes against buffer_size_changed() while the refill thread is allocating.
+    std::thread m_refill_thread;
+    sem_t m_refill_wakeup;      // Posted when the refill thread must top up the pool or free drained blocks.
+    std::atomic<bool> m_terminate;              // Set by the destructor.
 
     static int s_increment_chunks;
     static int s_initial_chunks;
+    static int s_low_watermark;
+    static int s_high_watermark;
 
   private:
-    // Return the next chunk in the block (or a pointer that points one past the end of it).
-    chunk* increment(chunk* ptr) const { return reinterpret_cast<chunk*>(&ptr->data[m_chunk_size]); }
-    chunk const* increment(chunk const* ptr) const { return reinterpret_cast<chunk const*>(&ptr->data[m_chunk_size]); }
-
     // Allocate a new block of size / (m_chunk_size * sizeof(jack_default_audio_sample_t) chunks and return a pointer to the first chunk.
     // size is either m_initial_size or m_increment_size (a multiple of m_chunk_size * sizeof(jack_default_audio_sample_t)).
     chunk* allocate_new_block(size_t size);
 
-    // Initialize m_free_chunk.
-    void find_free_chunk_after(chunk* last_chunk);
+    // Allocate a block of size bytes from RTMemory; the size is stored in the first chunk.
+    static chunk* allocate_block(size_t size);
+
+    // Return the next, never used before, chunk after last_chunk; or NULL if that requires a block and there is none.
+    chunk* next_fresh_chunk(chunk* last_chunk);
+
+    // Return a block from the refill thread, or NULL if there isn't any.
+    chunk* take_refilled_block();
+
+    // Called from allocate() when the number of available chunks dropped below the low watermark.
+    void request_refill();
+
+    // Return the size class of chunks of nframes samples, or NULL if there is none.
+    SizeClass* find_size_class(size_t nframes);
+
+    // Called from release() when the last chunk of an old size class was released.
+    void drained(SizeClass* size_class);
+
+    void refill_thread();
+    static void free_blocks(chunk* block);
 
   private:
     JackChunkAllocator();
     ~JackChunkAllocator();
 
   public:
-    // Return a pointer to fftwf_malloc aligned memory of m_chunk_size samples in O(1) time.
-    // It can happen occassionally that no more blocks are available, in that case
-    // a call to fftwf_malloc() happens which is slow -- the only way to avoid that
-    // is to increase initial_chunks passed to the constructor.
+    // Return a pointer to SIMD aligned memory of chunk_size() samples in O(1) time,
+    // or NULL when the refill thread couldn't keep up and the reserve block was used up too;
+    // see emergency_allocations() and failed_allocations().
     void* allocate()
     {
-      chunk* current_chunk = m_free_chunk;
-      m_free_chunk = current_chunk->meta.next;
-      if (AI_UNLIKELY(!m_free_chunk))
-        find_free_chunk_after(current_chunk);
+      SizeClass& size_class(*m_current);
+      chunk* current_chunk = size_class.m_free_chunk;
+      // Find the chunk that will be next before handing out this one; m_free_chunk may never become NULL.
+      chunk* next_chunk = current_chunk->meta.next;
+      if (AI_UNLIKELY(!next_chunk) && AI_UNLIKELY(!(next_chunk = next_fresh_chunk(current_chunk))))
+        return NULL;
+      size_class.m_free_chunk = next_chunk;
+      ++size_class.m_outstanding;
+      size_t const available = size_class.m_available.load(std::memory_order_relaxed) - 1;
+      size_class.m_available.store(available, std::memory_order_relaxed);
+      if (AI_UNLIKELY(available < (size_t)s_low_watermark))
+        request_refill();
       return current_chunk;
     }
 
-    // Release a memory chunk so it can be returned again by allocate(), always in O(1) time.
-    void release(void const* ptr)
+    // Release a memory chunk of nframes samples so it can be returned again by allocate(), in O(1) time.
+    void release(void const* ptr, jack_nframes_t nframes)
     {
+      SizeClass* size_class = m_current;
+      if (AI_UNLIKELY(size_class->m_chunk_size != nframes))
+        size_class = find_size_class(nframes);
+      ASSERT(size_class && size_class->m_outstanding > 0);
       chunk* free_chunk = reinterpret_cast<chunk*>(const_cast<void*>(ptr));
-      free_chunk->meta.next = m_free_chunk;
-      m_free_chunk = free_chunk;
+      free_chunk->meta.next = size_class->m_free_chunk;
+      size_class->m_free_chunk = free_chunk;
+      size_class->m_available.store(size_class->m_available.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+      if (AI_UNLIKELY(--size_class->m_outstanding == 0) && size_class != m_current)
+        drained(size_class);
     }
 
+    // The number of times that allocate() had to use the reserve block because the refill thread didn't keep up.
+    int emergency_allocations() const { return m_emergency_allocations.load(std::memory_order_relaxed); }
+
+    // The number of times that allocate() returned NULL.
+    int failed_allocations() const { return m_failed_allocations.load(std::memory_order_relaxed); }
+
     // Return current chunk size.
-    jack_nframes_t chunk_size() const { return m_chunk_size; }
+    jack_nframes_t chunk_size() const { return m_current ? m_current->m_chunk_size : 0; }
+
+    // An upper limit for the memory that the pool uses while the buffer size is nframes.
+    static size_t memory_budget(jack_nframes_t nframes);
 
-    // Re-initialize this object for a new chuck size.
-    // This invalidates ALL pointers previously returned by allocate()!
-    // You may not even call release() on them anymore.
+    // Switch to a new chunk size.
+    // Chunks of the previous size remain valid until they are released.
     void buffer_size_changed(jack_nframes_t nframes);
 };
 
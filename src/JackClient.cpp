@@ -30,6 +30,7 @@
 #include "JackClient.h"
 #include "JackPorts.h"
 #include "Configuration.h"
+#include "NoAllocationScope.h"
 #include "utils/AIAlert.h"
 
 //static
@@ -53,14 +54,28 @@ int JackClient::process_cb(jack_nframes_t nframes, void* self)
 {
   //DoutEntering(dc::notice, "JackClient::process_cb(" << nframes << ", " << self << ")");
 
+  // The process thread may never use the heap.
+  NoAllocationScope no_allocation;
+
   JackClient* client = static_cast<JackClient*>(self);
-  jack_default_audio_sample_t* in = (jack_default_audio_sample_t*)jack_port_get_buffer(client->m_input_port, nframes);
-  jack_default_audio_sample_t* out = (jack_default_audio_sample_t*)jack_port_get_buffer(client->m_output_port, nframes);
-  return client->process(in, out, nframes);
+  int const number_of_channels = client->number_of_channels();
+  for (int channel = 0; channel < number_of_channels; ++channel)
+  {
+    client->m_input_buffers[channel] = (jack_default_audio_sample_t*)jack_port_get_buffer(client->m_input_ports[channel], nframes);
+    client->m_output_buffers[channel] = (jack_default_audio_sample_t*)jack_port_get_buffer(client->m_output_ports[channel], nframes);
+  }
+  return client->process(client->m_input_buffers.data(), client->m_output_buffers.data(), nframes);
 }
 
-JackClient::JackClient(char const* name) : m_input_buffer_size(0), m_sample_rate(0)
+JackClient::JackClient(char const* name, int number_of_channels) :
+  m_input_buffer_size(0), m_input_buffers(number_of_channels), m_output_buffers(number_of_channels), m_sample_rate(0)
 {
+  if (number_of_channels < 1 || number_of_channels > Configuration::max_channels)
+  {
+    THROW_ALERT("The number of channels ([CHANNELS]) must be between 1 and [MAX].",
+        AIArgs("[CHANNELS]", number_of_channels)("[MAX]", Configuration::max_channels));
+  }
+
   // Try to become a client of the JACK server.
   m_client = jack_client_open(name, JackNoStartServer, NULL);
   if (!m_client)
@@ -94,9 +109,13 @@ JackClient::JackClient(char const* name) : m_input_buffer_size(0), m_sample_rate
   // Tell the JACK server to call port_connect_cb whenever a connection is made.
   jack_set_port_connect_callback(m_client, &JackClient::port_connect_cb, this);
 
-  // Create two ports.
-  m_input_port = jack_port_register(m_client, "input", JACK_DEFAULT_AUDIO_TYPE, JackPortIsInput, 0);
-  m_output_port = jack_port_register(m_client, "output", JACK_DEFAULT_AUDIO_TYPE, JackPortIsOutput, 0);
+  // Create an input and output port per channel. A mono client keeps the names "input" and "output".
+  for (int channel = 0; channel < number_of_channels; ++channel)
+  {
+    std::string const suffix = number_of_channels == 1 ? std::string() : "_" + std::to_string(channel + 1);
+    m_input_ports.push_back(jack_port_register(m_client, ("input" + suffix).c_str(), JACK_DEFAULT_AUDIO_TYPE, JackPortIsInput, 0));
+    m_output_ports.push_back(jack_port_register(m_client, ("output" + suffix).c_str(), JACK_DEFAULT_AUDIO_TYPE, JackPortIsOutput, 0));
+  }
 }
 
 //static
@@ -147,49 +166,63 @@ void JackClient::activate()
   }
 }
 
-// Connect input and output port.
+void JackClient::deactivate()
+{
+  DoutEntering(dc::notice, "JackClient::deactivate()");
+  // This waits until the process thread returned from process(); doing it twice is harmless.
+  int err = jack_deactivate(m_client);
+  if (err)
+    Dout(dc::warning, "jack_deactivate failed (" << err << ").");
+}
+
+// Connect the input and output ports of all channels.
 void JackClient::connect_ports()
 {
   bool needs_update = false;
   JackPorts ports(m_client);
-  // First connect output then input.
-  for (int connect_output = 1; connect_output >= 0; --connect_output)
+  Configuration& configuration(Singleton<Configuration>::instance());
+  for (int channel = 0; channel < number_of_channels(); ++channel)
   {
-    // Do some magic to define the correct values to source_port_name and target_port_name.
-    std::set<std::string> other_port_names =
-      connect_output ? Singleton<Configuration>::instance().get_playback_ports()
-                     : Singleton<Configuration>::instance().get_capture_ports();
-    if (other_port_names.empty())
+    // First connect output then input.
+    for (int connect_output = 1; connect_output >= 0; --connect_output)
     {
-      other_port_names.insert(ports.get(JackPortIsPhysical | (connect_output ? JackPortIsInput : JackPortIsOutput)));
-      if (connect_output)
-        Singleton<Configuration>::instance().set_playback_ports(other_port_names);
-      else
-        Singleton<Configuration>::instance().set_capture_ports(other_port_names);
-      needs_update = true;
-    }
-    std::string our_port = jack_port_name(connect_output ? m_output_port : m_input_port);
-    for (std::set<std::string>::iterator iter = other_port_names.begin(); iter != other_port_names.end(); ++iter)
-    {
-      std::string source_port_name = *iter;
-      std::string target_port_name = our_port;
-      if (connect_output) std::swap(source_port_name, target_port_name);
-
-      // Connect port source_port_name to target_port_name.
-      int err = jack_connect(m_client, source_port_name.c_str(), target_port_name.c_str());
-      if (err == EEXIST)
+      // Do some magic to define the correct values to source_port_name and target_port_name.
+      std::set<std::string> other_port_names =
+        connect_output ? configuration.get_playback_ports(channel)
+                       : configuration.get_capture_ports(channel);
+      if (other_port_names.empty())
       {
-        std::cout << "Ports " << source_port_name << " and " << target_port_name << " are already connected!" << std::endl;
+        // Connect channel N to the N-th physical port.
+        other_port_names.insert(ports.get(JackPortIsPhysical | (connect_output ? JackPortIsInput : JackPortIsOutput), channel));
+        if (connect_output)
+          configuration.set_playback_ports(channel, other_port_names);
+        else
+          configuration.set_capture_ports(channel, other_port_names);
+        needs_update = true;
       }
-      else if (err)
+      std::string our_port = jack_port_name(connect_output ? m_output_ports[channel] : m_input_ports[channel]);
+      for (std::set<std::string>::iterator iter = other_port_names.begin(); iter != other_port_names.end(); ++iter)
       {
-        THROW_ALERTC(err, "jack_connect: Cannot connect port \"[PORT1]\" to \"[PORT2]\"",
-            AIArgs("[PORT1]", source_port_name)("[PORT2]", target_port_name));
+        std::string source_port_name = *iter;
+        std::string target_port_name = our_port;
+        if (connect_output) std::swap(source_port_name, target_port_name);
+
+        // Connect port source_port_name to target_port_name.
+        int err = jack_connect(m_client, source_port_name.c_str(), target_port_name.c_str());
+        if (err == EEXIST)
+        {
+          std::cout << "Ports " << source_port_name << " and " << target_port_name << " are already connected!" << std::endl;
+        }
+        else if (err)
+        {
+          THROW_ALERTC(err, "jack_connect: Cannot connect port \"[PORT1]\" to \"[PORT2]\"",
+              AIArgs("[PORT1]", source_port_name)("[PORT2]", target_port_name));
+        }
       }
     }
   }
   if (needs_update)
-    Singleton<Configuration>::instance().update();
+    configuration.update();
 }
 
 //static
@@ -211,7 +244,8 @@ void JackClient::port_connect(jack_port_id_t a, jack_port_id_t b, int
 
   if (jack_port_is_mine(m_client, port_a))
   {
-    assert(strcmp(jack_port_short_name(port_a), "output") == 0);
+    int channel = channel_of(port_a, m_output_ports);
+    assert(channel != -1);
     assert(jack_port_flags(port_a) == JackPortIsOutput);
     char const** array = jack_port_get_connections(port_a);
     std::set<std::string> playback_ports;
@@ -220,11 +254,12 @@ void JackClient::port_connect(jack_port_id_t a, jack_port_id_t b, int
       for (char const** ptr = array; *ptr; ++ptr) playback_ports.insert(*ptr);
       jack_free(array);
     }
-    Singleton<Configuration>::instance().set_playback_ports(playback_ports);
+    Singleton<Configuration>::instance().set_playback_ports(channel, playback_ports);
   }
   if (jack_port_is_mine(m_client, port_b))
   {
-    assert(strcmp(jack_port_short_name(port_b), "input") == 0);
+    int channel = channel_of(port_b, m_input_ports);
+    assert(channel != -1);
     assert(jack_port_flags(port_b) == JackPortIsInput);
     char const** array = jack_port_get_connections(port_b);
     std::set<std::string> capture_ports;
@@ -233,11 +268,20 @@ void JackClient::port_connect(jack_port_id_t a, jack_port_id_t b, int
       for (char const** ptr = array; *ptr; ++ptr) capture_ports.insert(*ptr);
       jack_free(array);
     }
-    Singleton<Configuration>::instance().set_capture_ports(capture_ports);
+    Singleton<Configuration>::instance().set_capture_ports(channel, capture_ports);
   }
   Singleton<Configuration>::instance().update();
 }
 
+// Return the channel of port, or -1 if it isn't in ports.
+int JackClient::channel_of(jack_port_t const* port, std::vector<jack_port_t*> const& ports) const
+{
+  for (size_t channel = 0; channel < ports.size(); ++channel)
+    if (ports[channel] == port)
+      return channel;
+  return -1;
+}
+
 //static
 void JackClient::latency_cb(jack_latency_callback_mode_t mode, void* self)
 {
@@ -248,44 +292,48 @@ void JackClient::latency_cb(jack_latency_callback_mode_t mode, void* self)
 void JackClient::latency(jack_latency_callback_mode_t mode)
 {
   DoutEntering(dc::notice, "JackClient::latency(" << mode << ")");
-  jack_latency_range_t range;
-  range.min = 1000000;
-  range.max = 0;
-  jack_port_t* our_port = (mode == JackPlaybackLatency) ? m_input_port : m_output_port;
-  char const** connected_ports = jack_port_get_connections(our_port);
-  if (connected_ports)
+  // Calculate our delay; it is the same for all channels.
+  jack_latency_range_t delay;
+  calculate_delay(delay);
+  for (int channel = 0; channel < number_of_channels(); ++channel)
   {
-    char const** ptr = connected_ports;
-    assert(*ptr);       // Otherwise start with the while and don't call jack_port_set_latency_range when range is still 1000000, 0.
-    do
+    jack_latency_range_t range;
+    range.min = 1000000;
+    range.max = 0;
+    jack_port_t* our_port = (mode == JackPlaybackLatency) ? m_input_ports[channel] : m_output_ports[channel];
+    char const** connected_ports = jack_port_get_connections(our_port);
+    if (connected_ports)
     {
-      jack_port_t* port = jack_port_by_name(m_client, *ptr);
-      jack_latency_range_t port_latency_range;
-      jack_port_get_latency_range(port, mode, &port_latency_range);
-      range.min = std::min(range.min, port_latency_range.min);
-      range.max = std::max(range.max, port_latency_range.max);
-    }
-    while(*++ptr);
-    jack_free(connected_ports);
-    // Since we only have one input and one output port, we're free to add all delay on the output port.
-    if (mode == JackCaptureLatency)
-    {
-      // Calculate our delay.
-      jack_latency_range_t delay;
-      calculate_delay(delay);
-      // Update range.
-      range.min += delay.min;
-      range.max += delay.max;
+      char const** ptr = connected_ports;
+      assert(*ptr);     // Otherwise start with the while and don't call jack_port_set_latency_range when range is still 1000000, 0.
+      do
+      {
+        jack_port_t* port = jack_port_by_name(m_client, *ptr);
+        jack_latency_range_t port_latency_range;
+        jack_port_get_latency_range(port, mode, &port_latency_range);
+        range.min = std::min(range.min, port_latency_range.min);
+        range.max = std::max(range.max, port_latency_range.max);
+      }
+      while(*++ptr);
+      jack_free(connected_ports);
+      // Each input port only feeds the output port of the same channel, so we're free to add all delay on the output port.
+      if (mode == JackCaptureLatency)
+      {
+        // Update range.
+        range.min += delay.min;
+        range.max += delay.max;
+      }
+      Dout(dc::notice, "Calling jack_port_set_latency_range(" <<
+           ((mode == JackPlaybackLatency) ? "m_input_ports[" : "m_output_ports[") << channel << "], " <<
+           ((mode == JackPlaybackLatency) ? "JackPlaybackLatency" : "JackCaptureLatency") <<
+           ", {" << range.min << ", " << range.max << "})");
+      jack_port_set_latency_range(our_port, mode, &range);
     }
-    Dout(dc::notice, "Calling jack_port_set_latency_range(" <<
-         ((mode == JackPlaybackLatency) ? "m_input_port, JackPlaybackLatency" : "m_output_port, JackCaptureLatency") <<
-         ", {" << range.min << ", " << range.max << "})");
-    jack_port_set_latency_range(our_port, mode, &range);
   }
 }
 
 // This might get called while the derived class is being destructed: do nothing.
-int JackClient::process(jack_default_audio_sample_t*, jack_default_audio_sample_t*, jack_nframes_t)
+int JackClient::process(jack_default_audio_sample_t* const*, jack_default_audio_sample_t* const*, jack_nframes_t)
 {
   return 0;
 }
@@ -22,6 +22,7 @@
 #define JACK_CLIENT_H
 
 #include <jack/jack.h>
+#include <vector>
 
 class Configuration;
 
@@ -31,17 +32,27 @@ class JackClient
     jack_client_t* m_client;
     jack_nframes_t m_input_buffer_size;
 
-    jack_port_t* m_input_port;
-    jack_port_t* m_output_port;
+    std::vector<jack_port_t*> m_input_ports;                    // One input port per channel.
+    std::vector<jack_port_t*> m_output_ports;                   // One output port per channel.
+    std::vector<jack_default_audio_sample_t*> m_input_buffers;  // Passed to process(); one buffer per channel.
+    std::vector<jack_default_audio_sample_t*> m_output_buffers; // Passed to process(); one buffer per channel.
 
     jack_nframes_t m_sample_rate;
 
   public:
-    JackClient(char const* name);
+    // Create a client with number_of_channels input and number_of_channels output ports.
+    JackClient(char const* name, int number_of_channels = 1);
     virtual ~JackClient();
     void activate();
+    // Stop calling process(). Derived classes must call this before destroying anything that process() uses.
+    void deactivate();
     void connect_ports();
 
+    int number_of_channels() const { return m_input_ports.size(); }
+
+    // The current sample rate. Unlike m_sample_rate, this may be used from any thread.
+    jack_nframes_t sample_rate() const { return jack_get_sample_rate(m_client); }
+
   private:
     static void thread_init_cb(void* self);
     static void shutdown_cb(void* self);
@@ -60,7 +71,11 @@ class JackClient
     virtual void latency(jack_latency_callback_mode_t mode);
     virtual void calculate_delay(jack_latency_range_t& range) { range.min = range.max = 0; }
 
-    virtual int process(jack_default_audio_sample_t* in, jack_default_audio_sample_t* out, jack_nframes_t nframes);
+    // in[channel] and out[channel] are the buffers of the input and output port of each channel.
+    virtual int process(jack_default_audio_sample_t* const* in, jack_default_audio_sample_t* const* out, jack_nframes_t nframes);
+
+  private:
+    int channel_of(jack_port_t const* port, std::vector<jack_port_t*> const& ports) const;
 };
 
 #endif // JACK_CLIENT_H
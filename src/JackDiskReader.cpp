@@ -0,0 +1,276 @@
+/**
+ * /file JackDiskReader.cpp
+ * /brief Implementation of class JackDiskReader.
+ *
+ * Copyright (C) 2016 Aleric Inglewood.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published
+ * by the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "sys.h"
+
+#include "JackDiskReader.h"
+#include "RTMemory.h"
+#include "debug.h"
+#include "utils/AIAlert.h"
+#include "utils/macros.h"
+#include <iostream>
+#include <algorithm>
+#include <climits>
+#include <cerrno>
+#include <cmath>
+#include <cstring>
+
+namespace {
+
+// The largest number of frames read from the file at once.
+jack_nframes_t const max_batch_frames = 16384;
+
+int ring_chunks(double prefetch_seconds, jack_nframes_t sample_rate, jack_nframes_t nframes)
+{
+  return std::max(2, (int)std::ceil(prefetch_seconds * sample_rate / nframes));
+}
+
+} // namespace
+
+JackDiskReader::JackDiskReader(std::shared_ptr<AudioSource> const& source, int number_of_channels, double prefetch_seconds, jack_nframes_t sample_rate, jack_nframes_t nframes) :
+    m_source(source), m_prefetch_seconds(prefetch_seconds), m_sample_rate(sample_rate), m_nframes(nframes), m_channels(number_of_channels), m_silence(NULL),
+    m_rewind_requested(0), m_repeat(false), m_pending_frames(0),
+    m_rewind_done(0), m_start_position(0), m_end_position(SIZE_MAX), m_underruns(0), m_terminate(false)
+{
+  allocate_rings();
+  sem_init(&m_wakeup, 0, 0);
+  m_thread = std::thread(&JackDiskReader::prefetch_thread, this);
+  sem_post(&m_wakeup);          // Fill the rings.
+}
+
+JackDiskReader::~JackDiskReader()
+{
+  m_terminate = true;
+  sem_post(&m_wakeup);
+  if (m_thread.joinable())
+    m_thread.join();
+  sem_destroy(&m_wakeup);
+  Dout(dc::notice, "JackDiskReader: " << m_underruns << " underruns.");
+  Singleton<RTMemory>::instance().deallocate_array(m_silence, m_nframes);
+}
+
+//static
+size_t JackDiskReader::memory_budget(int number_of_channels, double prefetch_seconds, jack_nframes_t sample_rate, jack_nframes_t nframes)
+{
+  // JackFIFOBuffer rounds the number of chunks up to a power of two, and uses huge pages.
+  size_t nchunks = 1;
+  while (nchunks < (size_t)ring_chunks(prefetch_seconds, sample_rate, nframes))
+    nchunks <<= 1;
+  size_t const huge_page_size = 2 * 1024 * 1024;
+  size_t const ring_size = (nchunks * nframes * sizeof(jack_default_audio_sample_t) + huge_page_size - 1) / huge_page_size * huge_page_size;
+  return number_of_channels * ring_size + nframes * sizeof(jack_default_audio_sample_t);
+}
+
+// Called with m_mutex locked, or before the prefetch thread is started.
+void JackDiskReader::allocate_rings()
+{
+  RTMemory& rt_memory(Singleton<RTMemory>::instance());
+  int const nchunks = ring_chunks(m_prefetch_seconds, m_sample_rate, m_nframes);
+  for (auto& channel : m_channels)
+  {
+    channel.m_ring.reset(new JackFIFOBuffer(nchunks, m_nframes));
+    channel.m_holding = false;
+  }
+  m_silence = rt_memory.allocate_array<jack_default_audio_sample_t>(m_nframes);
+  m_frames.resize(m_source ? std::max(max_batch_frames, m_nframes) * m_source->channels() : 0);
+}
+
+void JackDiskReader::set_source(std::shared_ptr<AudioSource> const& source)
+{
+  {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_source = source;
+    m_frames.resize(m_source ? std::max(max_batch_frames, m_nframes) * m_source->channels() : 0);
+  }
+  // Throw away what was prefetched from the old source.
+  rewind();
+}
+
+void JackDiskReader::buffer_size_changed(jack_nframes_t nframes)
+{
+  DoutEntering(dc::notice, "JackDiskReader::buffer_size_changed(" << nframes << ")");
+  {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    if (nframes == m_nframes)
+      return;
+    Singleton<RTMemory>::instance().deallocate_array(m_silence, m_nframes);
+    m_nframes = nframes;
+    allocate_rings();
+    // What was prefetched is gone; start at the beginning again.
+    if (m_source)
+      m_source->rewind();
+    m_start_position = 0;
+    m_end_position = SIZE_MAX;
+    m_rewind_done.store(m_rewind_requested.load(std::memory_order_relaxed), std::memory_order_release);
+  }
+  sem_post(&m_wakeup);
+}
+
+jack_default_audio_sample_t* JackDiskReader::read(int channel)
+{
+  Channel& ch(m_channels[channel]);
+  JackFIFOBuffer& ring(*ch.m_ring);
+
+  // The chunk returned by the previous call has been used now.
+  if (ch.m_holding)
+  {
+    ring.commit_pop(1);
+    ch.m_holding = false;
+  }
+  if (channel == 0)
+  {
+    m_pending_frames += m_nframes;
+    if (m_pending_frames >= s_wakeup_frames)
+    {
+      m_pending_frames = 0;
+      sem_post(&m_wakeup);
+    }
+  }
+
+  if (AI_UNLIKELY(m_rewind_done.load(std::memory_order_acquire) != m_rewind_requested.load(std::memory_order_relaxed)))
+  {
+    // Everything in the ring is from before the rewind.
+    JackFIFOBuffer::Span span;
+    while ((span = ring.acquire_pop(INT_MAX)).nchunks)
+      ring.commit_pop(span.nchunks);
+    return m_silence;
+  }
+
+  // Skip what was pushed before the last rewind.
+  size_t const start = m_start_position.load(std::memory_order_relaxed);
+  JackFIFOBuffer::Span span;
+  while (ring.popped() < start && (span = ring.acquire_pop(start - ring.popped())).nchunks)
+    ring.commit_pop(span.nchunks);
+
+  size_t const end = m_end_position.load(std::memory_order_acquire);
+  span = ring.acquire_pop(1);
+  if (AI_LIKELY(span.nchunks))
+  {
+    ch.m_holding = true;
+    return span.data;
+  }
+  if (ring.popped() >= end)
+    return NULL;        // End of the source.
+  // The prefetch thread didn't keep up (or the disk is too slow).
+  m_underruns.fetch_add(1, std::memory_order_relaxed);
+  return m_silence;
+}
+
+void JackDiskReader::rewind()
+{
+  m_rewind_requested.fetch_add(1, std::memory_order_relaxed);
+  sem_post(&m_wakeup);
+}
+
+// Called with m_mutex locked.
+void JackDiskReader::fill_rings()
+{
+  if (m_end_position.load(std::memory_order_relaxed) != SIZE_MAX)
+    return;     // At the end of the source; wait for a rewind.
+  if (!m_source)
+  {
+    // Nothing to play.
+    m_end_position.store(m_channels[0].m_ring->pushed(), std::memory_order_release);
+    return;
+  }
+  int const source_channels = m_source->channels();
+  int const max_batch_chunks = std::max(max_batch_frames / m_nframes, (jack_nframes_t)1);
+  std::vector<jack_default_audio_sample_t*> chunks(m_channels.size());
+  while (true)
+  {
+    // Every ring is filled in lockstep, so the same chunks are free in every ring.
+    int nchunks = max_batch_chunks;
+    for (size_t channel = 0; channel < m_channels.size(); ++channel)
+    {
+      JackFIFOBuffer::Span span = m_channels[channel].m_ring->acquire_write(nchunks);
+      nchunks = span.nchunks;
+      chunks[channel] = span.data;
+    }
+    if (nchunks == 0)
+      break;
+
+    jack_nframes_t const frames = nchunks * m_nframes;
+    jack_nframes_t got = 0;
+    bool at_end = false;
+    try
+    {
+      got = m_source->read(m_frames.data(), frames);
+      // Seek back to the start instead of reopening or re-reading the file.
+      while (got < frames && m_repeat.load(std::memory_order_relaxed) && m_source->frames() > 0)
+      {
+        m_source->rewind();
+        got += m_source->read(m_frames.data() + got * source_channels, frames - got);
+      }
+    }
+    catch (AIAlert::Error const& error)
+    {
+      std::cerr << error << std::endl;
+    }
+    if (got < frames)
+    {
+      at_end = true;
+      std::memset(m_frames.data() + got * source_channels, 0, (frames - got) * source_channels * sizeof(float));
+      nchunks = (got + m_nframes - 1) / m_nframes;
+    }
+
+    // De-interleave.
+    for (size_t channel = 0; channel < m_channels.size(); ++channel)
+    {
+      float const* in = m_frames.data() + channel % source_channels;
+      jack_default_audio_sample_t* out = chunks[channel];
+      for (jack_nframes_t frame = 0; frame < (jack_nframes_t)nchunks * m_nframes; ++frame, in += source_channels)
+        out[frame] = *in;
+      m_channels[channel].m_ring->commit_write(nchunks);
+    }
+
+    if (at_end)
+    {
+      m_end_position.store(m_channels[0].m_ring->pushed(), std::memory_order_release);
+      break;
+    }
+  }
+}
+
+// Runs in m_thread.
+void JackDiskReader::prefetch_thread()
+{
+  Debug(debug::init_thread());
+  while (true)
+  {
+    if (sem_wait(&m_wakeup) == -1)
+    {
+      ASSERT(errno == EINTR);
+      continue;
+    }
+    if (m_terminate)
+      break;
+    std::lock_guard<std::mutex> lock(m_mutex);
+    unsigned int const requested = m_rewind_requested.load(std::memory_order_relaxed);
+    if (requested != m_rewind_done.load(std::memory_order_relaxed))
+    {
+      if (m_source)
+        m_source->rewind();
+      m_end_position.store(SIZE_MAX, std::memory_order_relaxed);
+      m_start_position.store(m_channels[0].m_ring->pushed(), std::memory_order_relaxed);
+      m_rewind_done.store(requested, std::memory_order_release);
+    }
+    fill_rings();
+  }
+}
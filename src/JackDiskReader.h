@@ -0,0 +1,117 @@
+/**
+ * \file JackDiskReader.h
+ * \brief Declaration of JackDiskReader.
+ *
+ * Copyright (C) 2016 Aleric Inglewood.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published
+ * by the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef JACK_DISK_READER_H
+#define JACK_DISK_READER_H
+
+#include "JackFIFOBuffer.h"
+#include "AudioSource.h"
+#include <jack/jack.h>
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include <semaphore.h>
+
+// Streams an AudioSource (a WAV file on disk, or a CompressedTake) for playback.
+//
+// A prefetch thread reads the source and keeps a ring (a JackFIFOBuffer) per channel filled
+// with the next prefetch_seconds of audio; the real-time thread pops one chunk per cycle
+// from every ring with read(). Channel c plays channel c modulo the number of channels of the source.
+//
+// When the end of the file is reached the prefetch thread either seeks back to the start
+// and continues (repeat), or records the end position so that read() can report the end.
+// rewind() asks the prefetch thread to seek back to the start: it acknowledges that with
+// the number of chunks that it had pushed at that moment, and read() throws away everything
+// before that position.
+//
+// set_source() replaces the source (another thread may do that at any time) and rewinds;
+// without a source read() reports the end right away.
+//
+// read() may be called for different channels at the same time (from worker threads),
+// but for one channel only by one thread at a time. rewind() and set_repeat() are called
+// from the JACK process thread. None of them block.
+class JackDiskReader
+{
+  private:
+    struct Channel
+    {
+      std::unique_ptr<JackFIFOBuffer> m_ring;
+      bool m_holding;                           // Set when read() returned a chunk that wasn't popped yet.
+    };
+
+    static jack_nframes_t const s_wakeup_frames = 4096;        // Wake up the prefetch thread when this many frames were played.
+
+    std::shared_ptr<AudioSource> m_source;      // Only used by the prefetch thread (or with m_mutex locked). May be NULL.
+    double m_prefetch_seconds;
+    jack_nframes_t m_sample_rate;
+    jack_nframes_t m_nframes;                   // The number of frames per chunk.
+    std::vector<Channel> m_channels;
+    jack_default_audio_sample_t* m_silence;     // Returned by read() when the prefetch thread didn't keep up.
+    std::vector<float> m_frames;                // Scratch space for interleaved frames (prefetch thread).
+
+    // Written by the real-time thread.
+    std::atomic<unsigned int> m_rewind_requested;       // Incremented by rewind() (also by set_source()).
+    std::atomic<bool> m_repeat;
+    jack_nframes_t m_pending_frames;            // The number of frames played since the last wake up.
+
+    // Written by the prefetch thread.
+    std::atomic<unsigned int> m_rewind_done;    // The value of m_rewind_requested when the prefetch thread last rewound.
+    std::atomic<size_t> m_start_position;       // The number of chunks pushed into every ring at the last rewind.
+    std::atomic<size_t> m_end_position;         // The number of chunks pushed into every ring at the end of the file, or SIZE_MAX.
+    std::atomic<int> m_underruns;               // The number of times that read() returned silence.
+
+    std::mutex m_mutex;                         // Held by the prefetch thread while it uses m_source and the rings.
+    std::thread m_thread;
+    sem_t m_wakeup;                             // Posted when the rings have room, or a rewind is requested.
+    std::atomic<bool> m_terminate;              // Set by the destructor.
+
+  public:
+    JackDiskReader(std::shared_ptr<AudioSource> const& source, int number_of_channels, double prefetch_seconds, jack_nframes_t sample_rate, jack_nframes_t nframes);
+    ~JackDiskReader();
+
+    // Play source from the start. Not called from the real-time thread.
+    void set_source(std::shared_ptr<AudioSource> const& source);
+
+    // Real-time thread.
+    // Return the next chunk of channel, silence if the prefetch thread didn't keep up, or NULL at the end of the source.
+    jack_default_audio_sample_t* read(int channel);
+    void rewind();
+    void set_repeat(bool repeat) { m_repeat.store(repeat, std::memory_order_relaxed); }
+
+    // Reallocate the rings for chunks of nframes frames and rewind.
+    // Must not be called while the real-time thread is playing.
+    void buffer_size_changed(jack_nframes_t nframes);
+
+    // The bytes of RTMemory that are used for prefetch_seconds of number_of_channels channels.
+    static size_t memory_budget(int number_of_channels, double prefetch_seconds, jack_nframes_t sample_rate, jack_nframes_t nframes);
+
+    // Accessors.
+    jack_nframes_t nframes() const { return m_nframes; }
+    int underruns() const { return m_underruns; }
+
+  private:
+    void allocate_rings();
+    void fill_rings();
+    void prefetch_thread();
+};
+
+#endif // JACK_DISK_READER_H
@@ -0,0 +1,230 @@
+/**
+ * /file JackDiskWriter.cpp
+ * /brief Implementation of class JackDiskWriter.
+ *
+ * Copyright (C) 2016 Aleric Inglewood.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published
+ * by the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "sys.h"
+
+#include "JackDiskWriter.h"
+#include "WaveFileWriter.h"
+#include "debug.h"
+#include "utils/AIAlert.h"
+#include "utils/macros.h"
+#include <iostream>
+#include <algorithm>
+#include <climits>
+#include <cerrno>
+#include <ctime>
+
+JackDiskWriter::JackDiskWriter(std::vector<JackFIFOBuffer*> const& buffers, new_take_type const& new_take, take_finished_type const& take_finished) :
+    m_buffers(buffers), m_new_take(new_take), m_take_finished(take_finished), m_sample_rate(0),
+    m_marks_head(0), m_pending_frames(0), m_in_take(false), m_marks_tail(0), m_chunks(buffers.size()), m_terminate(false)
+{
+  static_assert((s_max_marks & (s_max_marks - 1)) == 0, "s_max_marks must be a power of two.");
+  sem_init(&m_wakeup, 0, 0);
+  m_thread = std::thread(&JackDiskWriter::writer_thread, this);
+}
+
+JackDiskWriter::~JackDiskWriter()
+{
+  m_terminate = true;
+  sem_post(&m_wakeup);
+  if (m_thread.joinable())
+    m_thread.join();
+  sem_destroy(&m_wakeup);
+}
+
+void JackDiskWriter::add_mark(bool begin)
+{
+  unsigned int const head = m_marks_head.load(std::memory_order_relaxed);
+  if (AI_UNLIKELY(head - m_marks_tail.load(std::memory_order_acquire) == s_max_marks))
+  {
+    // The helper thread is stuck; the takes will end up in the same sink.
+    Dout(dc::warning, "JackDiskWriter: too many pending take boundaries, dropping one.");
+    return;
+  }
+  Mark& mark(m_marks[head & (s_max_marks - 1)]);
+  mark.position = m_buffers[0]->pushed();
+  mark.begin = begin;
+  m_marks_head.store(head + 1, std::memory_order_release);
+  sem_post(&m_wakeup);
+}
+
+void JackDiskWriter::begin_take()
+{
+  m_in_take = true;
+  add_mark(true);
+}
+
+void JackDiskWriter::end_take()
+{
+  if (!m_in_take)
+    return;
+  m_in_take = false;
+  add_mark(false);
+}
+
+void JackDiskWriter::recorded(jack_nframes_t nframes)
+{
+  // Let the helper thread write in large batches.
+  m_pending_frames += nframes;
+  if (m_pending_frames >= s_wakeup_frames)
+  {
+    m_pending_frames = 0;
+    sem_post(&m_wakeup);
+  }
+}
+
+std::unique_lock<std::mutex> JackDiskWriter::flush()
+{
+  DoutEntering(dc::notice, "JackDiskWriter::flush()");
+  std::unique_lock<std::mutex> lock(m_mutex);
+  write_out();
+  // The buffers are empty now, and all marks are handled because none can lie beyond the last pushed chunk.
+  ASSERT(m_buffers[0]->empty() && m_marks_tail == m_marks_head);
+  return lock;
+}
+
+// Called with m_mutex locked.
+void JackDiskWriter::write_out()
+{
+  unsigned int tail = m_marks_tail.load(std::memory_order_relaxed);
+  while (true)
+  {
+    bool const have_mark = tail != m_marks_head.load(std::memory_order_acquire);
+    size_t const limit = have_mark ? m_marks[tail & (s_max_marks - 1)].position : SIZE_MAX;
+    drain(limit);
+    if (!have_mark || m_buffers[0]->popped() != limit)
+      break;
+    // Everything of the previous take is written.
+    close_take();
+    if (m_marks[tail & (s_max_marks - 1)].begin)
+      open_take();
+    m_marks_tail.store(++tail, std::memory_order_release);
+  }
+}
+
+// Write the chunks in the recording buffers to the current take, but not beyond chunk number limit.
+void JackDiskWriter::drain(size_t limit)
+{
+  size_t const number_of_channels = m_buffers.size();
+  while (true)
+  {
+    size_t const popped = m_buffers[0]->popped();
+    if (popped >= limit)
+      break;
+    // Because the buffers are filled in lockstep, the same chunks are available in every channel.
+    int nchunks = std::min(limit - popped, (size_t)INT_MAX);
+    for (size_t channel = 0; channel < number_of_channels; ++channel)
+    {
+      JackFIFOBuffer::Span span = m_buffers[channel]->acquire_pop(nchunks);
+      nchunks = span.nchunks;
+      m_chunks[channel] = span.data;
+    }
+    if (nchunks == 0)
+      break;
+    if (m_take)
+    {
+      try
+      {
+        m_take->write(m_chunks.data(), nchunks * m_buffers[0]->nframes());
+      }
+      catch (AIAlert::Error const& error)
+      {
+        // The rest of this take is lost.
+        std::cerr << error << std::endl;
+        close_take();
+      }
+    }
+    for (size_t channel = 0; channel < number_of_channels; ++channel)
+      m_buffers[channel]->commit_pop(nchunks);
+  }
+}
+
+//static
+JackDiskWriter::new_take_type JackDiskWriter::wave_files(std::string const& directory, bool direct_io)
+{
+  return [directory, direct_io](int channels, jack_nframes_t sample_rate) -> std::shared_ptr<AudioSink>
+  {
+    time_t const now = time(NULL);
+    struct tm local_time;
+    char stamp[32];
+    strftime(stamp, sizeof(stamp), "%Y%m%d-%H%M%S", localtime_r(&now, &local_time));
+    std::shared_ptr<WaveFileWriter> file(std::make_shared<WaveFileWriter>());
+    // Don't overwrite a previous take that was started in the same second.
+    for (int n = 0;; ++n)
+    {
+      std::string filename = directory + "/take-" + stamp + (n ? "-" + std::to_string(n) : std::string()) + ".wav";
+      if (file->open(filename, channels, sample_rate, direct_io))
+        break;
+    }
+    Dout(dc::notice, "JackDiskWriter: recording to \"" << file->filename() << "\".");
+    return file;
+  };
+}
+
+void JackDiskWriter::open_take()
+{
+  try
+  {
+    m_take = m_new_take(m_buffers.size(), m_sample_rate);
+  }
+  catch (AIAlert::Error const& error)
+  {
+    std::cerr << error << std::endl;
+  }
+}
+
+void JackDiskWriter::close_take()
+{
+  if (!m_take)
+    return;
+  try
+  {
+    m_take->close();
+    if (m_take_finished)
+      m_take_finished(m_take);
+  }
+  catch (AIAlert::Error const& error)
+  {
+    std::cerr << error << std::endl;
+  }
+  m_take.reset();
+}
+
+// Runs in m_thread.
+void JackDiskWriter::writer_thread()
+{
+  Debug(debug::init_thread());
+  while (true)
+  {
+    if (sem_wait(&m_wakeup) == -1)
+    {
+      ASSERT(errno == EINTR);
+      continue;
+    }
+    std::lock_guard<std::mutex> lock(m_mutex);
+    write_out();
+    if (m_terminate)
+    {
+      // Finish the current take with what we have.
+      close_take();
+      break;
+    }
+  }
+}
@@ -0,0 +1,118 @@
+/**
+ * \file JackDiskWriter.h
+ * \brief Declaration of JackDiskWriter.
+ *
+ * Copyright (C) 2016 Aleric Inglewood.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published
+ * by the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef JACK_DISK_WRITER_H
+#define JACK_DISK_WRITER_H
+
+#include "JackFIFOBuffer.h"
+#include "AudioSink.h"
+#include <jack/jack.h>
+#include <atomic>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#include <semaphore.h>
+
+// Streams recordings to disk (or to any other AudioSink).
+//
+// The real-time thread keeps pushing chunks into the recording buffers (one JackFIFOBuffer
+// per channel), while a helper thread pops them and writes them to the AudioSink of the
+// current take, usually a WAV file. The recording buffers then only have to absorb the
+// jitter of the disk, instead of limiting the length of a take.
+//
+// The recording buffers must be filled in lockstep: every channel gets a chunk in the same cycle.
+//
+// Take boundaries are passed from the real-time thread as marks: the number of chunks that
+// were pushed into the first recording buffer when the take began or ended. Everything before
+// a begin mark belongs to the previous take, so the helper thread can finish the previous
+// take and create the next one at exactly the right chunk, however far behind it is.
+// The sink of every take is created by the new_take function passed to the constructor,
+// and handed to take_finished (if any) after it was closed; both are called by the helper thread.
+//
+// begin_take(), end_take() and recorded() are called from the real-time thread, and never block.
+class JackDiskWriter
+{
+  public:
+    typedef std::function<std::shared_ptr<AudioSink> (int channels, jack_nframes_t sample_rate)> new_take_type;
+    typedef std::function<void (std::shared_ptr<AudioSink> const& take)> take_finished_type;
+
+  private:
+    struct Mark
+    {
+      size_t position;                          // The number of chunks pushed into the first recording buffer.
+      bool begin;                               // True if a take begins at position, false if it ends there.
+    };
+
+    static int const s_max_marks = 16;         // The number of marks that can be pending (a power of two).
+    static jack_nframes_t const s_wakeup_frames = 16384;       // Wake up the helper thread when this many frames were recorded.
+
+    std::vector<JackFIFOBuffer*> m_buffers;     // The recording buffer of every channel.
+    new_take_type m_new_take;
+    take_finished_type m_take_finished;
+    std::atomic<jack_nframes_t> m_sample_rate;
+
+    // Written by the real-time thread.
+    Mark m_marks[s_max_marks];
+    std::atomic<unsigned int> m_marks_head;     // The number of marks added.
+    jack_nframes_t m_pending_frames;            // The number of frames recorded since the last wake up.
+    bool m_in_take;                             // Set between begin_take() and end_take().
+
+    // Written by the helper thread.
+    std::atomic<unsigned int> m_marks_tail;     // The number of marks handled.
+    std::shared_ptr<AudioSink> m_take;          // The sink of the current take, or NULL.
+    std::vector<jack_default_audio_sample_t const*> m_chunks;  // Scratch space: the chunks to write, one pointer per channel.
+
+    std::mutex m_mutex;                         // Held by the helper thread while it uses the recording buffers.
+    std::thread m_thread;
+    sem_t m_wakeup;                             // Posted when there is something to write.
+    std::atomic<bool> m_terminate;              // Set by the destructor.
+
+  public:
+    JackDiskWriter(std::vector<JackFIFOBuffer*> const& buffers, new_take_type const& new_take, take_finished_type const& take_finished = take_finished_type());
+    ~JackDiskWriter();
+
+    // Returns a new_take function that writes every take to a new WAV file in directory.
+    static new_take_type wave_files(std::string const& directory, bool direct_io);
+
+    // Real-time thread.
+    void begin_take();                          // The next chunk pushed starts a new take.
+    void end_take();                            // The last chunk of the current take was pushed.
+    void recorded(jack_nframes_t nframes);      // Called every cycle in which a chunk was pushed.
+
+    // Write out everything that is in the recording buffers and keep the helper thread away from
+    // them until the returned lock is released; afterwards the buffers may be reallocated.
+    // Must not be called while the real-time thread is recording.
+    std::unique_lock<std::mutex> flush();
+
+    void sample_rate_changed(jack_nframes_t sample_rate) { m_sample_rate = sample_rate; }
+
+  private:
+    void add_mark(bool begin);
+    void write_out();
+    void drain(size_t limit);
+    void open_take();
+    void close_take();
+    void writer_thread();
+};
+
+#endif // JACK_DISK_WRITER_H
@@ -21,25 +21,98 @@
 #include "sys.h"
 
 #include <cmath>
-#include <fftw3.h>
+#include <cstring>
 
 #include "JackFIFOBuffer.h"
+#include "NoAllocationScope.h"
+#include "RTMemory.h"
 #include "debug.h"
+#include "utils/AIAlert.h"
+
+char const JackFIFOBuffer::s_store_magic[8] = "SPFIFO2";
+
+void JackFIFOBuffer::free_buffer()
+{
+  RTMemory& rt_memory(Singleton<RTMemory>::instance());
+  if (m_store)
+    rt_memory.unmap_file(m_store, s_store_header_size + m_capacity * sizeof(jack_default_audio_sample_t));
+  else if (m_buffer)
+    rt_memory.deallocate_array(m_buffer, m_capacity, true);
+  m_store = NULL;
+  m_buffer = NULL;
+}
 
 void JackFIFOBuffer::reallocate_buffer(int nchunks, jack_nframes_t nframes)
 {
-  m_nframes = nframes;
-  m_capacity = nframes * nchunks;
+  NoAllocationScope::check();
+  RTMemory& rt_memory(Singleton<RTMemory>::instance());
   // The following is safe because the buffer isn't used at the moment.
-  if (m_buffer)
-    fftwf_free(m_buffer);
-  m_buffer = fftwf_alloc_real(m_capacity);
-  Dout(dc::notice, "Allocated buffer at " << m_buffer << " till " << &m_buffer[m_capacity]);
-  m_head = m_buffer;
+  free_buffer();
+  // Round the number of chunks up to a power of two, so that we can use a mask instead of a modulo.
+  size_t number_of_chunks = 1;
+  while (number_of_chunks < (size_t)nchunks)
+    number_of_chunks <<= 1;
+  m_mask = number_of_chunks - 1;
+  m_nframes = nframes;
+  m_capacity = nframes * number_of_chunks;
+  m_head = 0;
+  m_cached_tail = 0;
+  if (m_store_path.empty())
+  {
+    // This buffer is large (seconds of audio), so use huge pages if possible.
+    m_buffer = rt_memory.allocate_array<jack_default_audio_sample_t>(m_capacity, true);
+    Dout(dc::notice, "Allocated buffer at " << m_buffer << " till " << &m_buffer[m_capacity]);
+    clear();
+    return;
+  }
+
+  char* mapping = static_cast<char*>(rt_memory.map_file(m_store_path, s_store_header_size + m_capacity * sizeof(jack_default_audio_sample_t)));
+  m_store = reinterpret_cast<StoreHeader*>(mapping);
+  m_buffer = reinterpret_cast<jack_default_audio_sample_t*>(mapping + s_store_header_size);
+  Dout(dc::notice, "Mapped \"" << m_store_path << "\" at " << m_buffer << " till " << &m_buffer[m_capacity]);
+  // Continue with the recording in the file, if it was made with the same buffer layout.
+  StoreHeader const& header(*m_store);
+  if (std::memcmp(header.magic, s_store_magic, sizeof(s_store_magic)) == 0 &&
+      header.nframes == m_nframes && header.nchunks == number_of_chunks &&
+      header.head - header.tail <= number_of_chunks && header.readptr - header.tail * m_nframes <= (header.head - header.tail) * m_nframes)
+  {
+    Dout(dc::notice, "Restored " << (header.head - header.tail) << " chunks from \"" << m_store_path << "\".");
+    m_head = m_cached_head = header.head;
+    m_cached_tail = header.tail;
+    m_tail = header.tail;
+    m_readptr = header.readptr;
+    return;
+  }
+  std::memcpy(m_store->magic, s_store_magic, sizeof(s_store_magic));
+  m_store->nframes = m_nframes;
+  m_store->nchunks = number_of_chunks;
+  m_store->head = 0;
   clear();
 }
 
-JackFIFOBuffer::JackFIFOBuffer(jack_client_t* client, double period) : m_buffer(NULL)
+bool JackFIFOBuffer::use_store(std::string const& path)
+{
+  DoutEntering(dc::notice, "JackFIFOBuffer::use_store(\"" << path << "\")");
+  int const number_of_chunks = nchunks();
+  m_store_path = path;
+  try
+  {
+    reallocate_buffer(number_of_chunks, m_nframes);
+  }
+  catch (AIAlert::Error const&)
+  {
+    // Continue without a store.
+    m_store_path.clear();
+    reallocate_buffer(number_of_chunks, m_nframes);
+    throw;
+  }
+  return !empty();
+}
+
+// Everything is initialized before calling reallocate_buffer(), because clear() reads m_tail and m_readptr.
+JackFIFOBuffer::JackFIFOBuffer(jack_client_t* client, double period) :
+    m_nframes(0), m_capacity(0), m_buffer(NULL), m_mask(0), m_store(NULL),
+    m_head(0), m_cached_tail(0), m_tail(0), m_readptr(0), m_cached_head(0)
 {
   DoutEntering(dc::notice, "JackFIFOBuffer::JackFIFOBuffer(" << client << ", " << period << ")");
   jack_nframes_t sample_rate = jack_get_sample_rate(client);
@@ -47,14 +120,13 @@ JackFIFOBuffer::JackFIFOBuffer(jack_client_t* client, double period) : m_buffer(
   jack_nframes_t nframes = jack_get_buffer_size(client);
   Dout(dc::notice, "nframes = " << nframes);
   intptr_t const required_samples = std::round(period * sample_rate);
-  int const nchunks = (required_samples + nframes / 2) / nframes + 1;
+  int const nchunks = (required_samples + nframes / 2) / nframes;
   reallocate_buffer(nchunks, nframes);
 }
 
 JackFIFOBuffer::~JackFIFOBuffer()
 {
-  if (m_buffer)
-    fftwf_free(m_buffer);
+  free_buffer();
 }
 
 void JackFIFOBuffer::buffer_size_changed(jack_nframes_t nframes)
@@ -25,103 +25,234 @@
 #include <atomic>
 #include <cstdint>
 #include <cstring>
+#include <algorithm>
+#include <string>
 #include "debug.h"
 
+// Single producer, single consumer circular buffer of chunks of nframes() frames.
+//
+// The number of chunks is a power of two; m_head and m_tail count chunks and are never
+// wrapped, so that the position in the buffer is simply the index masked with m_mask
+// and the buffer is full when m_head - m_tail equals the number of chunks.
+//
+// The variables written by the producer and those written by the consumer are in
+// different cache lines. Both sides keep a copy of the index of the other side and only
+// load the atomic when that copy says that the buffer is full (producer) or empty (consumer).
+//
+// Next to the one-chunk-at-a-time functions, acquire_write()/commit_write() and
+// acquire_pop()/commit_pop() give access to many contiguous chunks at once, so that
+// for example a disk writer can drain a large batch with a single atomic store.
+//
+// The non-destructive read position of the consumer (read_frames(), seek()) counts frames,
+// not chunks, so that playback can start anywhere; a read that crosses the end of the buffer
+// is split into two contiguous pieces.
+//
+// After use_store() the buffer lives in a memory mapped file, preceded by a header page
+// that holds the indices; the file is written back by the kernel, so the recording
+// survives a restart (or crash) and is available again as soon as it is mapped.
 class JackFIFOBuffer
 {
+  public:
+    //! A range of contiguous chunks in the buffer.
+    struct Span
+    {
+      jack_default_audio_sample_t* data;                //!< The first frame of the first chunk.
+      int nchunks;                                      //!< The number of chunks (zero if none are available).
+    };
+
+    //! A range of contiguous frames in the buffer.
+    struct FrameSpan
+    {
+      jack_default_audio_sample_t* data;                //!< The first frame.
+      jack_nframes_t nframes;                           //!< The number of frames (zero if none are available).
+    };
+
   private:
+    // The first page of the file behind the buffer.
+    struct StoreHeader
+    {
+      char magic[8];                                    //!< s_store_magic.
+      uint64_t nframes;                                 //!< The number of frames per chunk.
+      uint64_t nchunks;                                 //!< The number of chunks.
+      alignas(64) uint64_t head;                        //!< Copy of m_head (written by the producer).
+      alignas(64) uint64_t tail;                        //!< Copy of m_tail (written by the consumer).
+      uint64_t readptr;                                 //!< Copy of m_readptr, in frames (written by the consumer).
+    };
+    static size_t const s_store_header_size = 4096;
+    static char const s_store_magic[8];
+
+    // Only changed while neither thread uses the buffer.
     jack_nframes_t m_nframes;                           //!< Number of frames per jack buffer (one frame is one sample because this is mono).
     intptr_t m_capacity;                                //!< Total size of m_buffer in jack_default_audio_sample_t's (nframes * nchunks).
     jack_default_audio_sample_t* m_buffer;              //!< Buffer start.
-    std::atomic<jack_default_audio_sample_t*> m_head;   //!< Write position in circular buffer.
-    jack_default_audio_sample_t* m_readptr;             //!< Non-destructive read position in circular buffer.
-    std::atomic<jack_default_audio_sample_t*> m_tail;   //!< Read position in circular buffer.
+    size_t m_mask;                                      //!< The number of chunks minus one.
+    std::string m_store_path;                           //!< The file behind the buffer, or empty.
+    StoreHeader* m_store;                               //!< The header page of the mapped file, or NULL.
+
+    // Written by the producer.
+    alignas(64) std::atomic<size_t> m_head;             //!< Index of the next chunk to write.
+    size_t m_cached_tail;                               //!< The value of m_tail when the producer last looked.
+
+    // Written by the consumer.
+    alignas(64) std::atomic<size_t> m_tail;             //!< Index of the oldest chunk in the buffer.
+    size_t m_readptr;                                   //!< Index of the next frame returned by read_frames() (non-destructive read position).
+    size_t m_cached_head;                               //!< The value of m_head when the consumer last looked.
 
   private:
-    jack_default_audio_sample_t* increment(jack_default_audio_sample_t* ptr) const { return ((ptr - m_buffer + m_nframes) % m_capacity) + m_buffer; }
+    jack_default_audio_sample_t* chunk(size_t index) const { return m_buffer + (index & m_mask) * m_nframes; }
+    size_t nchunks() const { return m_mask + 1; }
     void reallocate_buffer(int nchunks, jack_nframes_t nframes);
+    void free_buffer();
+    void store_consumer_state() { if (m_store) { m_store->tail = m_tail.load(std::memory_order_relaxed); m_store->readptr = m_readptr; } }
+
+    // The number of contiguous chunks starting at index, at most n.
+    int contiguous(size_t index, size_t n) const { return std::min(n, nchunks() - (index & m_mask)); }
 
   public:
-    //! Construct a buffer for \a client with a duration of \a period seconds.
+    //! Construct a buffer for \a client with a duration of (at least) \a period seconds.
     JackFIFOBuffer(jack_client_t* client, double period);
 
-    //! Construct a buffer of \a nchunks chunks, each of \a nframes frames.
-    JackFIFOBuffer(int nchunks, jack_nframes_t nframes) : m_buffer(NULL) { reallocate_buffer(nchunks + 1, nframes); }
+    //! Construct a buffer of (at least) \a nchunks chunks, each of \a nframes frames.
+    JackFIFOBuffer(int nchunks, jack_nframes_t nframes) :
+        m_nframes(0), m_capacity(0), m_buffer(NULL), m_mask(0), m_store(NULL),
+        m_head(0), m_cached_tail(0), m_tail(0), m_readptr(0), m_cached_head(0) { reallocate_buffer(nchunks, nframes); }
 
     //! Destructor.
     virtual ~JackFIFOBuffer();
 
+    //! Keep the buffer in the file at \a path from now on. If the file holds a buffer of the same size, continue with its contents.
+    //! Returns true if a previous recording was restored. Must not be called while the buffer is in use.
+    //! Throws AIAlert::Error if the file can't be mapped, in which case the buffer stays in (empty) memory.
+    bool use_store(std::string const& path);
+
     //-------------------------------------------------------------------------
     // Producer thread.
 
     //! Copy m_nframes frames from \a in to m_head and advance head. Returns true if the operation succeeded, false if the buffer is full.
     bool push(jack_default_audio_sample_t const* in)
     {
-      auto const current_head = m_head.load(std::memory_order_relaxed);
-      auto const next_head = increment(current_head);
-
-      if (next_head != m_tail.load(std::memory_order_acquire))  // Otherwise the buffer would appear empty after the m_head.store below,
-                                                                // and we'd be writing over data that possibly still needs to be read
-                                                                // by the consumer (that was returned by pop()).
-      {
-        std::memcpy(current_head, in, m_nframes * sizeof(jack_default_audio_sample_t));
-        m_head.store(next_head, std::memory_order_release);
-        return true;
-      }
-
-      return false; // Full queue.
+      Span span = acquire_write(1);
+      if (!span.nchunks)
+        return false; // Full queue.
+      std::memcpy(span.data, in, m_nframes * sizeof(jack_default_audio_sample_t));
+      commit_write(1);
+      return true;
     }
 
     // Same as the above but writes zero's.
     bool push_zero()
     {
-      auto const current_head = m_head.load(std::memory_order_relaxed);
-      auto const next_head = increment(current_head);
+      Span span = acquire_write(1);
+      if (!span.nchunks)
+        return false; // Full queue.
+      std::memset(span.data, 0, m_nframes * sizeof(jack_default_audio_sample_t));
+      commit_write(1);
+      return true;
+    }
 
-      if (next_head != m_tail.load(std::memory_order_acquire))  // Otherwise the buffer would appear empty after the m_head.store below,
-                                                                // and we'd be writing over data that possibly still needs to be read
-                                                                // by the consumer (that was returned by pop()).
+    //! Return up to \a max_chunks contiguous free chunks at the head. Write them, then call commit_write().
+    Span acquire_write(int max_chunks)
+    {
+      size_t const current_head = m_head.load(std::memory_order_relaxed);
+      size_t free_chunks = nchunks() - (current_head - m_cached_tail);
+      if (free_chunks < (size_t)max_chunks)
       {
-        std::memset(current_head, 0, m_nframes * sizeof(jack_default_audio_sample_t));
-        m_head.store(next_head, std::memory_order_release);
-        return true;
+        // We may not write over data that still needs to be read by the consumer (that was returned by pop()).
+        m_cached_tail = m_tail.load(std::memory_order_acquire);
+        free_chunks = nchunks() - (current_head - m_cached_tail);
       }
+      Span span = { chunk(current_head), contiguous(current_head, std::min(free_chunks, (size_t)max_chunks)) };
+      return span;
+    }
 
-      return false; // Full queue.
+    //! Make \a nchunks chunks that were returned by acquire_write() available to the consumer.
+    void commit_write(int nchunks)
+    {
+      size_t const next_head = m_head.load(std::memory_order_relaxed) + nchunks;
+      m_head.store(next_head, std::memory_order_release);
+      if (m_store)
+        m_store->head = next_head;
     }
 
+    //! The number of chunks pushed since the buffer was (re)allocated.
+    size_t pushed() const { return m_head.load(std::memory_order_relaxed); }
+
     //-------------------------------------------------------------------------
     // Consumer thread.
 
-    //! Return m_tail and advance it, possibly also advancing m_readptr. Returns NULL if the buffer is empty.
+    //! Return m_tail and advance it, possibly also advancing the read position. Returns NULL if the buffer is empty.
     jack_default_audio_sample_t* pop()
     {
-      auto const current_tail = m_tail.load(std::memory_order_relaxed);
-      if (current_tail == m_head.load(std::memory_order_acquire))
+      Span span = acquire_pop(1);
+      if (!span.nchunks)
         return NULL; // Empty queue.
+      commit_pop(1);
+      return span.data;
+    }
+
+    //! Return up to \a max_chunks contiguous recorded chunks at the tail, without removing them; call commit_pop() when done.
+    Span acquire_pop(int max_chunks)
+    {
+      size_t const current_tail = m_tail.load(std::memory_order_relaxed);
+      size_t available = m_cached_head - current_tail;
+      if (available < (size_t)max_chunks)
+      {
+        m_cached_head = m_head.load(std::memory_order_acquire);
+        available = m_cached_head - current_tail;
+      }
+      Span span = { chunk(current_tail), contiguous(current_tail, std::min(available, (size_t)max_chunks)) };
+      return span;
+    }
 
-      auto const next_tail = increment(current_tail);
-      if (current_tail == m_readptr)
-        m_readptr = next_tail;
+    //! Remove \a nchunks chunks, that were returned by acquire_pop(), from the buffer.
+    void commit_pop(int nchunks)
+    {
+      size_t const next_tail = m_tail.load(std::memory_order_relaxed) + nchunks;
+      if (m_readptr < next_tail * m_nframes)
+        m_readptr = next_tail * m_nframes;
       m_tail.store(next_tail, std::memory_order_release);
-      return current_tail;
+      store_consumer_state();
     }
 
-    //! Return m_readptr and advance it. Returns NULL if the read pointer is at the end of the buffer.
-    jack_default_audio_sample_t* read()
+    //! The number of chunks popped since the buffer was (re)allocated.
+    size_t popped() const { return m_tail.load(std::memory_order_relaxed); }
+
+    //! Return up to \a max_frames contiguous frames at the read position and advance it past them.
+    //! Stops at the end of the buffer and at frame \a limit (counted from the oldest frame); returns zero frames at the end.
+    FrameSpan read_frames(jack_nframes_t max_frames, size_t limit = SIZE_MAX)
     {
-      auto current_ptr = m_readptr;
-      if (current_ptr == m_head.load(std::memory_order_acquire))
-        return NULL; // At end.
+      size_t const first = m_tail.load(std::memory_order_relaxed) * m_nframes;
+      if (m_readptr + max_frames > m_cached_head * m_nframes)
+        m_cached_head = m_head.load(std::memory_order_acquire);
+      size_t end = m_cached_head * m_nframes;
+      if (limit < end - first)
+        end = first + limit;
+      size_t const index = m_readptr / m_nframes;
+      size_t const offset = (index & m_mask) * m_nframes + (m_readptr - index * m_nframes);
+      size_t const available = m_readptr < end ? end - m_readptr : 0;
+      FrameSpan span = { m_buffer + offset, (jack_nframes_t)std::min(std::min((size_t)max_frames, (size_t)m_capacity - offset), available) };
+      m_readptr += span.nframes;
+      if (m_store)
+        m_store->readptr = m_readptr;
+      return span;
+    }
 
-      m_readptr = increment(current_ptr);
-      return current_ptr;
+    //! Move the read position to \a frame frames after the oldest frame in the buffer, or to the end if there are fewer frames.
+    void seek(size_t frame)
+    {
+      size_t const first = m_tail.load(std::memory_order_relaxed) * m_nframes;
+      m_cached_head = m_head.load(std::memory_order_acquire);
+      m_readptr = first + std::min(frame, m_cached_head * m_nframes - first);
+      if (m_store)
+        m_store->readptr = m_readptr;
     }
 
     //! Reset the read pointer to the beginning of the recorded data in the buffer.
     void reset_readptr()
     {
-      m_readptr = m_tail.load(std::memory_order_relaxed);
+      m_readptr = m_tail.load(std::memory_order_relaxed) * m_nframes;
+      if (m_store)
+        m_store->readptr = m_readptr;
     }
 
     //! Clear the buffer.
@@ -131,9 +262,18 @@ class JackFIFOBuffer
     // the consumer thread is not using the buffer at that moment.
     void clear()
     {
-      auto const current_head = m_head.load(std::memory_order_relaxed);
-      m_readptr = current_head;
-      m_tail.store(current_head, std::memory_order_release);
+      keep_last(0);
+    }
+
+    //! Forget all but the last \a nchunks chunks and move the read position to the first of them. See clear().
+    void keep_last(size_t nchunks)
+    {
+      size_t const current_head = m_head.load(std::memory_order_relaxed);
+      size_t const next_tail = current_head - std::min(nchunks, current_head - m_tail.load(std::memory_order_relaxed));
+      m_cached_head = current_head;
+      m_readptr = next_tail * m_nframes;
+      m_tail.store(next_tail, std::memory_order_release);
+      store_consumer_state();
     }
 
     //-------------------------------------------------------------------------
@@ -144,8 +284,7 @@ class JackFIFOBuffer
     // Other threads   :             meaningless (don't call this)
     bool empty() const
     {
-      auto const current_head = m_head.load(std::memory_order_relaxed);
-      return current_head == m_tail.load(std::memory_order_relaxed);
+      return m_head.load(std::memory_order_relaxed) == m_tail.load(std::memory_order_relaxed);
     }
 
     // Return value    :  true                                false
@@ -154,8 +293,7 @@ class JackFIFOBuffer
     // Other threads   :             meaningless (don't call this)
     bool at_end() const
     {
-      auto const current_head = m_head.load(std::memory_order_relaxed);
-      return current_head == m_readptr;
+      return m_head.load(std::memory_order_relaxed) * m_nframes == m_readptr;
     }
 
     // Return value    :  true                                false
@@ -164,9 +302,7 @@ class JackFIFOBuffer
     // Other threads   :             meaningless (don't call this)
     bool full() const
     {
-      auto const current_tail = m_tail.load(std::memory_order_relaxed);
-      auto const next_head = increment(m_head.load(std::memory_order_relaxed));
-      return next_head == current_tail;
+      return m_head.load(std::memory_order_relaxed) - m_tail.load(std::memory_order_relaxed) == nchunks();
     }
 
     bool is_lock_free() const { return m_head.is_lock_free() && m_tail.is_lock_free(); }
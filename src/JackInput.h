@@ -52,13 +52,6 @@ class JackInput
     virtual ~JackInput() { disconnect(); }
 
   public:
-    // Fill buffer.
-    event_type fill_input_buffer(int sequence_number)
-    {
-      // The output buffer of m_connected_output is our input buffer.
-      return m_connected_output->fill_output_buffer(sequence_number);
-    }
-
     // Connect this input to output.
     void connect(JackOutput& output)
     {
@@ -105,6 +98,10 @@ class JackInput
       return 0;
     }
 
+    // Return the buffer that the connected output should write to when we are its only input, or NULL (see api_inplace).
+    virtual jack_default_audio_sample_t* inplace_buffer() const { return NULL; }
+    virtual jack_nframes_t nframes_inplace_buffer() const { return 0; }
+
     virtual event_type memcpy_input(jack_default_audio_sample_t const*)
     {
       ASSERT(false);                            // This function should only be called when has_memcpy_input(type()) is true;
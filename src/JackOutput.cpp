@@ -24,6 +24,11 @@
 #include "JackChunkAllocator.h"
 #include <algorithm>
 
+//static
+unsigned int JackOutput::s_graph_generation;
+//static
+JackOutput* JackOutput::s_allocated_outputs;
+
 void JackOutput::create_allocated_buffer()
 {
   DoutEntering(dc::notice, "JackOutput::create_allocated_buffer() with this = " << (void*)this << " [" << m_name << "].");
@@ -34,8 +39,22 @@ void JackOutput::create_allocated_buffer()
   ASSERT(!m_allocated);
 
   m_chunk = static_cast<jack_default_audio_sample_t*>(JackChunkAllocator::instance().allocate());
+  if (AI_UNLIKELY(!m_chunk))
+  {
+    // Out of chunks; JackSchedule::run will try again at the end of the cycle.
+    Dout(dc::warning, "JackOutput::create_allocated_buffer(): [" << m_name << "] failed to allocate a buffer.");
+    m_chunk_size = 0;
+    m_allocation_failed = true;
+    return;
+  }
   m_chunk_size = JackChunkAllocator::instance().chunk_size();
   m_allocated = true;
+  // Add this output to the front of the list of outputs with an allocated buffer.
+  m_prev_allocated = NULL;
+  m_next_allocated = s_allocated_outputs;
+  if (m_next_allocated)
+    m_next_allocated->m_prev_allocated = this;
+  s_allocated_outputs = this;
 }
 
 void JackOutput::release_allocated_buffer(void)
@@ -45,10 +64,45 @@ void JackOutput::release_allocated_buffer(void)
   if (m_allocated)
   {
     ASSERT(m_chunk);
-    JackChunkAllocator::instance().release(m_chunk);
+    JackChunkAllocator::instance().release(m_chunk, m_chunk_size);
     m_chunk = NULL;
     m_chunk_size = 0;
     m_allocated = false;
+    // Remove this output from the list of outputs with an allocated buffer.
+    if (m_prev_allocated)
+      m_prev_allocated->m_next_allocated = m_next_allocated;
+    else
+      s_allocated_outputs = m_next_allocated;
+    if (m_next_allocated)
+      m_next_allocated->m_prev_allocated = m_prev_allocated;
+    m_prev_allocated = m_next_allocated = NULL;
+  }
+}
+
+void JackOutput::reacquire_allocated_buffer()
+{
+  if (AI_LIKELY(!m_allocated || m_chunk_size == JackChunkAllocator::instance().chunk_size()))
+    return;
+  Dout(dc::notice, "JackOutput::reacquire_allocated_buffer(): [" << m_name << "] still has a buffer of " << m_chunk_size << " frames.");
+  release_allocated_buffer();
+  update_buffer();      // Allocates a new buffer and tells the connected inputs about it.
+}
+
+//static
+void JackOutput::reacquire_allocated_buffers()
+{
+  jack_nframes_t const chunk_size = JackChunkAllocator::instance().chunk_size();
+  JackOutput* output = s_allocated_outputs;
+  while (output)
+  {
+    if (AI_LIKELY(output->m_chunk_size == chunk_size))
+      output = output->m_next_allocated;
+    else
+    {
+      output->reacquire_allocated_buffer();
+      // That changed the list (also buffer_changed() of other outputs might have); start over.
+      output = s_allocated_outputs;
+    }
   }
 }
 
@@ -70,31 +124,13 @@ void JackOutput::connect(JackInput& input)
   // by inserting it after the last element that has the same (or greater) value.
   api_type input_type = input.type() & api_input_any;
   auto pos = std::find_if(m_connected_inputs.begin(), m_connected_inputs.end(), [input_type] (std::pair<JackInput*, api_type> const& p) { return p.second < input_type; });
-  m_connected_inputs.insert(pos, std::make_pair(&input, input_type));
+  m_connected_inputs.insert(pos, std::make_pair(&input, input_type));  // Does not allocate memory.
 
-  // Fix allocation if needed.
-  bool need_allocation = !has_provided_output_buffer(type()) && !has_provided_input_buffer(m_connected_inputs[0].second);
-  if (need_allocation != m_allocated)
-  {
-    if (m_allocated)
-      release_allocated_buffer();
-    else
-      create_allocated_buffer();
-  }
-
-  // Update m_chunk if needed.
-  if (!need_allocation)
-  {
-    if (!has_provided_output_buffer(type())) // else m_chunk and m_chunk_size will be set by fill_output_buffer.
-    {
-      // has_provided_input_buffer(m_connected_inputs[0].second) must be true.
-      m_chunk = m_connected_inputs[0].first->provided_input_buffer();
-      m_chunk_size = m_connected_inputs[0].first->nframes_provided_input_buffer();
-    }
-  }
+  update_buffer();
 
   // Connect the input to this output.
   input.m_connected_output = this;
+  ++s_graph_generation;
 }
 
 void JackOutput::disconnect(JackInput& input)
@@ -107,8 +143,37 @@ void JackOutput::disconnect(JackInput& input)
   ASSERT(pos != m_connected_inputs.end());
   m_connected_inputs.erase(pos);
 
+  update_buffer();
+
+  // Disconnect the input from this output.
+  input.m_connected_output = NULL;
+  ++s_graph_generation;
+}
+
+void JackOutput::update_buffer()
+{
+  if (has_provided_output_buffer(type()))
+    return;     // m_chunk and m_chunk_size will be set by fill_output_buffer.
+
+  // Find a buffer that we can write to directly, if any.
+  jack_default_audio_sample_t* buffer = NULL;
+  jack_nframes_t nframes = 0;
+  if (!m_connected_inputs.empty())
+  {
+    JackInput const* first_input = m_connected_inputs[0].first;
+    if (has_provided_input_buffer(m_connected_inputs[0].second))
+    {
+      buffer = first_input->provided_input_buffer();
+      nframes = first_input->nframes_provided_input_buffer();
+    }
+    else if (m_connected_inputs.size() == 1 && (buffer = first_input->inplace_buffer()))
+      nframes = first_input->nframes_inplace_buffer();
+  }
+
   // Fix allocation if needed.
-  bool need_allocation = !has_provided_output_buffer(type()) && !m_connected_inputs.empty() && !has_provided_input_buffer(m_connected_inputs[0].second);
+  jack_default_audio_sample_t* const prev_chunk = m_chunk;
+  m_allocation_failed = false;
+  bool need_allocation = !m_connected_inputs.empty() && !buffer;
   if (need_allocation != m_allocated)
   {
     if (m_allocated)
@@ -118,19 +183,14 @@ void JackOutput::disconnect(JackInput& input)
   }
 
   // Update m_chunk if needed.
-  if (!need_allocation)
+  if (buffer)
   {
-    if (!has_provided_output_buffer(type()) && // else m_chunk and m_chunk_size will be set by fill_output_buffer.
-        !m_connected_inputs.empty())
-    {
-      // has_provided_input_buffer(m_connected_inputs[0].second)) must be true.
-      m_chunk = m_connected_inputs[0].first->provided_input_buffer();
-      m_chunk_size = m_connected_inputs[0].first->nframes_provided_input_buffer();
-    }
+    m_chunk = buffer;
+    m_chunk_size = nframes;
   }
 
-  // Disconnect the input from this output.
-  input.m_connected_output = NULL;
+  if (m_chunk != prev_chunk)
+    buffer_changed();
 }
 
 void JackOutput::disconnect()
@@ -140,6 +200,7 @@ void JackOutput::disconnect()
     input.first->m_connected_output = NULL;
   m_connected_inputs.clear();
   release_allocated_buffer();
+  ++s_graph_generation;
 }
 
 event_type JackOutput::handle_memcpys()
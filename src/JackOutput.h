@@ -23,26 +23,41 @@
 
 #include "ApiType.h"
 #include "Events.h"
+#include "InlineVector.h"
 #include <jack/jack.h>
 #include <string>
-#include <vector>
 #include <utility>
 #include "debug.h"
 
-// Forward declaration.
+// Forward declarations.
 class JackInput;
+class JackSchedule;
 
 class JackOutput
 {
-    typedef std::vector<std::pair<JackInput*, api_type>> connected_inputs_type; // The type of m_connected_inputs.
+  public:
+    static int const s_max_connected_inputs = 16;       // The maximum number of inputs that can be connected to one output.
+
+  private:
+    typedef InlineVector<std::pair<JackInput*, api_type>, s_max_connected_inputs> connected_inputs_type; // The type of m_connected_inputs.
 
   protected:
     jack_default_audio_sample_t* m_chunk;       // The buffer to use.
     jack_nframes_t m_chunk_size;                // The buffer size, in frames.
     bool m_allocated;                           // Set if m_chunk was allocated (by us).
-    int m_sequence_number;                      // sequence_number of the last call to fill_output_buffer.
+    bool m_allocation_failed;                   // Set if we need an allocated buffer but JackChunkAllocator::allocate() failed; m_chunk is NULL then.
+    JackOutput* m_prev_allocated;               // The previous output in the list of outputs with an allocated buffer (valid when m_allocated is set).
+    JackOutput* m_next_allocated;               // The next output in that list.
     connected_inputs_type m_connected_inputs;   // A list of connected JackInput pointers and their api type.
 
+  private:
+    friend class JackSchedule;
+    event_type m_broken;                        // Set by JackSchedule::run_steps when fill_output_buffer() returned event_bit_broken_pipe this cycle.
+    unsigned int m_schedule_mark;               // Used by JackSchedule::compile to add each output only once.
+    int m_schedule_level;                       // The level of this output in the last compiled JackSchedule.
+    static unsigned int s_graph_generation;     // Incremented every time a connection is made or broken.
+    static JackOutput* s_allocated_outputs;     // The first output that has an allocated buffer, or NULL.
+
 #ifdef CWDEBUG
   public:
     std::string m_name;                         // A human readable string describing this object, used for debug output only.
@@ -52,7 +67,7 @@ class JackOutput
     // Disconnect from all connected inputs (if any).
     void disconnect();
 
-    // Allocate a new buffer.
+    // Allocate a new buffer. Sets m_allocation_failed instead when the pool is exhausted.
     void create_allocated_buffer();
 
     // Release allocated buffer (if any).
@@ -65,14 +80,14 @@ class JackOutput
   protected:
     // Construct a JackOutput that is not connected nor associated with any buffer.
     JackOutput(DEBUG_ONLY(std::string processor_name)) :
-      m_chunk(NULL), m_chunk_size(0), m_allocated(false),
-      m_sequence_number(-1)
+      m_chunk(NULL), m_chunk_size(0), m_allocated(false), m_allocation_failed(false), m_prev_allocated(NULL), m_next_allocated(NULL),
+      m_broken(0), m_schedule_mark(0), m_schedule_level(0)
       COMMA_DEBUG_ONLY(m_name(processor_name + " Output")) { }
 
     // Construct a JackOutput as wrapper around a jack buffer (chunk).
     JackOutput(jack_default_audio_sample_t* chunk, jack_nframes_t nframes COMMA_DEBUG_ONLY(std::string processor_name)) :
-        m_chunk(chunk), m_chunk_size(nframes), m_allocated(false),
-        m_sequence_number(-1)
+        m_chunk(chunk), m_chunk_size(nframes), m_allocated(false), m_allocation_failed(false), m_prev_allocated(NULL), m_next_allocated(NULL),
+        m_broken(0), m_schedule_mark(0), m_schedule_level(0)
         COMMA_DEBUG_ONLY(m_name(processor_name + " Output")) { }
 
     // The destructor makes sure we're not (still) connected, because the JackInputs keep
@@ -83,6 +98,9 @@ class JackOutput
     // Copy generated output to inputs that provide their own buffer, if any.
     event_type handle_memcpys();
 
+    // Called by update_buffer() when m_chunk changed.
+    virtual void buffer_changed() { }
+
   public:
     // Connect an input to this output; does nothing when already connected to this output.
     // First calls disconnect when already connected to another output.
@@ -91,17 +109,50 @@ class JackOutput
     // Disconnect a previously, to this output, connected input.
     void disconnect(JackInput& input);
 
+    // Decide which buffer to use, depending on the connected inputs: the buffer provided by the
+    // first input, the in-place buffer of the only input, or an allocated buffer.
+    // Called by connect() and disconnect(), and by an input when its in-place buffer changed.
+    void update_buffer();
+
+    // Replace an allocated buffer of a previous buffer size by one of the current size.
+    void reacquire_allocated_buffer();
+
+    // Call reacquire_allocated_buffer() for every output that has an allocated buffer, also for those
+    // that are not part of any schedule; otherwise their old size class would never drain.
+    // Called by JackSchedule::compile.
+    static void reacquire_allocated_buffers();
+
+    // True when this output needs an allocated buffer but couldn't get one; JackSchedule then
+    // treats it as a broken pipe and retries the allocation at the end of the cycle.
+    bool allocation_failed() const { return m_allocation_failed; }
+
     // The underlaying buffer to use; used by JackProcessor derived classes to write data to.
     jack_default_audio_sample_t* chunk_ptr() const { return m_chunk; }
 
     // The size of the underlaying buffer.
     jack_nframes_t nframes() const { return m_chunk_size; }
 
+    // The events that fill_output_buffer() returned this cycle, including event_bit_broken_pipe, if that was set; otherwise zero.
+    event_type broken() const { return m_broken; }
+
+    // A number that changes every time a connection is made or broken anywhere.
+    static unsigned int graph_generation() { return s_graph_generation; }
+
   public:
     // Does all the work, so all connected inputs are ready to be read from after this call.
-    // This function should first check if it wasn't called before with sequence_number,
-    // and if it wasn't, generate the output (to m_chunk) and finally call handle_memcpys().
-    virtual event_type fill_output_buffer(int sequence_number) = 0;
+    // This function is called once per cycle by JackSchedule::run_steps, after all outputs that were
+    // added by add_sources_to() did their work; it should generate the output (to m_chunk) and
+    // finally call handle_memcpys(). When the output can't be generated, return event_bit_broken_pipe
+    // together with the events that explain why (for example, the broken() value of a source).
+    virtual event_type fill_output_buffer() = 0;
+
+    // Call schedule.add() for every output that fill_output_buffer() reads from.
+    virtual void add_sources_to(JackSchedule&) { }
+
+    // Called by JackSchedule::run, in the process thread, after all outputs were filled.
+    // fill_output_buffer() can run in parallel with other outputs and may therefore not
+    // change connections; this is where changes that it decided on should be made.
+    virtual void end_of_cycle() { }
 
     virtual api_type type() const
     {
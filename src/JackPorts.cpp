@@ -23,12 +23,12 @@
 #include "JackPorts.h"
 #include "utils/AIAlert.h"
 
-char const* JackPorts::get(unsigned long flags)
+char const* JackPorts::get(unsigned long flags, int index)
 {
   if (m_ports)
   {
     if (flags == m_flags)
-      return m_ports[0];
+      return nth_port(index);
     jack_free(m_ports);
   }
   m_flags = flags;
@@ -48,7 +48,15 @@ char const* JackPorts::get(unsigned long flags)
       error += "monitor ";
     THROW_ALERT(error + "ports.");
   }
-  return m_ports[0];
+  return nth_port(index);
+}
+
+char const* JackPorts::nth_port(int index) const
+{
+  int count = 0;
+  while (m_ports[count])
+    ++count;
+  return m_ports[index % count];
 }
 
 void JackPorts::release()
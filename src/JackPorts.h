@@ -30,11 +30,14 @@ class JackPorts
     unsigned long m_flags;
     jack_client_t* m_client;
 
+    char const* nth_port(int index) const;
+
   public:
     JackPorts(jack_client_t* client) : m_ports(NULL), m_client(client) { }
     ~JackPorts() { release(); }
 
-    char const* get(unsigned long flags);
+    // Return the name of the index-th port with the given flags; wraps around when there are fewer ports.
+    char const* get(unsigned long flags, int index = 0);
     void release();
 };
 
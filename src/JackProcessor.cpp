@@ -20,14 +20,20 @@
 
 #include "sys.h"
 #include "JackProcessor.h"
+#include "JackSchedule.h"
+#include "utils/macros.h"
 
-event_type JackProcessor::fill_output_buffer(int sequence_number)
+event_type JackProcessor::fill_output_buffer()
 {
-  if (m_sequence_number == sequence_number)
-    return 0;
-  m_sequence_number = sequence_number;
-  event_type events = fill_input_buffer(sequence_number);
+  // Our input buffer is the output buffer of m_connected_output, which was already filled.
+  if (AI_UNLIKELY(m_connected_output->broken()))
+    return m_connected_output->broken();
   generate_output();
-  events |= handle_memcpys();
-  return events;
+  return handle_memcpys();
+}
+
+void JackProcessor::add_sources_to(JackSchedule& schedule)
+{
+  if (m_connected_output)
+    schedule.add(*m_connected_output);
 }
@@ -74,12 +74,21 @@ class JackProcessor : public JackInput, public JackOutput
 
     /*virtual*/ api_type type() const
     {
-      // Assume as default that no buffers are provided by the processor.
+      // Assume as default that no buffers are provided by the processor and that it can't work in place.
       return api_input_uses_output_buffer | api_output_uses_allocated_or_input_buffer;
     }
 
+    // JackInput
+    /*virtual*/ jack_default_audio_sample_t* inplace_buffer() const { return has_inplace(type()) ? JackOutput::chunk_ptr() : NULL; }
+    /*virtual*/ jack_nframes_t nframes_inplace_buffer() const { return JackOutput::nframes(); }
+
     // JackOutput
-    /*virtual*/ event_type fill_output_buffer(int sequence_number);
+    /*virtual*/ event_type fill_output_buffer();
+    /*virtual*/ void add_sources_to(JackSchedule& schedule);
+
+  protected:
+    // Let the output that we read from write to our new buffer, if we work in place.
+    /*virtual*/ void buffer_changed() { if (m_connected_output) m_connected_output->update_buffer(); }
 };
 
 #endif // JACK_PROCESSOR_H
@@ -21,42 +21,146 @@
 #include "sys.h"
 
 #include "JackRecorder.h"
+#include "RTMemory.h"
 #include "Events.h"
 #include "utils/macros.h"
+#include <cstring>
+
+JackRecorder::JackRecorder(jack_client_t* client, double period) :
+    DEBUG_ONLY(JackInput("JackRecorder"), JackOutput("JackRecorder"),)
+    m_client(client), m_period(period), m_record_slot(0), m_playback_slot(0), m_loop_begin(0), m_loop_end(0),
+    m_preroll_frames(0), m_pre_rolling(false), m_repeat(false), m_streaming(false), m_disk_reader(NULL), m_disk_channel(0)
+{
+  set_number_of_slots(1);
+  m_chunk_size = m_scratch_frames = m_slots[0]->nframes();
+  m_scratch = Singleton<RTMemory>::instance().allocate_array<jack_default_audio_sample_t>(m_scratch_frames);
+}
+
+JackRecorder::~JackRecorder() noexcept
+{
+  Singleton<RTMemory>::instance().deallocate_array(m_scratch, m_scratch_frames);
+}
+
+void JackRecorder::buffer_size_changed(jack_nframes_t nframes)
+{
+  for (auto& slot : m_slots)
+    slot->buffer_size_changed(nframes);
+  if (m_preroll)
+    m_preroll->buffer_size_changed(nframes);
+  RTMemory& rt_memory(Singleton<RTMemory>::instance());
+  rt_memory.deallocate_array(m_scratch, m_scratch_frames);
+  m_chunk_size = m_scratch_frames = nframes;
+  m_scratch = rt_memory.allocate_array<jack_default_audio_sample_t>(m_scratch_frames);
+}
+
+void JackRecorder::set_preroll(double seconds)
+{
+  DoutEntering(dc::notice, "JackRecorder::set_preroll(" << seconds << ")");
+  // Same size as the slots, so that they can be swapped.
+  m_preroll.reset(new JackFIFOBuffer(m_client, m_period));
+  m_preroll_frames = seconds * jack_get_sample_rate(m_client);
+}
+
+void JackRecorder::take_preroll()
+{
+  if (!m_preroll)
+  {
+    clear();
+    return;
+  }
+  // The pre-roll ring becomes the slot, and the previous contents of the slot are dropped.
+  m_slots[m_record_slot].swap(m_preroll);
+  jack_nframes_t const nframes = m_slots[m_record_slot]->nframes();
+  m_slots[m_record_slot]->keep_last((m_preroll_frames + nframes - 1) / nframes);
+  m_preroll->clear();
+  m_pre_rolling = false;
+}
 
 event_type JackRecorder::memcpy_input(jack_default_audio_sample_t const* chunk)
 {
-  return m_recording_buffer.push(chunk) ? 0 : event_bit_stop_recording;
+  if (AI_UNLIKELY(m_pre_rolling))
+  {
+    // Forget the oldest chunk when the ring is full; the real-time thread is both producer and consumer here.
+    if (m_preroll->full())
+      m_preroll->pop();
+    m_preroll->push(chunk);
+    return 0;
+  }
+  return m_slots[m_record_slot]->push(chunk) ? 0 : event_bit_stop_recording;
 }
 
 event_type JackRecorder::zero_input()
 {
-  return m_recording_buffer.push_zero() ? 0 : event_bit_stop_recording;
+  if (AI_UNLIKELY(m_pre_rolling))
+  {
+    if (m_preroll->full())
+      m_preroll->pop();
+    m_preroll->push_zero();
+    return 0;
+  }
+  return m_slots[m_record_slot]->push_zero() ? 0 : event_bit_stop_recording;
 }
 
-event_type JackRecorder::fill_output_buffer(int sequence_number)
+event_type JackRecorder::fill_output_buffer()
 {
-  if (m_output_sequence_number == sequence_number)
-    return 0;
-  m_sequence_number = sequence_number;
   // api_output_provided_buffer requires we set m_chunk and m_chunk_size in fill_output_buffer.
-  while (true)  // So we can use break and continue.
+  if (m_disk_reader)
   {
-    m_chunk = m_recording_buffer.read();
+    m_chunk = m_disk_reader->read(m_disk_channel);
     if (AI_UNLIKELY(!m_chunk))
     {
-      Dout(dc::notice, "JackRecorder::fill_output_buffer(" << sequence_number << "): at end of recording buffer.");
-      // We reached the end. Reset the read pointer to the beginning of the buffer.
-      reset_readptr();
-      if (!m_repeat || m_recording_buffer.empty())
-      {
-        throw BrokenPipe(event_bit_stop_playback);
-      }
-      // We get here at most once because after reset_readptr() either read() will succeed or m_recording_buffer.empty() will return true.
-      continue; // Try again.
+      Dout(dc::notice, "JackRecorder::fill_output_buffer(): at end of file.");
+      return event_bit_broken_pipe | event_bit_stop_playback;
     }
-    m_chunk_size = m_recording_buffer.nframes();
-    break;      // Done.
+    m_chunk_size = m_disk_reader->nframes();
+    return handle_memcpys();
+  }
+  if (AI_UNLIKELY(m_streaming))
+    return event_bit_broken_pipe | event_bit_stop_playback;     // The recording is on disk.
+  JackFIFOBuffer& slot(*m_slots[m_playback_slot]);
+  jack_nframes_t const nframes = slot.nframes();
+  bool const loop = looping();
+  size_t const limit = loop ? m_loop_end : SIZE_MAX;
+  m_chunk_size = nframes;
+  JackFIFOBuffer::FrameSpan span = slot.read_frames(nframes, limit);
+  if (AI_LIKELY(span.nframes == nframes))
+  {
+    m_chunk = span.data;
+    return handle_memcpys();
+  }
+
+  // Put the chunk together from the pieces before and after the end of the ring buffer, loop region or recording.
+  jack_nframes_t filled = 0;
+  bool rewound = false;
+  while (true)
+  {
+    if (span.nframes)
+    {
+      std::memcpy(m_scratch + filled, span.data, span.nframes * sizeof(jack_default_audio_sample_t));
+      filled += span.nframes;
+      if (filled == nframes)
+        break;
+      rewound = false;
+    }
+    else
+    {
+      // At the end of the loop region or the recording.
+      if (rewound || !(loop || m_repeat))
+        break;
+      slot.seek(loop ? m_loop_begin : 0);
+      rewound = true;
+    }
+    span = slot.read_frames(nframes - filled, limit);
+  }
+  if (AI_UNLIKELY(filled == 0))
+  {
+    Dout(dc::notice, "JackRecorder::fill_output_buffer(): at end of slot " << m_playback_slot << ".");
+    // Start from the beginning next time.
+    reset_readptr();
+    return event_bit_broken_pipe | event_bit_stop_playback;
   }
+  // The last frames of the recording are followed by silence; the next cycle stops.
+  std::memset(m_scratch + filled, 0, (nframes - filled) * sizeof(jack_default_audio_sample_t));
+  m_chunk = m_scratch;
   return handle_memcpys();
 }
@@ -24,25 +24,79 @@
 #include "JackInput.h"
 #include "JackOutput.h"
 #include "JackFIFOBuffer.h"
+#include "JackDiskReader.h"
+#include <memory>
+#include <vector>
 
+// Records into, and plays back from, one of a number of recording slots.
+//
+// Every slot is a JackFIFOBuffer of the same duration; they are all allocated up front
+// (from RTMemory), so that switching the slot that is recorded into or played back
+// is just a change of index, and one slot can be played back while another is recorded.
+//
+// Playback starts at any frame (seek()) and can loop a region of the recording (set_loop()).
+// As long as the frames of a cycle are contiguous in the slot they are played back straight
+// from the slot; only when the end of the ring buffer, the loop region or the recording falls
+// inside a cycle, the two pieces are copied after each other into m_scratch.
+//
+// With a pre-roll (set_preroll()) the recorder is also fed while nothing is recorded: the chunks
+// then go into a ring of the same size as a slot, that always holds the most recent audio.
+// When a take starts, take_preroll() swaps that ring with the slot that is recorded into,
+// so that the take begins with the last seconds before record was pressed without copying them.
 class JackRecorder : public JackInput, public JackOutput
 {
   private:
-    JackFIFOBuffer m_recording_buffer;
-    int m_input_sequence_number;              // sequence_number of the last call to fill_input_buffer.
-    int m_output_sequence_number;             // sequence_number of the last call to fill_output_buffer.
+    jack_client_t* m_client;
+    double m_period;
+    std::vector<std::unique_ptr<JackFIFOBuffer>> m_slots;      // The recording slots (at least one).
+    int m_record_slot;          // The index of the slot that the input is recorded into.
+    int m_playback_slot;        // The index of the slot that is played back.
+    size_t m_loop_begin;        // The first frame of the loop region (counted from the start of the recording).
+    size_t m_loop_end;          // One past the last frame of the loop region; there is no loop region when this isn't larger than m_loop_begin.
+    jack_default_audio_sample_t* m_scratch;     // Room for one chunk, used when a chunk has to be put together from two pieces.
+    jack_nframes_t m_scratch_frames;            // The size of m_scratch.
+    std::unique_ptr<JackFIFOBuffer> m_preroll;  // The pre-roll ring, or NULL when there is no pre-roll.
+    size_t m_preroll_frames;                    // The number of frames of the pre-roll that a take starts with.
+    bool m_pre_rolling;                         // Set when the input goes into m_preroll.
     bool m_repeat;
+    bool m_streaming;           // Set when a JackDiskWriter empties the first slot.
+    JackDiskReader* m_disk_reader;      // If non-NULL, play back channel m_disk_channel of this file instead of a slot.
+    int m_disk_channel;
 
   public:
-    JackRecorder(jack_client_t* client, double period) :
-        DEBUG_ONLY(JackInput("JackRecorder"), JackOutput("JackRecorder"),)
-        m_recording_buffer(client, period), m_input_sequence_number(-1), m_repeat(false) { }
-    ~JackRecorder() noexcept { }
+    JackRecorder(jack_client_t* client, double period);
+    ~JackRecorder() noexcept;
 
-    void buffer_size_changed(jack_nframes_t nframes)
+    void buffer_size_changed(jack_nframes_t nframes);
+
+    // Allocate slots until there are number_of_slots. Must be called before the client is activated.
+    void set_number_of_slots(int number_of_slots)
+    {
+      while ((int)m_slots.size() < number_of_slots)
+        m_slots.emplace_back(new JackFIFOBuffer(m_client, m_period));
+    }
+
+    // Keep the last seconds of the input in a pre-roll ring while not recording. Must be called before the client is activated.
+    void set_preroll(double seconds);
+
+    // Feed the input to the pre-roll ring (if any) instead of the slot that is recorded into. Real-time thread.
+    void set_pre_rolling(bool pre_rolling)
     {
-      m_recording_buffer.buffer_size_changed(nframes);
-      m_chunk_size = nframes;
+      m_pre_rolling = pre_rolling && m_preroll;
+    }
+
+    // Start a take in the slot that is recorded into with the pre-roll, instead of with an empty slot. Real-time thread.
+    void take_preroll();
+
+    // Record into slot record_slot and play back slot playback_slot from now on.
+    // A slot that doesn't exist is ignored. Real-time thread.
+    void select_slots(int record_slot, int playback_slot)
+    {
+      // While streaming the first slot belongs to the disk writer.
+      if (record_slot < (int)m_slots.size() && !m_streaming)
+        m_record_slot = record_slot;
+      if (playback_slot < (int)m_slots.size())
+        m_playback_slot = playback_slot;
     }
 
     void set_repeat(bool repeat)
@@ -50,16 +104,58 @@ class JackRecorder : public JackInput, public JackOutput
       m_repeat = repeat;
     }
 
+    // When streaming, the recording buffer is emptied by a JackDiskWriter (the consumer);
+    // then there is nothing to play back, and clear() and reset_readptr() may not be called.
+    void set_streaming(bool streaming)
+    {
+      m_streaming = streaming;
+    }
+
+    // Play back channel of disk_reader.
+    void play_from_disk(JackDiskReader* disk_reader, int channel)
+    {
+      m_disk_reader = disk_reader;
+      m_disk_channel = channel;
+    }
+
+    JackFIFOBuffer& recording_buffer(int slot = 0)
+    {
+      return *m_slots[slot];
+    }
+
+    int number_of_slots() const
+    {
+      return m_slots.size();
+    }
+
+    // Clear the slot that is recorded into.
     void clear()
     {
-      m_recording_buffer.clear();
-      m_input_sequence_number = m_output_sequence_number = -1;
+      m_slots[m_record_slot]->clear();
     }
 
+    // Play the slot that is played back from the start (of the loop region, if any).
     void reset_readptr()
     {
-      m_recording_buffer.reset_readptr();
-      m_input_sequence_number = m_output_sequence_number = -1;
+      m_slots[m_playback_slot]->seek(looping() ? m_loop_begin : 0);
+    }
+
+    // Continue playback of the slot that is played back at frame (counted from the start of the recording).
+    void seek(size_t frame)
+    {
+      m_slots[m_playback_slot]->seek(frame);
+    }
+
+    // Play frames [begin, end) over and over, or stop looping when end isn't larger than begin.
+    void set_loop(size_t begin, size_t end)
+    {
+      m_loop_begin = begin;
+      m_loop_end = end;
+    }
+
+    bool looping() const
+    {
+      return m_loop_begin < m_loop_end;
     }
 
   public:
@@ -71,7 +167,8 @@ class JackRecorder : public JackInput, public JackOutput
     /*virtual*/ event_type zero_input();
 
     // JackOutput
-    /*virtual*/ event_type fill_output_buffer(int sequence_number);
+    // The output is read from the recording buffer, so it doesn't depend on any other output (no add_sources_to).
+    /*virtual*/ event_type fill_output_buffer();
 };
 
 #endif // JACK_RECORDER_H
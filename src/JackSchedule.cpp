@@ -0,0 +1,188 @@
+/**
+ * /file JackSchedule.cpp
+ * /brief Implementation of class JackSchedule.
+ *
+ * Copyright (C) 2016 Aleric Inglewood.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published
+ * by the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "sys.h"
+
+#include "JackSchedule.h"
+#include "JackInput.h"
+#include "JackWorkerPool.h"
+#include "utils/macros.h"
+#include <algorithm>
+#include <sched.h>
+
+//static
+unsigned int JackSchedule::s_compilation;
+
+void JackSchedule::add_sink(JackInput& sink)
+{
+  ASSERT(m_number_of_sinks < s_max_sinks);
+  m_sinks[m_number_of_sinks++] = &sink;
+  m_compiled = false;
+}
+
+namespace {
+
+// Tell the CPU that we are spinning.
+inline void cpu_relax()
+{
+#if defined(__i386__) || defined(__x86_64__)
+  __builtin_ia32_pause();
+#endif
+}
+
+} // namespace
+
+void JackSchedule::wait_until_done(int count)
+{
+  // Steps are short, so spin first. But the thread that we wait for has the same SCHED_FIFO
+  // priority as we have, so if it was preempted on our CPU it only runs again when we yield.
+  for (int spins = 0; m_done.load(std::memory_order_acquire) < count; ++spins)
+  {
+    if (spins < s_max_spins)
+      cpu_relax();
+    else
+      sched_yield();
+  }
+}
+
+void JackSchedule::compile()
+{
+  // Zero is the initial value of JackOutput::m_schedule_mark.
+  if (++s_compilation == 0)
+    ++s_compilation;
+  m_number_of_steps = 0;
+  for (int i = 0; i < m_number_of_sinks; ++i)
+  {
+    JackOutput* source = m_sinks[i]->connected_output();
+    m_source_level = -1;
+    if (source)
+      add(*source);
+  }
+
+  // Sort the steps by level (counting sort, keeping the order within each level).
+  int count[s_max_steps + 1];
+  std::fill(count, count + m_number_of_steps + 1, 0);
+  for (int i = 0; i < m_number_of_steps; ++i)
+    ++count[m_steps[i]->m_schedule_level + 1];
+  m_max_width = 0;
+  for (int level = 0; level < m_number_of_steps; ++level)
+  {
+    m_max_width = std::max(m_max_width, count[level + 1]);
+    count[level + 1] += count[level];           // count[level] is now the index of the first step of level.
+  }
+  JackOutput* unsorted[s_max_steps];
+  std::copy(m_steps, m_steps + m_number_of_steps, unsorted);
+  for (int i = 0; i < m_number_of_steps; ++i)
+  {
+    int const level = unsorted[i]->m_schedule_level;
+    m_steps[count[level]++] = unsorted[i];
+  }
+  // Outputs that still use a buffer of a previous buffer size get a new one; also the outputs that aren't scheduled.
+  JackOutput::reacquire_allocated_buffers();
+
+  for (int i = 0; i < m_number_of_steps; ++i)
+    m_level_begin[i] = (i > 0 && m_steps[i - 1]->m_schedule_level == m_steps[i]->m_schedule_level) ? m_level_begin[i - 1] : i;
+
+  m_generation = JackOutput::graph_generation();
+  m_compiled = true;
+}
+
+void JackSchedule::add(JackOutput& output)
+{
+  if (output.m_schedule_mark != s_compilation)
+  {
+    output.m_schedule_mark = s_compilation;
+    output.m_schedule_level = 0;                // In case of a loop in the graph.
+    // Depth first: everything that output reads from goes before it.
+    int const source_level = m_source_level;
+    m_source_level = -1;
+    output.add_sources_to(*this);
+    output.m_schedule_level = m_source_level + 1;
+    m_source_level = source_level;
+    ASSERT(m_number_of_steps < s_max_steps);
+    m_steps[m_number_of_steps++] = &output;
+  }
+  // Keep track of the highest level of the sources of the output that is calling us.
+  m_source_level = std::max(m_source_level, output.m_schedule_level);
+}
+
+event_type JackSchedule::run()
+{
+  m_events.store(0, std::memory_order_relaxed);
+  m_done.store(0, std::memory_order_relaxed);
+  m_next_step.store(0, std::memory_order_release);
+  // Only wake up the workers when there is something to do in parallel, and no more than can be busy at the same time
+  // (the process thread itself takes steps too).
+  if (m_worker_pool && m_max_width > 1)
+    m_worker_pool->wake(*this, m_max_width - 1);
+  run_steps();
+  // Wait until the workers finished the steps that they took.
+  wait_until_done(m_number_of_steps);
+  m_next_step.store(s_idle, std::memory_order_relaxed);
+  event_type events = m_events.load(std::memory_order_relaxed);
+
+  // With the current position of the switches we cannot create the necessary output?
+  for (int i = 0; i < m_number_of_sinks; ++i)
+  {
+    JackOutput* source = m_sinks[i]->connected_output();
+    if (source && AI_UNLIKELY(source->broken()))
+      events |= event_bit_try_again | (source->broken() & ~event_bit_broken_pipe);
+  }
+
+  // Now that no other thread is using the graph, it may be changed.
+  for (int i = 0; i < m_number_of_steps; ++i)
+  {
+    // Retry outputs that couldn't get a buffer; the refill thread might have caught up by now.
+    if (AI_UNLIKELY(m_steps[i]->allocation_failed()))
+      m_steps[i]->update_buffer();
+    m_steps[i]->end_of_cycle();
+  }
+
+  return events;
+}
+
+void JackSchedule::run_steps()
+{
+  while (true)
+  {
+    int const step = m_next_step.fetch_add(1, std::memory_order_acquire);
+    // Steps are only taken between the two stores to m_next_step in run(), so we don't read m_number_of_steps while compile() writes it.
+    if (step >= s_max_steps || step >= m_number_of_steps)
+      break;
+    // Wait until all outputs that this one could depend on are filled.
+    int const level_begin = m_level_begin[step];
+    wait_until_done(level_begin);
+    JackOutput* output = m_steps[step];
+    // An output without a buffer can't be filled.
+    event_type const events = AI_UNLIKELY(output->allocation_failed()) ? event_bit_broken_pipe : output->fill_output_buffer();
+    if (AI_UNLIKELY(events & event_bit_broken_pipe))
+    {
+      // Outputs that read from this one will see this and either deal with it, or return it too.
+      Dout(dc::notice, "JackSchedule::run_steps: broken pipe for output \"" << output->m_name << "\".");
+      output->m_broken = events;
+    }
+    else
+    {
+      output->m_broken = 0;
+      m_events.fetch_or(events, std::memory_order_relaxed);
+    }
+    m_done.fetch_add(1, std::memory_order_release);
+  }
+}
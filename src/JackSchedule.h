@@ -0,0 +1,113 @@
+/**
+ * \file JackSchedule.h
+ * \brief Declaration of JackSchedule.
+ *
+ * Copyright (C) 2016 Aleric Inglewood.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published
+ * by the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef JACK_SCHEDULE_H
+#define JACK_SCHEDULE_H
+
+#include "JackOutput.h"
+#include <atomic>
+
+class JackWorkerPool;
+
+// A flat, topologically sorted list of the outputs that must be filled every cycle.
+//
+// compile() walks the graph from the sinks (the inputs that we need data for)
+// towards the sources, using JackOutput::add_sources_to(), and appends every
+// output after all the outputs that it reads from. run() then simply calls
+// fill_output_buffer() on each of them, in order.
+//
+// Connections change while processing (a finished crossfade reconnects its
+// switch), therefore the schedule remembers JackOutput::graph_generation()
+// at the moment it was compiled; is_outdated() returns true after any change.
+// Compiling doesn't allocate memory, so it can be done in the real-time thread.
+//
+// The steps are sorted by level: an output that has no sources has level 0,
+// any other output has a level one higher than its highest source. Outputs of
+// the same level don't depend on each other, so when a JackWorkerPool is set,
+// its threads take steps in parallel with the process thread. Every thread
+// takes the next step from a shared atomic index, and waits until all steps
+// of the lower levels are done before running it. Waiting spins for a while
+// and then yields the CPU, so that a preempted worker can't starve the process thread.
+//
+// Steps may not change connections while running; that is what
+// JackOutput::end_of_cycle is for, which is called afterwards by the process thread.
+class JackSchedule
+{
+  public:
+    static int const s_max_steps = 256;         // The maximum number of outputs in the graph.
+    static int const s_max_sinks = 64;          // The maximum number of sinks.
+
+  private:
+    JackOutput* m_steps[s_max_steps];           // The outputs to fill, in order.
+    int m_level_begin[s_max_steps];             // The index of the first step with the same level as the step with this index.
+    int m_number_of_steps;
+    int m_max_width;                            // The largest number of steps that have the same level.
+    int m_source_level;                         // The highest level of the sources added so far by add_sources_to(); used by add().
+    JackInput* m_sinks[s_max_sinks];            // The inputs that we need data for.
+    int m_number_of_sinks;
+    unsigned int m_generation;                  // The value of JackOutput::graph_generation() when we were compiled.
+    bool m_compiled;
+
+    JackWorkerPool* m_worker_pool;              // Threads to help with running the steps, or NULL.
+    std::atomic<int> m_next_step;               // The index of the next step to run.
+    std::atomic<int> m_done;                    // The number of steps that finished.
+    std::atomic<event_type> m_events;           // The events returned by all steps.
+
+    static int const s_idle = 0x40000000;       // The value of m_next_step when not running; larger than any step index.
+    static int const s_max_spins = 1000;        // The number of times to spin while waiting for other threads, before yielding the CPU.
+
+    static unsigned int s_compilation;          // Incremented by every call to compile(); used to mark outputs.
+
+  public:
+    JackSchedule() : m_number_of_steps(0), m_max_width(0), m_source_level(-1), m_number_of_sinks(0), m_generation(0), m_compiled(false),
+                     m_worker_pool(NULL), m_next_step(s_idle), m_done(0), m_events(0) { }
+
+    // Use the threads of worker_pool to run steps in parallel (NULL to run everything in the calling thread).
+    void set_worker_pool(JackWorkerPool* worker_pool) { m_worker_pool = worker_pool; }
+
+    // Build the list of sinks; call compile() afterwards.
+    void clear_sinks() { m_number_of_sinks = 0; m_compiled = false; }
+    void add_sink(JackInput& sink);
+
+    // Force a call to compile(), for example because the buffer size changed.
+    void invalidate() { m_compiled = false; }
+
+    // Return true when compile() needs to be called.
+    bool is_outdated() const { return !m_compiled || m_generation != JackOutput::graph_generation(); }
+
+    // Build the list of steps from the sinks.
+    void compile();
+
+    // Add output, after all of its sources, unless it was already added. Called by compile() and JackOutput::add_sources_to().
+    void add(JackOutput& output);
+
+    // Fill all outputs, in order. Returns the events of all outputs. If a sink could
+    // not be filled then event_bit_try_again and the events of its broken source are set.
+    event_type run();
+
+    // Take steps and run them until none are left. Called by run() and by the threads of the worker pool.
+    void run_steps();
+
+  private:
+    // Wait until count steps are done.
+    void wait_until_done(int count);
+};
+
+#endif // JACK_SCHEDULE_H
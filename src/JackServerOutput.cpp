@@ -21,11 +21,8 @@
 #include "sys.h"
 #include "JackServerOutput.h"
 
-event_type JackServerOutput::fill_output_buffer(int sequence_number)
+event_type JackServerOutput::fill_output_buffer()
 {
-  if (m_sequence_number == sequence_number)
-    return 0;
-  m_sequence_number = sequence_number;
   // api_output_provided_buffer requires we set m_chunk and m_chunk_size in fill_output_buffer(),
   // but those are already set by the call to initialize() when we get here.
   return handle_memcpys();
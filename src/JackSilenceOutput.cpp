@@ -22,6 +22,7 @@
 #include "JackSilenceOutput.h"
 #include "JackChunkAllocator.h"
 #include "JackInput.h"
+#include <cstring>
 
 JackSilenceOutput::JackSilenceOutput() : JackOutput(DEBUG_ONLY("Silence"))
 {
@@ -33,23 +34,23 @@ JackSilenceOutput::JackSilenceOutput() : JackOutput(DEBUG_ONLY("Silence"))
 JackSilenceOutput::~JackSilenceOutput()
 {
   if (m_chunk)
-    JackChunkAllocator::instance().release(m_chunk);
+    JackChunkAllocator::instance().release(m_chunk, m_chunk_size);
 }
 
 void JackSilenceOutput::buffer_size_changed(jack_nframes_t nframes)
 {
-  // m_empty_chunk was already invalidated by calling JackChunkAllocator::buffer_size_changed.
   ASSERT(JackChunkAllocator::instance().chunk_size() == nframes);
+  // Return the chunk of the previous buffer size.
+  if (m_chunk)
+    JackChunkAllocator::instance().release(m_chunk, m_chunk_size);
   m_chunk = static_cast<jack_default_audio_sample_t*>(JackChunkAllocator::instance().allocate());
+  ASSERT(m_chunk);      // The initial block of the new size was just allocated.
   m_chunk_size = nframes;
+  std::memset(m_chunk, 0, nframes * sizeof(jack_default_audio_sample_t));
 }
 
-event_type JackSilenceOutput::fill_output_buffer(int sequence_number)
+event_type JackSilenceOutput::fill_output_buffer()
 {
-  if (m_sequence_number == sequence_number)
-    return 0;
-  m_sequence_number = sequence_number;
-
   // api_output_provided_buffer requires we set m_chunk and m_chunk_size in fill_output_buffer(),
   // but those already set by the call to buffer_size_changed() when we get here.
 
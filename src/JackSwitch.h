@@ -51,8 +51,8 @@ class JackSwitch
     JackInput& m_input;                         // A reference to the input that must be switched.
     CrossfadeProcessor m_crossfade_processor;   // The input of the crossfade processor is NOT connected/used!
                                                 // The new output source (fade-in) as well as the previous output
-                                                // source(s) (fade-out) are connected to JackInput member variables
-                                                // in the array CrossfadeProcessor::m_sources.
+                                                // source(s) (fade-out) are connected to CrossfadeInput objects
+                                                // from the pool CrossfadeProcessor::m_pool.
 
   public:
     JackSwitch(JackInput& input) : m_input(input), m_crossfade_processor(*this) { }
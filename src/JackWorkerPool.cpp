@@ -0,0 +1,95 @@
+/**
+ * /file JackWorkerPool.cpp
+ * /brief Implementation of class JackWorkerPool.
+ *
+ * Copyright (C) 2016 Aleric Inglewood.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published
+ * by the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "sys.h"
+
+#include "JackWorkerPool.h"
+#include "JackSchedule.h"
+#include "NoAllocationScope.h"
+#include "utils/macros.h"
+#include "debug.h"
+#include <algorithm>
+#include <cerrno>
+#include <pthread.h>
+
+JackWorkerPool::JackWorkerPool(jack_client_t* client, int number_of_workers) :
+    m_client(client), m_schedule(NULL), m_terminate(false)
+{
+  DoutEntering(dc::notice, "JackWorkerPool::JackWorkerPool(" << client << ", " << number_of_workers << ")");
+  sem_init(&m_wakeup, 0, 0);
+  number_of_workers = std::min(number_of_workers, s_max_workers);
+  int const priority = jack_client_real_time_priority(m_client);
+  int const realtime = jack_is_realtime(m_client);
+  for (int i = 0; i < number_of_workers; ++i)
+  {
+    jack_native_thread_t thread;
+    int error = jack_client_create_thread(m_client, &thread, priority, realtime, &JackWorkerPool::worker_cb, this);
+    if (error)
+    {
+      // Without real-time privileges we can't help the process thread: it would have to wait for us.
+      Dout(dc::warning, "Failed to create worker thread (" << error << "); using " << i << " worker threads.");
+      break;
+    }
+    m_threads.push_back(thread);
+  }
+}
+
+JackWorkerPool::~JackWorkerPool()
+{
+  m_terminate.store(true, std::memory_order_relaxed);
+  for (size_t i = 0; i < m_threads.size(); ++i)
+    sem_post(&m_wakeup);
+  for (jack_native_thread_t thread : m_threads)
+    pthread_join(thread, NULL);
+  sem_destroy(&m_wakeup);
+}
+
+void JackWorkerPool::wake(JackSchedule& schedule, int count)
+{
+  m_schedule.store(&schedule, std::memory_order_release);
+  for (int i = std::min(count, (int)m_threads.size()); i > 0; --i)
+    sem_post(&m_wakeup);
+}
+
+//static
+void* JackWorkerPool::worker_cb(void* self)
+{
+  Debug(debug::init_thread());
+  static_cast<JackWorkerPool*>(self)->worker();
+  return NULL;
+}
+
+void JackWorkerPool::worker()
+{
+  // Just like the process thread, the workers may never use the heap.
+  NoAllocationScope no_allocation;
+  while (true)
+  {
+    if (sem_wait(&m_wakeup) == -1)
+    {
+      ASSERT(errno == EINTR);
+      continue;
+    }
+    if (AI_UNLIKELY(m_terminate.load(std::memory_order_relaxed)))
+      break;
+    // If we woke up late, then the steps of this cycle are already taken and run_steps() returns immediately.
+    m_schedule.load(std::memory_order_acquire)->run_steps();
+  }
+}
@@ -0,0 +1,71 @@
+/**
+ * \file JackWorkerPool.h
+ * \brief Declaration of JackWorkerPool.
+ *
+ * Copyright (C) 2016 Aleric Inglewood.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published
+ * by the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef JACK_WORKER_POOL_H
+#define JACK_WORKER_POOL_H
+
+#include <jack/jack.h>
+#include <jack/thread.h>
+#include <semaphore.h>
+#include <atomic>
+#include <vector>
+
+class JackSchedule;
+
+// Threads that help the JACK process thread to run a JackSchedule.
+//
+// The threads are created once, by JACK, with the same real-time priority
+// as the process thread (SCHED_FIFO when JACK runs real-time). They sleep on
+// a semaphore until wake() is called from the process thread, then take
+// steps from the schedule until none are left, and go back to sleep.
+// wake() only posts a semaphore, so it is safe to call in the real-time thread.
+class JackWorkerPool
+{
+  public:
+    static int const s_max_workers = 16;
+
+  private:
+    jack_client_t* m_client;
+    std::vector<jack_native_thread_t> m_threads;
+    sem_t m_wakeup;                             // Posted once per worker by wake().
+    std::atomic<JackSchedule*> m_schedule;      // The schedule to help with.
+    std::atomic<bool> m_terminate;              // Set by the destructor.
+
+  public:
+    // Create number_of_workers threads (at most s_max_workers) for client.
+    JackWorkerPool(jack_client_t* client, int number_of_workers);
+    ~JackWorkerPool();
+
+    // Let (at most) count workers help with running schedule. Called from the process thread.
+    void wake(JackSchedule& schedule, int count);
+
+    // Accessor.
+    int number_of_workers() const { return m_threads.size(); }
+
+  private:
+    static void* worker_cb(void* self);
+    void worker();
+
+    // Disallow copying.
+    JackWorkerPool(JackWorkerPool const&);
+    JackWorkerPool& operator=(JackWorkerPool const&);
+};
+
+#endif // JACK_WORKER_POOL_H
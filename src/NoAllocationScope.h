@@ -0,0 +1,53 @@
+/**
+ * \file NoAllocationScope.h
+ * \brief Declaration of NoAllocationScope.
+ *
+ * Copyright (C) 2016 Aleric Inglewood.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published
+ * by the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef NO_ALLOCATION_SCOPE_H
+#define NO_ALLOCATION_SCOPE_H
+
+#include "debug.h"
+
+// Marks the current thread as one that may not use the heap, for as long as the object exists.
+//
+// Create one at the top of everything that runs in the real-time threads. Functions that
+// allocate memory call NoAllocationScope::check(), which asserts (in debug mode) that they
+// are not called inside such a scope. In non-debug mode this class does nothing.
+class NoAllocationScope
+{
+#ifdef CWDEBUG
+  private:
+    static int& depth() { static thread_local int s_depth; return s_depth; }
+
+  public:
+    NoAllocationScope() { ++depth(); }
+    ~NoAllocationScope() { --depth(); }
+
+    static bool active() { return depth() > 0; }
+#else
+  public:
+    NoAllocationScope() { }
+
+    static bool active() { return false; }
+#endif
+
+    // Call this before allocating memory.
+    static void check() { ASSERT(!active()); }
+};
+
+#endif // NO_ALLOCATION_SCOPE_H
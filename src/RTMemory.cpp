@@ -0,0 +1,146 @@
+/**
+ * /file RTMemory.cpp
+ * /brief Implementation of class RTMemory.
+ *
+ * Copyright (C) 2016 Aleric Inglewood.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published
+ * by the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "sys.h"
+
+#include "RTMemory.h"
+#include "debug.h"
+#include "utils/AIAlert.h"
+#include <sys/mman.h>
+#include <sys/resource.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <cerrno>
+#include <new>
+#include <string>
+
+RTMemory::RTMemory() : m_page_size(sysconf(_SC_PAGESIZE)), m_allocated(0), m_lock_failures(0), m_budget(0)
+{
+}
+
+size_t RTMemory::mapping_size(size_t size, bool huge_pages) const
+{
+  size_t const granularity = huge_pages ? s_huge_page_size : m_page_size;
+  return (size + granularity - 1) / granularity * granularity;
+}
+
+void* RTMemory::allocate(size_t size, bool huge_pages)
+{
+  size_t const length = mapping_size(size, huge_pages);
+  void* ptr = MAP_FAILED;
+#ifdef MAP_HUGETLB
+  if (huge_pages)
+    ptr = mmap(NULL, length, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+#endif
+  if (ptr == MAP_FAILED)
+  {
+    ptr = mmap(NULL, length, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (ptr == MAP_FAILED)
+      throw std::bad_alloc();
+#ifdef MADV_HUGEPAGE
+    if (huge_pages)
+      madvise(ptr, length, MADV_HUGEPAGE);      // Transparent huge pages; failure is harmless.
+#endif
+  }
+
+  m_allocated += length;
+  if (mlock(ptr, length) == -1)
+  {
+    ++m_lock_failures;
+    Dout(dc::warning, "RTMemory: failed to lock " << length << " bytes.");
+  }
+
+  // Prefault: write to every page, so that it is really there (even if we couldn't lock it).
+  for (size_t offset = 0; offset < length; offset += m_page_size)
+    static_cast<volatile char*>(ptr)[offset] = 0;
+
+  return ptr;
+}
+
+void RTMemory::deallocate(void* ptr, size_t size, bool huge_pages)
+{
+  if (!ptr)
+    return;
+  size_t const length = mapping_size(size, huge_pages);
+  munlock(ptr, length);
+  munmap(ptr, length);
+  m_allocated -= length;
+}
+
+void* RTMemory::map_file(std::string const& path, size_t size)
+{
+  DoutEntering(dc::notice, "RTMemory::map_file(\"" << path << "\", " << size << ")");
+  size_t const length = mapping_size(size, false);
+  int fd = open(path.c_str(), O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+  if (fd == -1)
+    THROW_ALERTC(errno, "Cannot open \"[PATH]\"", AIArgs("[PATH]", path));
+  // Allocate the disk blocks now, so that a page fault never has to (and so that we find out about a full disk now).
+  int err = ftruncate(fd, size) == -1 ? errno : posix_fallocate(fd, 0, size);
+  void* ptr = err ? MAP_FAILED : mmap(NULL, length, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, 0);
+  if (!err && ptr == MAP_FAILED)
+    err = errno;
+  close(fd);                    // The mapping keeps the file open.
+  if (err)
+    THROW_ALERTC(err, "Cannot map \"[PATH]\"", AIArgs("[PATH]", path));
+
+  m_allocated += length;
+  if (mlock(ptr, length) == -1)
+  {
+    ++m_lock_failures;
+    Dout(dc::warning, "RTMemory: failed to lock " << length << " bytes.");
+  }
+
+  // Prefault: make every page dirty (without changing it), so that the first write doesn't fault either.
+  // After the kernel wrote a page back, the next write to it is a (minor) fault again.
+  for (size_t offset = 0; offset < length; offset += m_page_size)
+  {
+    volatile char* page = static_cast<volatile char*>(ptr) + offset;
+    *page = *page;
+  }
+
+  return ptr;
+}
+
+void RTMemory::unmap_file(void* ptr, size_t size)
+{
+  if (!ptr)
+    return;
+  size_t const length = mapping_size(size, false);
+  munlock(ptr, length);
+  munmap(ptr, length);
+  m_allocated -= length;
+}
+
+void RTMemory::reserve(size_t budget)
+{
+  m_budget = budget;
+  struct rlimit limit;
+  getrlimit(RLIMIT_MEMLOCK, &limit);
+  Dout(dc::notice, "RTMemory: budget " << (budget >> 20) << " MB; allocated " << (m_allocated >> 20) << " MB; " <<
+      "RLIMIT_MEMLOCK " << (limit.rlim_cur == RLIM_INFINITY ? std::string("unlimited") : std::to_string(limit.rlim_cur >> 20) + " MB") << ".");
+  if (m_lock_failures > 0 || (limit.rlim_cur != RLIM_INFINITY && limit.rlim_cur < budget))
+  {
+    THROW_ALERT("The real-time thread needs [BUDGET] MB of locked memory, but the limit is [LIMIT] MB. "
+                "Increase memlock in /etc/security/limits.conf (or run ulimit -l).",
+        AIArgs("[BUDGET]", (budget >> 20) + 1)("[LIMIT]", limit.rlim_cur >> 20));
+  }
+}
+
+static SingletonInstance<RTMemory> dummy __attribute__ ((__unused__));
@@ -0,0 +1,86 @@
+/**
+ * \file RTMemory.h
+ * \brief Declaration of RTMemory.
+ *
+ * Copyright (C) 2016 Aleric Inglewood.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published
+ * by the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef RT_MEMORY_H
+#define RT_MEMORY_H
+
+#include "utils/Singleton.h"
+#include <atomic>
+#include <cstddef>
+#include <string>
+
+// Memory for buffers that are used by the real-time thread.
+//
+// Every allocation is a separate anonymous mapping that is locked into RAM (mlock)
+// and written to once per page before it is returned, so that the real-time thread
+// never takes a page fault on it. Large buffers can ask for huge pages: MAP_HUGETLB
+// when the system has reserved huge pages, transparent huge pages otherwise.
+// The memory is zero initialized and page aligned (so it is also SIMD aligned).
+//
+// Call reserve() after everything was allocated at start up: it throws if the
+// memory that we need can't be locked.
+class RTMemory : public Singleton<RTMemory>
+{
+    friend_Instance;
+  private:
+    RTMemory();
+    ~RTMemory() { }
+    RTMemory(RTMemory const&);
+
+    size_t m_page_size;
+    std::atomic<size_t> m_allocated;    // The number of bytes currently allocated.
+    std::atomic<int> m_lock_failures;   // The number of allocations that could not be locked.
+    size_t m_budget;                    // The argument of the last call to reserve().
+
+    static size_t const s_huge_page_size = 2 * 1024 * 1024;
+
+    size_t mapping_size(size_t size, bool huge_pages) const;
+
+  public:
+    // Allocate size bytes of locked, prefaulted and zeroed memory.
+    // Never call this from the real-time thread.
+    void* allocate(size_t size, bool huge_pages = false);
+    // Free memory returned by allocate(size, huge_pages).
+    void deallocate(void* ptr, size_t size, bool huge_pages = false);
+
+    // Map the file at path, which is created if needed and resized to size bytes, shared into memory;
+    // the mapping is locked and prefaulted like the memory returned by allocate(), but keeps the contents of the file.
+    // Changes are written back to the file by the kernel. Throws AIAlert::ErrorCode on failure.
+    void* map_file(std::string const& path, size_t size);
+    // Unmap memory returned by map_file(path, size).
+    void unmap_file(void* ptr, size_t size);
+
+    template<typename T>
+    T* allocate_array(size_t n, bool huge_pages = false) { return static_cast<T*>(allocate(n * sizeof(T), huge_pages)); }
+    template<typename T>
+    void deallocate_array(T* ptr, size_t n, bool huge_pages = false) { deallocate(ptr, n * sizeof(T), huge_pages); }
+
+    // Check that budget bytes (the memory allocated so far plus what is still going to be allocated) can be locked.
+    // Throws AIAlert::Error if not.
+    void reserve(size_t budget);
+
+    // Accessors.
+    size_t allocated() const { return m_allocated; }
+    int lock_failures() const { return m_lock_failures; }
+    size_t budget() const { return m_budget; }
+    size_t page_size() const { return m_page_size; }
+};
+
+#endif // RT_MEMORY_H
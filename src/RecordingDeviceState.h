@@ -22,6 +22,8 @@
 #define RECORDING_DEVICE_STATE_H
 
 #include <atomic>
+#include <cstddef>
+#include <cstdint>
 #include <memory>
 #include <functional>
 
@@ -44,18 +46,30 @@ class RecordingDeviceState
 
     static constexpr int clear_buffer = 0x80;
     static constexpr int playback_reset = 0x100;
-    static constexpr int commands_mask = clear_buffer | playback_reset;
+    static constexpr int playback_seek = 0x8000;        // Apply the loop region and seek position set with set_loop() and seek().
+    static constexpr int commands_mask = clear_buffer | playback_reset | playback_seek;
 
-    static constexpr int current_mask = playback_mask | record_mask | gui2jack_mask | commands_mask;
+    // The recording slot that is recorded into and the one that is played back.
+    static constexpr int max_slots = 8;
+    static constexpr int record_slot_shift = 9;
+    static constexpr int record_slot_mask = (max_slots - 1) << record_slot_shift;
+    static constexpr int playback_slot_shift = 12;
+    static constexpr int playback_slot_mask = (max_slots - 1) << playback_slot_shift;
+    static constexpr int slots_mask = record_slot_mask | playback_slot_mask;
+
+    static constexpr int current_mask = playback_mask | record_mask | gui2jack_mask | commands_mask | slots_mask;
     static constexpr int prev_mask_shift = 16;      // Larger or equal than the number of bits in current_mask but no larger than 16.
 
   protected:
     std::atomic<int> m_state;
     int m_last_state;
     std::function<void()> m_wakeup_gui;
+    std::atomic<size_t> m_seek_frame;           // The frame passed to seek(), or SIZE_MAX.
+    std::atomic<size_t> m_loop_begin;           // The arguments of the last call to set_loop().
+    std::atomic<size_t> m_loop_end;
 
   public:
-    RecordingDeviceState(int initial_state) : m_state(initial_state), m_last_state(-1) { }
+    RecordingDeviceState(int initial_state) : m_state(initial_state), m_last_state(-1), m_seek_frame(SIZE_MAX), m_loop_begin(0), m_loop_end(0) { }
     virtual ~RecordingDeviceState() { }
 
     void connect(std::function<void()> const& wakeup_gui) { m_wakeup_gui = wakeup_gui; }
@@ -69,6 +83,25 @@ class RecordingDeviceState
     }
     void set_recording_state(int record_state) { clear_and_set(record_mask, record_state & record_mask); }
     void set_playback_state(int playback_state);
+    void set_record_slot(int slot) { clear_and_set(record_slot_mask, (slot << record_slot_shift) & record_slot_mask); }
+    void set_playback_slot(int slot) { clear_and_set(playback_slot_mask, (slot << playback_slot_shift) & playback_slot_mask); }
+
+    // Continue playback at frame, counted from the start of the recording.
+    void seek(size_t frame)
+    {
+      m_seek_frame.store(frame, std::memory_order_relaxed);
+      std::atomic_thread_fence(std::memory_order_release);
+      clear_and_set(0, playback_seek);
+    }
+
+    // Loop playback of frames [begin, end), counted from the start of the recording. Stop looping when end isn't larger than begin.
+    void set_loop(size_t begin, size_t end)
+    {
+      m_loop_begin.store(begin, std::memory_order_relaxed);
+      m_loop_end.store(end, std::memory_order_relaxed);
+      std::atomic_thread_fence(std::memory_order_release);
+      clear_and_set(0, playback_seek);
+    }
 
     // Returns true when statebits & record_mask is record_output or record_input.
     bool is_recording() { return get_state() & record_mask; }
@@ -79,6 +112,11 @@ class RecordingDeviceState
   protected:
     // Return true if we must play from the start when reaching the end of the playback buffer.
     static bool is_repeat(int statebits) { return statebits & playback_repeat; }
+
+    static int record_slot(int statebits) { return (statebits & record_slot_mask) >> record_slot_shift; }
+    static int playback_slot(int statebits) { return (statebits & playback_slot_mask) >> playback_slot_shift; }
 };
 
+static_assert(RecordingDeviceState::current_mask < (1 << RecordingDeviceState::prev_mask_shift), "RecordingDeviceState::prev_mask_shift is too small.");
+
 #endif // RECORDING_DEVICE_STATE_H
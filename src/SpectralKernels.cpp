@@ -0,0 +1,355 @@
+/**
+ * /file SpectralKernels.cpp
+ * /brief Implementation of class SpectralKernels.
+ *
+ * Copyright (C) 2016 Aleric Inglewood.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published
+ * by the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "sys.h"
+
+#include "SpectralKernels.h"
+#include <cmath>
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define SPECTRAL_KERNELS_X86 1
+#endif
+
+typedef SpectralKernels::complex_type complex_type;
+
+namespace {
+
+//-----------------------------------------------------------------------------
+// Plain C++. Also used for the last few elements by the vectorized versions.
+
+void scalar_magnitude(float* out, complex_type const* in, size_t n, float scale)
+{
+  for (size_t i = 0; i < n; ++i)
+    out[i] = std::sqrt(in[i].real() * in[i].real() + in[i].imag() * in[i].imag()) * scale;
+}
+
+void scalar_replace_by_magnitude(complex_type* bins, size_t n, float scale)
+{
+  for (size_t i = 0; i < n; ++i)
+    bins[i] = std::sqrt(bins[i].real() * bins[i].real() + bins[i].imag() * bins[i].imag()) * scale;
+}
+
+void scalar_power(float* out, complex_type const* in, size_t n, float scale)
+{
+  for (size_t i = 0; i < n; ++i)
+    out[i] = (in[i].real() * in[i].real() + in[i].imag() * in[i].imag()) * scale;
+}
+
+void scalar_scale(float* out, float const* in, size_t n, float scale)
+{
+  for (size_t i = 0; i < n; ++i)
+    out[i] = in[i] * scale;
+}
+
+void scalar_multiply(float* out, float const* a, float const* b, size_t n)
+{
+  for (size_t i = 0; i < n; ++i)
+    out[i] = a[i] * b[i];
+}
+
+void scalar_multiply_add(float* acc, float const* a, float const* b, size_t n)
+{
+  for (size_t i = 0; i < n; ++i)
+    acc[i] += a[i] * b[i];
+}
+
+void scalar_add(float* acc, float const* in, size_t n)
+{
+  for (size_t i = 0; i < n; ++i)
+    acc[i] += in[i];
+}
+
+void scalar_complex_multiply_add(complex_type* acc, complex_type const* a, complex_type const* b, size_t n)
+{
+  // Written out, because operator* of std::complex also handles infinities, which is slow.
+  for (size_t i = 0; i < n; ++i)
+    acc[i] += complex_type(a[i].real() * b[i].real() - a[i].imag() * b[i].imag(), a[i].real() * b[i].imag() + a[i].imag() * b[i].real());
+}
+
+SpectralKernels::Table const scalar_table = {
+  "scalar",
+  scalar_magnitude, scalar_replace_by_magnitude, scalar_power, scalar_scale,
+  scalar_multiply, scalar_multiply_add, scalar_add, scalar_complex_multiply_add
+};
+
+#ifdef SPECTRAL_KERNELS_X86
+
+//-----------------------------------------------------------------------------
+// SSE2 (always available on x86_64). Four floats or two complex numbers per register.
+
+// Returns the squared magnitude of the four complex numbers in lo and hi.
+inline __m128 sse2_norm(__m128 lo, __m128 hi)
+{
+  __m128 re = _mm_shuffle_ps(lo, hi, _MM_SHUFFLE(2, 0, 2, 0));
+  __m128 im = _mm_shuffle_ps(lo, hi, _MM_SHUFFLE(3, 1, 3, 1));
+  return _mm_add_ps(_mm_mul_ps(re, re), _mm_mul_ps(im, im));
+}
+
+__attribute__ ((target("sse2")))
+void sse2_magnitude(float* out, complex_type const* in, size_t n, float scale)
+{
+  float const* src = reinterpret_cast<float const*>(in);
+  __m128 const s = _mm_set1_ps(scale);
+  size_t i = 0;
+  for (; i + 4 <= n; i += 4)
+  {
+    __m128 norm = sse2_norm(_mm_loadu_ps(src + 2 * i), _mm_loadu_ps(src + 2 * i + 4));
+    _mm_storeu_ps(out + i, _mm_mul_ps(_mm_sqrt_ps(norm), s));
+  }
+  scalar_magnitude(out + i, in + i, n - i, scale);
+}
+
+__attribute__ ((target("sse2")))
+void sse2_replace_by_magnitude(complex_type* bins, size_t n, float scale)
+{
+  float* dst = reinterpret_cast<float*>(bins);
+  __m128 const s = _mm_set1_ps(scale);
+  __m128 const zero = _mm_setzero_ps();
+  size_t i = 0;
+  for (; i + 4 <= n; i += 4)
+  {
+    __m128 mag = _mm_mul_ps(_mm_sqrt_ps(sse2_norm(_mm_loadu_ps(dst + 2 * i), _mm_loadu_ps(dst + 2 * i + 4))), s);
+    _mm_storeu_ps(dst + 2 * i, _mm_unpacklo_ps(mag, zero));
+    _mm_storeu_ps(dst + 2 * i + 4, _mm_unpackhi_ps(mag, zero));
+  }
+  scalar_replace_by_magnitude(bins + i, n - i, scale);
+}
+
+__attribute__ ((target("sse2")))
+void sse2_power(float* out, complex_type const* in, size_t n, float scale)
+{
+  float const* src = reinterpret_cast<float const*>(in);
+  __m128 const s = _mm_set1_ps(scale);
+  size_t i = 0;
+  for (; i + 4 <= n; i += 4)
+    _mm_storeu_ps(out + i, _mm_mul_ps(sse2_norm(_mm_loadu_ps(src + 2 * i), _mm_loadu_ps(src + 2 * i + 4)), s));
+  scalar_power(out + i, in + i, n - i, scale);
+}
+
+__attribute__ ((target("sse2")))
+void sse2_scale(float* out, float const* in, size_t n, float scale)
+{
+  __m128 const s = _mm_set1_ps(scale);
+  size_t i = 0;
+  for (; i + 4 <= n; i += 4)
+    _mm_storeu_ps(out + i, _mm_mul_ps(_mm_loadu_ps(in + i), s));
+  scalar_scale(out + i, in + i, n - i, scale);
+}
+
+__attribute__ ((target("sse2")))
+void sse2_multiply(float* out, float const* a, float const* b, size_t n)
+{
+  size_t i = 0;
+  for (; i + 4 <= n; i += 4)
+    _mm_storeu_ps(out + i, _mm_mul_ps(_mm_loadu_ps(a + i), _mm_loadu_ps(b + i)));
+  scalar_multiply(out + i, a + i, b + i, n - i);
+}
+
+__attribute__ ((target("sse2")))
+void sse2_multiply_add(float* acc, float const* a, float const* b, size_t n)
+{
+  size_t i = 0;
+  for (; i + 4 <= n; i += 4)
+    _mm_storeu_ps(acc + i, _mm_add_ps(_mm_loadu_ps(acc + i), _mm_mul_ps(_mm_loadu_ps(a + i), _mm_loadu_ps(b + i))));
+  scalar_multiply_add(acc + i, a + i, b + i, n - i);
+}
+
+__attribute__ ((target("sse2")))
+void sse2_add(float* acc, float const* in, size_t n)
+{
+  size_t i = 0;
+  for (; i + 4 <= n; i += 4)
+    _mm_storeu_ps(acc + i, _mm_add_ps(_mm_loadu_ps(acc + i), _mm_loadu_ps(in + i)));
+  scalar_add(acc + i, in + i, n - i);
+}
+
+__attribute__ ((target("sse2")))
+void sse2_complex_multiply_add(complex_type* acc, complex_type const* a, complex_type const* b, size_t n)
+{
+  float* pacc = reinterpret_cast<float*>(acc);
+  float const* pa = reinterpret_cast<float const*>(a);
+  float const* pb = reinterpret_cast<float const*>(b);
+  // Flips the sign of the real parts.
+  __m128 const negate_real = _mm_castsi128_ps(_mm_set_epi32(0, 0x80000000, 0, 0x80000000));
+  size_t i = 0;
+  for (; i + 2 <= n; i += 2)
+  {
+    __m128 va = _mm_loadu_ps(pa + 2 * i);                                       // ar ai
+    __m128 vb = _mm_loadu_ps(pb + 2 * i);                                       // br bi
+    __m128 b_re = _mm_shuffle_ps(vb, vb, _MM_SHUFFLE(2, 2, 0, 0));              // br br
+    __m128 b_im = _mm_shuffle_ps(vb, vb, _MM_SHUFFLE(3, 3, 1, 1));              // bi bi
+    __m128 a_swapped = _mm_shuffle_ps(va, va, _MM_SHUFFLE(2, 3, 0, 1));         // ai ar
+    __m128 cross = _mm_xor_ps(_mm_mul_ps(a_swapped, b_im), negate_real);        // -ai*bi ar*bi
+    __m128 product = _mm_add_ps(_mm_mul_ps(va, b_re), cross);
+    _mm_storeu_ps(pacc + 2 * i, _mm_add_ps(_mm_loadu_ps(pacc + 2 * i), product));
+  }
+  scalar_complex_multiply_add(acc + i, a + i, b + i, n - i);
+}
+
+SpectralKernels::Table const sse2_table = {
+  "SSE2",
+  sse2_magnitude, sse2_replace_by_magnitude, sse2_power, sse2_scale,
+  sse2_multiply, sse2_multiply_add, sse2_add, sse2_complex_multiply_add
+};
+
+//-----------------------------------------------------------------------------
+// AVX2 and FMA. Eight floats or four complex numbers per register.
+
+// Returns the squared magnitude of the eight complex numbers in lo and hi, in the order 0, 1, 4, 5, 2, 3, 6, 7.
+__attribute__ ((target("avx2,fma")))
+inline __m256 avx2_norm_interleaved(__m256 lo, __m256 hi)
+{
+  __m256 re = _mm256_shuffle_ps(lo, hi, _MM_SHUFFLE(2, 0, 2, 0));
+  __m256 im = _mm256_shuffle_ps(lo, hi, _MM_SHUFFLE(3, 1, 3, 1));
+  return _mm256_fmadd_ps(re, re, _mm256_mul_ps(im, im));
+}
+
+// Put the result of avx2_norm_interleaved in the order 0, 1, ..., 7.
+__attribute__ ((target("avx2,fma")))
+inline __m256 avx2_deinterleave(__m256 v)
+{
+  return _mm256_castpd_ps(_mm256_permute4x64_pd(_mm256_castps_pd(v), _MM_SHUFFLE(3, 1, 2, 0)));
+}
+
+__attribute__ ((target("avx2,fma")))
+void avx2_magnitude(float* out, complex_type const* in, size_t n, float scale)
+{
+  float const* src = reinterpret_cast<float const*>(in);
+  __m256 const s = _mm256_set1_ps(scale);
+  size_t i = 0;
+  for (; i + 8 <= n; i += 8)
+  {
+    __m256 norm = avx2_norm_interleaved(_mm256_loadu_ps(src + 2 * i), _mm256_loadu_ps(src + 2 * i + 8));
+    _mm256_storeu_ps(out + i, avx2_deinterleave(_mm256_mul_ps(_mm256_sqrt_ps(norm), s)));
+  }
+  sse2_magnitude(out + i, in + i, n - i, scale);
+}
+
+__attribute__ ((target("avx2,fma")))
+void avx2_replace_by_magnitude(complex_type* bins, size_t n, float scale)
+{
+  float* dst = reinterpret_cast<float*>(bins);
+  __m256 const s = _mm256_set1_ps(scale);
+  __m256 const zero = _mm256_setzero_ps();
+  size_t i = 0;
+  for (; i + 8 <= n; i += 8)
+  {
+    // Unpacking the interleaved order with zeroes puts the bins back where they came from.
+    __m256 mag = _mm256_mul_ps(_mm256_sqrt_ps(avx2_norm_interleaved(_mm256_loadu_ps(dst + 2 * i), _mm256_loadu_ps(dst + 2 * i + 8))), s);
+    _mm256_storeu_ps(dst + 2 * i, _mm256_unpacklo_ps(mag, zero));
+    _mm256_storeu_ps(dst + 2 * i + 8, _mm256_unpackhi_ps(mag, zero));
+  }
+  sse2_replace_by_magnitude(bins + i, n - i, scale);
+}
+
+__attribute__ ((target("avx2,fma")))
+void avx2_power(float* out, complex_type const* in, size_t n, float scale)
+{
+  float const* src = reinterpret_cast<float const*>(in);
+  __m256 const s = _mm256_set1_ps(scale);
+  size_t i = 0;
+  for (; i + 8 <= n; i += 8)
+  {
+    __m256 norm = avx2_norm_interleaved(_mm256_loadu_ps(src + 2 * i), _mm256_loadu_ps(src + 2 * i + 8));
+    _mm256_storeu_ps(out + i, avx2_deinterleave(_mm256_mul_ps(norm, s)));
+  }
+  sse2_power(out + i, in + i, n - i, scale);
+}
+
+__attribute__ ((target("avx2,fma")))
+void avx2_scale(float* out, float const* in, size_t n, float scale)
+{
+  __m256 const s = _mm256_set1_ps(scale);
+  size_t i = 0;
+  for (; i + 8 <= n; i += 8)
+    _mm256_storeu_ps(out + i, _mm256_mul_ps(_mm256_loadu_ps(in + i), s));
+  sse2_scale(out + i, in + i, n - i, scale);
+}
+
+__attribute__ ((target("avx2,fma")))
+void avx2_multiply(float* out, float const* a, float const* b, size_t n)
+{
+  size_t i = 0;
+  for (; i + 8 <= n; i += 8)
+    _mm256_storeu_ps(out + i, _mm256_mul_ps(_mm256_loadu_ps(a + i), _mm256_loadu_ps(b + i)));
+  sse2_multiply(out + i, a + i, b + i, n - i);
+}
+
+__attribute__ ((target("avx2,fma")))
+void avx2_multiply_add(float* acc, float const* a, float const* b, size_t n)
+{
+  size_t i = 0;
+  for (; i + 8 <= n; i += 8)
+    _mm256_storeu_ps(acc + i, _mm256_fmadd_ps(_mm256_loadu_ps(a + i), _mm256_loadu_ps(b + i), _mm256_loadu_ps(acc + i)));
+  sse2_multiply_add(acc + i, a + i, b + i, n - i);
+}
+
+__attribute__ ((target("avx2,fma")))
+void avx2_add(float* acc, float const* in, size_t n)
+{
+  size_t i = 0;
+  for (; i + 8 <= n; i += 8)
+    _mm256_storeu_ps(acc + i, _mm256_add_ps(_mm256_loadu_ps(acc + i), _mm256_loadu_ps(in + i)));
+  sse2_add(acc + i, in + i, n - i);
+}
+
+__attribute__ ((target("avx2,fma")))
+void avx2_complex_multiply_add(complex_type* acc, complex_type const* a, complex_type const* b, size_t n)
+{
+  float* pacc = reinterpret_cast<float*>(acc);
+  float const* pa = reinterpret_cast<float const*>(a);
+  float const* pb = reinterpret_cast<float const*>(b);
+  size_t i = 0;
+  for (; i + 4 <= n; i += 4)
+  {
+    __m256 va = _mm256_loadu_ps(pa + 2 * i);                                    // ar ai
+    __m256 vb = _mm256_loadu_ps(pb + 2 * i);                                    // br bi
+    __m256 a_swapped = _mm256_permute_ps(va, _MM_SHUFFLE(2, 3, 0, 1));          // ai ar
+    __m256 cross = _mm256_mul_ps(a_swapped, _mm256_movehdup_ps(vb));            // ai*bi ar*bi
+    __m256 product = _mm256_fmaddsub_ps(va, _mm256_moveldup_ps(vb), cross);     // ar*br-ai*bi ai*br+ar*bi
+    _mm256_storeu_ps(pacc + 2 * i, _mm256_add_ps(_mm256_loadu_ps(pacc + 2 * i), product));
+  }
+  sse2_complex_multiply_add(acc + i, a + i, b + i, n - i);
+}
+
+SpectralKernels::Table const avx2_table = {
+  "AVX2",
+  avx2_magnitude, avx2_replace_by_magnitude, avx2_power, avx2_scale,
+  avx2_multiply, avx2_multiply_add, avx2_add, avx2_complex_multiply_add
+};
+
+#endif // SPECTRAL_KERNELS_X86
+
+SpectralKernels::Table const& select_table()
+{
+#ifdef SPECTRAL_KERNELS_X86
+  __builtin_cpu_init();
+  if (__builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma"))
+    return avx2_table;
+  if (__builtin_cpu_supports("sse2"))
+    return sse2_table;
+#endif
+  return scalar_table;
+}
+
+} // namespace
+
+// Copied, so that calling a kernel is a single indirect call.
+SpectralKernels::Table const SpectralKernels::s_table = select_table();
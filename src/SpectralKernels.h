@@ -0,0 +1,83 @@
+/**
+ * \file SpectralKernels.h
+ * \brief Declaration of SpectralKernels.
+ *
+ * Copyright (C) 2016 Aleric Inglewood.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published
+ * by the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef SPECTRAL_KERNELS_H
+#define SPECTRAL_KERNELS_H
+
+#include <complex>
+#include <cstddef>
+
+// Vectorized loops over samples and frequency bins.
+//
+// The implementation (AVX2+FMA, SSE2 or plain C++) is chosen once at program
+// start, depending on what the CPU supports. None of the kernels require
+// aligned arrays, and none of them allocate memory, so they can be used in
+// the real-time thread. Output arrays may be the same as an input array.
+class SpectralKernels
+{
+  public:
+    typedef std::complex<float> complex_type;
+
+    // out[i] = |in[i]| * scale.
+    static void magnitude(float* out, complex_type const* in, size_t n, float scale = 1.0f) { s_table.magnitude(out, in, n, scale); }
+
+    // bins[i] = |bins[i]| * scale (the imaginary part becomes zero).
+    static void replace_by_magnitude(complex_type* bins, size_t n, float scale = 1.0f) { s_table.replace_by_magnitude(bins, n, scale); }
+
+    // out[i] = |in[i]|^2 * scale.
+    static void power(float* out, complex_type const* in, size_t n, float scale = 1.0f) { s_table.power(out, in, n, scale); }
+
+    // out[i] = in[i] * scale.
+    static void scale(float* out, float const* in, size_t n, float scale) { s_table.scale(out, in, n, scale); }
+
+    // out[i] = a[i] * b[i].
+    static void multiply(float* out, float const* a, float const* b, size_t n) { s_table.multiply(out, a, b, n); }
+
+    // acc[i] += a[i] * b[i].
+    static void multiply_add(float* acc, float const* a, float const* b, size_t n) { s_table.multiply_add(acc, a, b, n); }
+
+    // acc[i] += in[i].
+    static void add(float* acc, float const* in, size_t n) { s_table.add(acc, in, n); }
+
+    // acc[i] += a[i] * b[i], for complex numbers.
+    static void complex_multiply_add(complex_type* acc, complex_type const* a, complex_type const* b, size_t n) { s_table.complex_multiply_add(acc, a, b, n); }
+
+    // The name of the instruction set that is being used.
+    static char const* instruction_set() { return s_table.name; }
+
+  public:
+    struct Table
+    {
+      char const* name;
+      void (*magnitude)(float*, complex_type const*, size_t, float);
+      void (*replace_by_magnitude)(complex_type*, size_t, float);
+      void (*power)(float*, complex_type const*, size_t, float);
+      void (*scale)(float*, float const*, size_t, float);
+      void (*multiply)(float*, float const*, float const*, size_t);
+      void (*multiply_add)(float*, float const*, float const*, size_t);
+      void (*add)(float*, float const*, size_t);
+      void (*complex_multiply_add)(complex_type*, complex_type const*, complex_type const*, size_t);
+    };
+
+  private:
+    static Table const s_table;
+};
+
+#endif // SPECTRAL_KERNELS_H
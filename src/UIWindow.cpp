@@ -25,6 +25,7 @@
 #include "debug.h"
 #include "utils/at_scope_end.h"
 #include "RecordingDeviceState.h"
+#include "FFTJackClient.h"
 
 #include <gtkmm.h>
 
@@ -90,14 +91,16 @@ void GladeBuilder::get_widget(char const* name, T& widget)
   }
 }
 
-UIWindow::UIWindow(std::string const& glade_path, std::string const& css_path, char const* window_name, RecordingDeviceState& state) :
+UIWindow::UIWindow(std::string const& glade_path, std::string const& css_path, char const* window_name, FFTJackClient& jack_client) :
   GladeBuilder(glade_path, window_name),                                // Initialize the builder in the GladeBuilder base class.
   Gtk::Window(GladeBuilder::get_window(glade_path, window_name)),       // Get the window from the builder and wrap it as the Gtk::Window base class.
-  m_state(state),
+  m_jack_client(jack_client),
+  m_state(jack_client),
   m_internal_set_active(false),
   m_record_radio_buttons_state(RecordingDeviceState::record_input),
   m_stop_radio_buttons_state(RecordingDeviceState::passthrough),
-  m_play_check_buttons_state(0)
+  m_play_check_buttons_state(0),
+  m_number_of_takes(0)
 {
   Gtk::Window* window;
 
@@ -115,6 +118,13 @@ UIWindow::UIWindow(std::string const& glade_path, std::string const& css_path, c
     get_widget("passthrough", m_radio_passthrough);
     get_widget("test output", m_radio_test_output);
     get_widget("mute", m_radio_mute);
+    get_widget("record_slot", m_combo_record_slot);
+    get_widget("playback_slot", m_combo_playback_slot);
+    get_widget("seek", m_button_seek);
+    get_widget("position_begin", m_spin_position_begin);
+    get_widget("position_end", m_spin_position_end);
+    get_widget("loop", m_checkbox_loop);
+    get_widget("take", m_combo_take);
   }
   catch(AIAlert::Error const& error)
   {
@@ -137,6 +147,30 @@ UIWindow::UIWindow(std::string const& glade_path, std::string const& css_path, c
   // Clean up.
   m_refBuilder.reset();         // We're done with the builder.
 
+  // Fill the slot selectors; they are only shown when there is more than one slot.
+  std::vector<std::string> const& slot_names(m_jack_client.slot_names());
+  for (size_t slot = 0; slot < slot_names.size(); ++slot)
+  {
+    std::string const name = slot_names[slot].empty() ? "slot " + std::to_string(slot + 1) : slot_names[slot];
+    m_combo_record_slot->append(name);
+    m_combo_playback_slot->append(name);
+  }
+  m_combo_record_slot->set_active(0);
+  m_combo_playback_slot->set_active(0);
+  if (slot_names.size() < 2)
+  {
+    m_combo_record_slot->hide();
+    m_combo_playback_slot->hide();
+  }
+
+  // The start and end position of playback, in seconds. The recorder clamps them to the length of the recording.
+  for (Gtk::SpinButton* spin_button : { m_spin_position_begin, m_spin_position_end })
+  {
+    spin_button->set_digits(1);
+    spin_button->set_increments(0.1, 1.0);
+    spin_button->set_range(0.0, 3600.0);
+  }
+
   // Connect signals.
   m_button_record->signal_clicked().connect([this]{ on_button_record_clicked(); });
   m_button_play->signal_clicked().connect([this]{ on_button_play_clicked(); });
@@ -148,6 +182,13 @@ UIWindow::UIWindow(std::string const& glade_path, std::string const& css_path, c
   m_radio_passthrough->signal_toggled().connect([this]{ on_stop_radio_toggled(RecordingDeviceState::passthrough); });
   m_radio_test_output->signal_toggled().connect([this]{ on_stop_radio_toggled(RecordingDeviceState::direct); });
   m_radio_mute->signal_toggled().connect([this]{ on_stop_radio_toggled(RecordingDeviceState::muted); });
+  m_combo_record_slot->signal_changed().connect([this]{ on_record_slot_changed(); });
+  m_combo_playback_slot->signal_changed().connect([this]{ on_playback_slot_changed(); });
+  m_button_seek->signal_clicked().connect([this]{ on_seek_clicked(); });
+  m_spin_position_begin->signal_value_changed().connect([this]{ on_loop_changed(); });
+  m_spin_position_end->signal_value_changed().connect([this]{ on_loop_changed(); });
+  m_checkbox_loop->signal_toggled().connect([this]{ on_loop_changed(); });
+  m_combo_take->signal_changed().connect([this]{ on_take_changed(); });
 
   // Connect audio thread dispatcher.
   m_state_changed.connect([this]{ on_wakeup(); });
@@ -307,6 +348,68 @@ void UIWindow::on_stop_radio_toggled(int state)
     m_state.set_playback_state(m_stop_radio_buttons_state);
 }
 
+void UIWindow::on_record_slot_changed()
+{
+  int const slot = m_combo_record_slot->get_active_row_number();
+  Dout(dc::notice, "Calling UIWindow::on_record_slot_changed(): " << slot);
+  if (slot >= 0)
+    m_state.set_record_slot(slot);
+}
+
+void UIWindow::on_playback_slot_changed()
+{
+  int const slot = m_combo_playback_slot->get_active_row_number();
+  Dout(dc::notice, "Calling UIWindow::on_playback_slot_changed(): " << slot);
+  if (slot >= 0)
+    m_state.set_playback_slot(slot);
+}
+
+size_t UIWindow::seconds_to_frames(double seconds) const
+{
+  return static_cast<size_t>(seconds * m_jack_client.sample_rate() + 0.5);
+}
+
+void UIWindow::on_seek_clicked()
+{
+  Dout(dc::notice, "Calling UIWindow::on_seek_clicked(): " << m_spin_position_begin->get_value());
+  m_state.seek(seconds_to_frames(m_spin_position_begin->get_value()));
+}
+
+void UIWindow::on_loop_changed()
+{
+  bool const loop = m_checkbox_loop->get_active();
+  Dout(dc::notice, "Calling UIWindow::on_loop_changed(): " << loop << "; [" << m_spin_position_begin->get_value() << ", " << m_spin_position_end->get_value() << ")");
+  if (loop)
+    m_state.set_loop(seconds_to_frames(m_spin_position_begin->get_value()), seconds_to_frames(m_spin_position_end->get_value()));
+  else
+    m_state.set_loop(0, 0);     // Stop looping.
+}
+
+void UIWindow::on_take_changed()
+{
+  if (m_internal_set_active)
+    return;     // The newest take was added and selected by update_takes().
+  int const take = m_combo_take->get_active_row_number();
+  Dout(dc::notice, "Calling UIWindow::on_take_changed(): " << take);
+  if (take >= 0)
+    m_jack_client.play_take(take);
+}
+
+// Add the compressed takes that were finished since the last call, and select the newest one (which is what is played back then).
+void UIWindow::update_takes()
+{
+  size_t const number_of_takes = m_jack_client.number_of_takes();
+  if (number_of_takes == m_number_of_takes)
+    return;
+  m_internal_set_active = true;
+  auto&& reset_internal_set_active = at_scope_end([this]{ m_internal_set_active = false; });
+  for (; m_number_of_takes < number_of_takes; ++m_number_of_takes)
+    m_combo_take->append("take " + std::to_string(m_number_of_takes + 1));
+  m_combo_take->set_active(m_number_of_takes - 1);
+  reset_internal_set_active.now();
+  m_combo_take->show();
+}
+
 void UIWindow::on_wakeup()
 {
   Dout(dc::notice, "UIWindow::on_wakeup()");
@@ -315,4 +418,5 @@ void UIWindow::on_wakeup()
     stop_playback_if_any();
   if (!m_state.is_recording())
     stop_recording_if_any();
+  update_takes();
 }
@@ -34,10 +34,13 @@
 #include <gtkmm/application.h>
 #include <gtkmm/builder.h>
 #include <gtkmm/radiobutton.h>
+#include <gtkmm/comboboxtext.h>
+#include <gtkmm/spinbutton.h>
 #include <glibmm/dispatcher.h>
 
-// Forward declaration.
+// Forward declarations.
 class RecordingDeviceState;
+class FFTJackClient;
 
 // Helper class.
 class GladeBuilder
@@ -53,12 +56,14 @@ class GladeBuilder
 class UIWindow : private GladeBuilder, public Gtk::Window
 {
   public:
-    UIWindow(std::string const& glade_path, std::string const& css_path, char const* window_name, RecordingDeviceState& state);
+    UIWindow(std::string const& glade_path, std::string const& css_path, char const* window_name, FFTJackClient& jack_client);
     virtual ~UIWindow();
 
   private:
     void stop_playback_if_any();
     void stop_recording_if_any();
+    size_t seconds_to_frames(double seconds) const;
+    void update_takes();
 
   protected:
     // Signal handlers.
@@ -69,6 +74,11 @@ class UIWindow : private GladeBuilder, public Gtk::Window
     void on_playback_to_input_toggled();
     void on_record_radio_toggled(int state);
     void on_stop_radio_toggled(int state);
+    void on_record_slot_changed();
+    void on_playback_slot_changed();
+    void on_seek_clicked();
+    void on_loop_changed();
+    void on_take_changed();
     void on_wakeup();
 
   private:
@@ -82,7 +92,15 @@ class UIWindow : private GladeBuilder, public Gtk::Window
     Gtk::RadioButton* m_radio_passthrough;
     Gtk::RadioButton* m_radio_test_output;
     Gtk::RadioButton* m_radio_mute;
+    Gtk::ComboBoxText* m_combo_record_slot;
+    Gtk::ComboBoxText* m_combo_playback_slot;
+    Gtk::Button* m_button_seek;
+    Gtk::SpinButton* m_spin_position_begin;
+    Gtk::SpinButton* m_spin_position_end;
+    Gtk::CheckButton* m_checkbox_loop;
+    Gtk::ComboBoxText* m_combo_take;
 
+    FFTJackClient& m_jack_client;
     RecordingDeviceState& m_state;
     Glib::Dispatcher m_state_changed;
 
@@ -90,6 +108,7 @@ class UIWindow : private GladeBuilder, public Gtk::Window
     int m_record_radio_buttons_state;
     int m_stop_radio_buttons_state;
     int m_play_check_buttons_state;
+    size_t m_number_of_takes;           // The number of takes in m_combo_take.
 };
 
 #endif // UI_WINDOW_H
@@ -0,0 +1,184 @@
+/**
+ * /file WaveFileReader.cpp
+ * /brief Implementation of class WaveFileReader.
+ *
+ * Copyright (C) 2016 Aleric Inglewood.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published
+ * by the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "sys.h"
+
+#include "WaveFileReader.h"
+#include "debug.h"
+#include "utils/AIAlert.h"
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+namespace {
+
+// WAV files are little endian, independent of the host.
+bool is_id(unsigned char const* p, char const* id) { return std::memcmp(p, id, 4) == 0; }
+uint16_t get_u16(unsigned char const* p) { return p[0] | (p[1] << 8); }
+uint32_t get_u32(unsigned char const* p) { return get_u16(p) | ((uint32_t)get_u16(p + 2) << 16); }
+uint64_t get_u64(unsigned char const* p) { return get_u32(p) | ((uint64_t)get_u32(p + 4) << 32); }
+
+uint16_t const wave_format_pcm = 1;
+uint16_t const wave_format_ieee_float = 3;
+uint16_t const wave_format_extensible = 0xfffe;
+
+} // namespace
+
+WaveFileReader::WaveFileReader() :
+    m_fd(-1), m_channels(1), m_sample_rate(0), m_float(false), m_bytes_per_sample(2), m_data_offset(0), m_frames(0), m_position(0)
+{
+}
+
+void WaveFileReader::open(std::string const& filename)
+{
+  DoutEntering(dc::notice, "WaveFileReader::open(\"" << filename << "\")");
+  close();
+  m_fd = ::open(filename.c_str(), O_RDONLY | O_CLOEXEC);
+  if (m_fd == -1)
+    THROW_ALERTC(errno, "Cannot open \"[FILENAME]\"", AIArgs("[FILENAME]", filename));
+  m_filename = filename;
+
+  unsigned char header[36];
+  pread_fully(header, 12, 0);
+  bool const rf64 = is_id(header, "RF64");
+  if (!(is_id(header, "RIFF") || rf64) || !is_id(header + 8, "WAVE"))
+  {
+    close();
+    THROW_ALERT("\"[FILENAME]\" is not a WAV file.", AIArgs("[FILENAME]", filename));
+  }
+
+  // Walk the chunks until the data chunk.
+  uint64_t ds64_data_size = 0;
+  uint16_t format = 0;
+  int bits_per_sample = 0;
+  uint64_t offset = 12;
+  while (true)
+  {
+    pread_fully(header, 8, offset);
+    uint64_t size = get_u32(header + 4);
+    offset += 8;
+    if (is_id(header, "ds64"))
+    {
+      pread_fully(header + 8, 16, offset);
+      ds64_data_size = get_u64(header + 16);
+    }
+    else if (is_id(header, "fmt "))
+    {
+      pread_fully(header + 8, std::min(size, (uint64_t)26), offset);
+      format = get_u16(header + 8);
+      m_channels = get_u16(header + 10);
+      m_sample_rate = get_u32(header + 12);
+      bits_per_sample = get_u16(header + 22);
+      if (format == wave_format_extensible && size >= 26)
+        format = get_u16(header + 32);     // The first two bytes of the SubFormat GUID.
+    }
+    else if (is_id(header, "data"))
+    {
+      if (rf64 && size == 0xffffffff)
+        size = ds64_data_size;
+      m_data_offset = offset;
+      break;
+    }
+    offset += size + (size & 1);        // Chunks are padded to an even size.
+  }
+
+  m_float = format == wave_format_ieee_float;
+  m_bytes_per_sample = bits_per_sample / 8;
+  bool const supported = (format == wave_format_pcm && (bits_per_sample == 16 || bits_per_sample == 24 || bits_per_sample == 32)) ||
+                         (m_float && bits_per_sample == 32);
+  if (!supported || m_channels < 1)
+  {
+    close();
+    THROW_ALERT("\"[FILENAME]\": unsupported WAV format [FORMAT] with [BITS] bits per sample.",
+        AIArgs("[FILENAME]", filename)("[FORMAT]", format)("[BITS]", bits_per_sample));
+  }
+
+  // Don't trust the size in the header of a file that is still being written (or whose writer crashed).
+  int const block_align = m_channels * m_bytes_per_sample;
+  uint64_t data_size = get_u32(header + 4);
+  if (rf64 && data_size == 0xffffffff)
+    data_size = ds64_data_size;
+  struct stat st;
+  if (fstat(m_fd, &st) == 0 && (data_size == 0 || m_data_offset + data_size > (uint64_t)st.st_size))
+    data_size = st.st_size - m_data_offset;
+  m_frames = data_size / block_align;
+  m_position = 0;
+  m_buffer.resize(std::max(s_read_size / block_align, (size_t)1) * block_align);
+  Dout(dc::notice, "\"" << filename << "\": " << m_channels << " channels, " << m_sample_rate << " Hz, " << m_frames << " frames.");
+}
+
+void WaveFileReader::close()
+{
+  if (m_fd == -1)
+    return;
+  ::close(m_fd);
+  m_fd = -1;
+}
+
+jack_nframes_t WaveFileReader::read(float* out, jack_nframes_t max_frames)
+{
+  int const block_align = m_channels * m_bytes_per_sample;
+  jack_nframes_t total = 0;
+  while (total < max_frames && m_position < m_frames)
+  {
+    jack_nframes_t const nframes = std::min((uint64_t)std::min(max_frames - total, (jack_nframes_t)(m_buffer.size() / block_align)), m_frames - m_position);
+    pread_fully(m_buffer.data(), nframes * block_align, m_data_offset + m_position * block_align);
+    unsigned char const* in = m_buffer.data();
+    size_t const samples = (size_t)nframes * m_channels;
+    if (m_float)
+      std::memcpy(out, in, samples * sizeof(float));        // Both little endian.
+    else if (m_bytes_per_sample == 2)
+      for (size_t i = 0; i < samples; ++i, in += 2)
+        out[i] = (int16_t)get_u16(in) * (1.0f / 32768);
+    else if (m_bytes_per_sample == 3)
+      for (size_t i = 0; i < samples; ++i, in += 3)
+        out[i] = (int32_t)((in[0] << 8) | (in[1] << 16) | ((uint32_t)in[2] << 24)) * (1.0f / 2147483648.0f);
+    else
+      for (size_t i = 0; i < samples; ++i, in += 4)
+        out[i] = (int32_t)get_u32(in) * (1.0f / 2147483648.0f);
+    out += samples;
+    total += nframes;
+    m_position += nframes;
+  }
+  return total;
+}
+
+void WaveFileReader::pread_fully(void* data, size_t size, uint64_t offset)
+{
+  char* ptr = static_cast<char*>(data);
+  while (size > 0)
+  {
+    ssize_t len = pread(m_fd, ptr, size, offset);
+    if (len == -1 && errno == EINTR)
+      continue;
+    if (len <= 0)
+    {
+      if (len == 0)
+        THROW_ALERT("Unexpected end of file \"[FILENAME]\".", AIArgs("[FILENAME]", m_filename));
+      THROW_ALERTC(errno, "Error reading \"[FILENAME]\"", AIArgs("[FILENAME]", m_filename));
+    }
+    ptr += len;
+    size -= len;
+    offset += len;
+  }
+}
@@ -0,0 +1,83 @@
+/**
+ * \file WaveFileReader.h
+ * \brief Declaration of WaveFileReader.
+ *
+ * Copyright (C) 2016 Aleric Inglewood.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published
+ * by the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef WAVE_FILE_READER_H
+#define WAVE_FILE_READER_H
+
+#include "AudioSource.h"
+#include <jack/jack.h>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+// Read a WAV (or RF64) file as 32-bit float frames.
+//
+// Supports integer PCM of 16, 24 and 32 bits and 32-bit float, also when
+// wrapped in WAVE_FORMAT_EXTENSIBLE. The file is read sequentially with
+// large reads; rewind() seeks back to the first frame.
+//
+// Not thread-safe; the member functions throw AIAlert::Error on errors.
+class WaveFileReader : public AudioSource
+{
+  private:
+    int m_fd;                           // The file descriptor, or -1 when no file is open.
+    std::string m_filename;
+    int m_channels;
+    jack_nframes_t m_sample_rate;
+    bool m_float;                       // Set for 32-bit float samples, otherwise integer PCM.
+    int m_bytes_per_sample;
+    uint64_t m_data_offset;             // The offset of the first frame in the file.
+    uint64_t m_frames;                  // The number of frames in the file.
+    uint64_t m_position;                // The number of the next frame that read() returns.
+
+    std::vector<unsigned char> m_buffer;        // Raw data read from the file.
+
+  public:
+    static size_t const s_read_size = 256 * 1024;       // The size of one read from the file in bytes (about).
+
+    WaveFileReader();
+    ~WaveFileReader() { close(); }
+
+    void open(std::string const& filename);
+    void close();
+
+    // Read up to max_frames interleaved frames into out (max_frames * channels() floats).
+    // Returns the number of frames read, which is only less than max_frames at the end of the file.
+    /*virtual*/ jack_nframes_t read(float* out, jack_nframes_t max_frames);
+
+    // Continue reading at the first frame.
+    /*virtual*/ void rewind() { m_position = 0; }
+
+    // Accessors.
+    bool is_open() const { return m_fd != -1; }
+    std::string const& filename() const { return m_filename; }
+    /*virtual*/ int channels() const { return m_channels; }
+    /*virtual*/ jack_nframes_t sample_rate() const { return m_sample_rate; }
+    /*virtual*/ uint64_t frames() const { return m_frames; }
+    uint64_t position() const { return m_position; }
+
+  private:
+    void pread_fully(void* data, size_t size, uint64_t offset);
+
+  private:
+    WaveFileReader(WaveFileReader const&);
+};
+
+#endif // WAVE_FILE_READER_H
@@ -0,0 +1,239 @@
+/**
+ * /file WaveFileWriter.cpp
+ * /brief Implementation of class WaveFileWriter.
+ *
+ * Copyright (C) 2016 Aleric Inglewood.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published
+ * by the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "sys.h"
+
+#include "WaveFileWriter.h"
+#include "debug.h"
+#include "utils/AIAlert.h"
+#include "utils/macros.h"
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+#include <new>
+#include <fcntl.h>
+#include <unistd.h>
+
+namespace {
+
+// WAV files are little endian, independent of the host.
+void put_id(unsigned char* p, char const* id) { std::memcpy(p, id, 4); }
+void put_u16(unsigned char* p, uint16_t v) { p[0] = v; p[1] = v >> 8; }
+void put_u32(unsigned char* p, uint32_t v) { put_u16(p, v); put_u16(p + 2, v >> 16); }
+void put_u64(unsigned char* p, uint64_t v) { put_u32(p, v); put_u32(p + 4, v >> 32); }
+
+uint16_t const wave_format_ieee_float = 3;
+
+// Offsets of the chunks in the header.
+size_t const ds64_offset = 12;          // 'JUNK' until the file needs RF64, then 'ds64'.
+size_t const ds64_size = 28;            // riffSize, dataSize, sampleCount (64 bit each) and an empty table (32 bit).
+size_t const fmt_offset = ds64_offset + 8 + ds64_size;
+size_t const fmt_size = 18;
+size_t const fact_offset = fmt_offset + 8 + fmt_size;
+size_t const padding_offset = fact_offset + 12;
+size_t const data_offset = WaveFileWriter::s_header_size - 8;
+
+void* aligned_alloc_or_throw(size_t size)
+{
+  void* ptr;
+  if (posix_memalign(&ptr, WaveFileWriter::s_alignment, size) != 0)
+    throw std::bad_alloc();
+  return ptr;
+}
+
+} // namespace
+
+WaveFileWriter::WaveFileWriter(size_t buffer_size) :
+    m_fd(-1), m_direct_io(false), m_channels(1), m_sample_rate(0), m_data_bytes(0),
+    m_buffer_size(buffer_size / sizeof(float)), m_buffer_fill(0)
+{
+  // A full write buffer must be a multiple of the alignment.
+  ASSERT(buffer_size % s_alignment == 0);
+  m_buffer = static_cast<float*>(aligned_alloc_or_throw(buffer_size));
+  m_header = static_cast<unsigned char*>(aligned_alloc_or_throw(s_header_size));
+}
+
+WaveFileWriter::~WaveFileWriter()
+{
+  try
+  {
+    close();
+  }
+  catch (AIAlert::Error const& error)
+  {
+    Dout(dc::warning, error);
+  }
+  free(m_header);
+  free(m_buffer);
+}
+
+bool WaveFileWriter::open(std::string const& filename, int channels, jack_nframes_t sample_rate, bool direct_io)
+{
+  DoutEntering(dc::notice, "WaveFileWriter::open(\"" << filename << "\", " << channels << ", " << sample_rate << ", " << direct_io << ")");
+  ASSERT(!is_open());
+  int flags = O_WRONLY | O_CREAT | O_EXCL | O_CLOEXEC;
+  if (direct_io)
+    flags |= O_DIRECT;
+  m_fd = ::open(filename.c_str(), flags, 0644);
+  if (m_fd == -1 && direct_io && errno == EINVAL)
+  {
+    // The file system doesn't support O_DIRECT (for example tmpfs).
+    Dout(dc::notice, "O_DIRECT not supported for \"" << filename << "\", using buffered I/O.");
+    direct_io = false;
+    m_fd = ::open(filename.c_str(), flags & ~O_DIRECT, 0644);
+  }
+  if (m_fd == -1)
+  {
+    if (errno == EEXIST)
+      return false;
+    THROW_ALERTC(errno, "Cannot create \"[FILENAME]\"", AIArgs("[FILENAME]", filename));
+  }
+  m_filename = filename;
+  m_direct_io = direct_io;
+  m_channels = channels;
+  m_sample_rate = sample_rate;
+  m_data_bytes = 0;
+  m_buffer_fill = 0;
+  write_header();
+  return true;
+}
+
+void WaveFileWriter::write(jack_default_audio_sample_t const* const* in, jack_nframes_t nframes)
+{
+  // Interleave the channels into the write buffer. A frame may straddle two writes.
+  for (jack_nframes_t frame = 0; frame < nframes; ++frame)
+  {
+    for (int channel = 0; channel < m_channels; ++channel)
+    {
+      m_buffer[m_buffer_fill++] = in[channel][frame];
+      if (AI_UNLIKELY(m_buffer_fill == m_buffer_size))
+        flush_buffer(false);
+    }
+  }
+}
+
+void WaveFileWriter::close()
+{
+  if (!is_open())
+    return;
+  DoutEntering(dc::notice, "WaveFileWriter::close() [" << m_filename << ", " << frames() << " frames]");
+  int fd = m_fd;
+  try
+  {
+    flush_buffer(true);
+  }
+  catch (AIAlert::Error const&)
+  {
+    m_fd = -1;
+    ::close(fd);
+    throw;
+  }
+  m_fd = -1;
+  if (::close(fd) == -1)
+    THROW_ALERTC(errno, "Error closing \"[FILENAME]\"", AIArgs("[FILENAME]", m_filename));
+}
+
+void WaveFileWriter::flush_buffer(bool final)
+{
+  size_t const bytes = m_buffer_fill * sizeof(float);
+  if (bytes > 0)
+  {
+    size_t write_size = bytes;
+    if (m_direct_io && bytes % s_alignment != 0)
+    {
+      // Only the last write can be partial. O_DIRECT needs an aligned size, so pad it with zeroes and truncate afterwards.
+      ASSERT(final);
+      write_size = (bytes + s_alignment - 1) / s_alignment * s_alignment;
+      std::memset(reinterpret_cast<char*>(m_buffer) + bytes, 0, write_size - bytes);
+    }
+    pwrite_fully(m_buffer, write_size, s_header_size + m_data_bytes);
+    m_data_bytes += bytes;
+    m_buffer_fill = 0;
+    if (write_size != bytes && ftruncate(m_fd, s_header_size + m_data_bytes) == -1)
+      THROW_ALERTC(errno, "Cannot truncate \"[FILENAME]\"", AIArgs("[FILENAME]", m_filename));
+  }
+  if (bytes > 0 || final)
+    write_header();
+}
+
+void WaveFileWriter::write_header()
+{
+  uint32_t const block_align = m_channels * sizeof(float);
+  uint64_t const riff_size = s_header_size - 8 + m_data_bytes;
+  uint64_t const frames = m_data_bytes / block_align;
+  bool const rf64 = riff_size > 0xffffffff;
+
+  unsigned char* const h = m_header;
+  std::memset(h, 0, s_header_size);
+  put_id(h, rf64 ? "RF64" : "RIFF");
+  put_u32(h + 4, rf64 ? 0xffffffff : riff_size);
+  put_id(h + 8, "WAVE");
+
+  put_id(h + ds64_offset, rf64 ? "ds64" : "JUNK");
+  put_u32(h + ds64_offset + 4, ds64_size);
+  if (rf64)
+  {
+    put_u64(h + ds64_offset + 8, riff_size);
+    put_u64(h + ds64_offset + 16, m_data_bytes);
+    put_u64(h + ds64_offset + 24, frames);
+    // The table length (at ds64_offset + 32) is zero.
+  }
+
+  put_id(h + fmt_offset, "fmt ");
+  put_u32(h + fmt_offset + 4, fmt_size);
+  put_u16(h + fmt_offset + 8, wave_format_ieee_float);
+  put_u16(h + fmt_offset + 10, m_channels);
+  put_u32(h + fmt_offset + 12, m_sample_rate);
+  put_u32(h + fmt_offset + 16, m_sample_rate * block_align);
+  put_u16(h + fmt_offset + 20, block_align);
+  put_u16(h + fmt_offset + 22, 8 * sizeof(float));
+  // cbSize (at fmt_offset + 24) is zero.
+
+  // Non-PCM formats must have a 'fact' chunk.
+  put_id(h + fact_offset, "fact");
+  put_u32(h + fact_offset + 4, 4);
+  put_u32(h + fact_offset + 8, rf64 ? 0xffffffff : frames);
+
+  put_id(h + padding_offset, "JUNK");
+  put_u32(h + padding_offset + 4, data_offset - (padding_offset + 8));
+
+  put_id(h + data_offset, "data");
+  put_u32(h + data_offset + 4, rf64 ? 0xffffffff : m_data_bytes);
+
+  pwrite_fully(h, s_header_size, 0);
+}
+
+void WaveFileWriter::pwrite_fully(void const* data, size_t size, uint64_t offset)
+{
+  char const* ptr = static_cast<char const*>(data);
+  while (size > 0)
+  {
+    ssize_t written = pwrite(m_fd, ptr, size, offset);
+    if (written == -1)
+    {
+      if (errno == EINTR)
+        continue;
+      THROW_ALERTC(errno, "Error writing to \"[FILENAME]\"", AIArgs("[FILENAME]", m_filename));
+    }
+    ptr += written;
+    size -= written;
+    offset += written;
+  }
+}
@@ -0,0 +1,89 @@
+/**
+ * \file WaveFileWriter.h
+ * \brief Declaration of WaveFileWriter.
+ *
+ * Copyright (C) 2016 Aleric Inglewood.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published
+ * by the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef WAVE_FILE_WRITER_H
+#define WAVE_FILE_WRITER_H
+
+#include "AudioSink.h"
+#include <jack/jack.h>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+// Write interleaved 32-bit float audio to a WAV file.
+//
+// The header takes exactly s_header_size bytes: the space for a 'ds64' chunk is reserved
+// with a 'JUNK' chunk, and a second 'JUNK' chunk pads the header so that the audio data
+// starts on an s_alignment boundary. When the file grows beyond 4 GB the header is
+// turned into an RF64 header in place, so there is no limit on the length of a recording.
+//
+// Samples are collected in a write buffer of s_alignment aligned memory and written in one go
+// when it is full, so that with direct_io (O_DIRECT) every write is aligned and bypasses the page cache.
+// The header is rewritten after every write, so after a crash the file is valid up till the last write.
+//
+// Not thread-safe; the member functions throw AIAlert::ErrorCode when a system call fails.
+class WaveFileWriter : public AudioSink
+{
+  public:
+    static size_t const s_alignment = 4096;                     // Alignment of file offsets, sizes and memory for O_DIRECT.
+    static size_t const s_header_size = s_alignment;            // The offset of the audio data in the file.
+    static size_t const s_default_buffer_size = 1024 * 1024;    // The default size of the write buffer in bytes.
+
+  private:
+    int m_fd;                           // The file descriptor, or -1 when no file is open.
+    bool m_direct_io;                   // Set when m_fd was opened with O_DIRECT.
+    int m_channels;                     // The number of interleaved channels.
+    jack_nframes_t m_sample_rate;       // The sample rate written to the header.
+    uint64_t m_data_bytes;              // The number of bytes of audio data written to the file so far (not counting the write buffer).
+    std::string m_filename;
+
+    float* m_buffer;                    // The write buffer (aligned to s_alignment).
+    size_t m_buffer_size;               // The size of m_buffer in samples.
+    size_t m_buffer_fill;               // The number of samples in m_buffer.
+    unsigned char* m_header;            // Scratch space for the header (s_header_size bytes, aligned to s_alignment).
+
+  public:
+    WaveFileWriter(size_t buffer_size = s_default_buffer_size);
+    ~WaveFileWriter();
+
+    // Create filename, which must not exist yet. Returns false if it does exist.
+    bool open(std::string const& filename, int channels, jack_nframes_t sample_rate, bool direct_io);
+
+    // Append nframes frames; channel c of frame f is in[c][f].
+    /*virtual*/ void write(jack_default_audio_sample_t const* const* in, jack_nframes_t nframes);
+
+    // Flush the write buffer, write the final header and close the file. Does nothing when no file is open.
+    /*virtual*/ void close();
+
+    // Accessors.
+    bool is_open() const { return m_fd != -1; }
+    std::string const& filename() const { return m_filename; }
+    uint64_t frames() const { return (m_data_bytes + m_buffer_fill * sizeof(float)) / (m_channels * sizeof(float)); }
+
+  private:
+    void flush_buffer(bool final);
+    void write_header();
+    void pwrite_fully(void const* data, size_t size, uint64_t offset);
+
+  private:
+    WaveFileWriter(WaveFileWriter const&);
+};
+
+#endif // WAVE_FILE_WRITER_H
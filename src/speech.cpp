@@ -24,12 +24,15 @@
 #include <cerrno>
 #include <cstdlib>
 #include <string>
+#include <sstream>
+#include <vector>
 #include <boost/filesystem.hpp>
 
 #include "debug.h"
 #include "FFTJackClient.h"
 #include "UIWindow.h"
 #include "Configuration.h"
+#include "FFTWisdom.h"
 #include "utils/debug_ostream_operators.h"
 #include "utils/AIAlert.h"
 #include "utils/GlobalObjectManager.h"
@@ -56,6 +59,9 @@ int main(int argc, char* argv[])
     {
       boost::filesystem::create_directories(config_path);
     }
+    // FFTW wisdom is stored next to config.xml; this must be done before the jack client plans its FFTs.
+    Singleton<FFTWisdom>::instance().set_path(config_path);
+    boost::filesystem::path const config_dir(config_path);
     config_path += "config.xml";
     Singleton<Configuration>::instance().set_path(config_path);
 
@@ -79,8 +85,77 @@ int main(int argc, char* argv[])
                   AIArgs("[CSS_PATH]", css_path));
     }
 
+    // The number of input and output channels; SPEECH_CHANNELS defaults to mono.
+    char const* speech_channels = getenv("SPEECH_CHANNELS");
+    int number_of_channels = speech_channels ? atoi(speech_channels) : 1;
+    // The number of threads that help the JACK process thread; SPEECH_WORKERS defaults to none.
+    // Only worth it for graphs with several costly outputs per level (for example many channels with a large FFT).
+    char const* speech_workers = getenv("SPEECH_WORKERS");
+    int number_of_workers = speech_workers ? atoi(speech_workers) : 0;
+
     // Create the jack client.
-    FFTJackClient jack_client("Speech", 10.0);
+    FFTJackClient jack_client("Speech", 10.0, number_of_channels, number_of_workers);
+
+    // The number of seconds that is read ahead when playing back a file or a compressed take.
+    char const* speech_prefetch_seconds = getenv("SPEECH_PREFETCH_SECONDS");
+    double const prefetch_seconds = speech_prefetch_seconds ? atof(speech_prefetch_seconds) : 10.0;
+
+    // Stream recordings to SPEECH_RECORD_DIR, if set, instead of keeping them in memory (which limits them to the 10 seconds above).
+    // Set SPEECH_RECORD_DIRECT_IO to 1 to bypass the page cache.
+    // Alternatively, set SPEECH_RECORD_COMPRESSED to 1 to keep every take in memory, losslessly compressed, and play back the last one.
+    char const* speech_record_dir = getenv("SPEECH_RECORD_DIR");
+    char const* speech_record_compressed = getenv("SPEECH_RECORD_COMPRESSED");
+    bool const record_compressed = speech_record_compressed && atoi(speech_record_compressed);
+    // The recordings are only kept across restarts when SPEECH_PERSIST_RECORDINGS is set to 1.
+    char const* speech_persist_recordings = getenv("SPEECH_PERSIST_RECORDINGS");
+    bool const persist_recordings = speech_persist_recordings && atoi(speech_persist_recordings);
+    // Start every take with the last SPEECH_PREROLL_SECONDS of input before record was pressed.
+    char const* speech_preroll_seconds = getenv("SPEECH_PREROLL_SECONDS");
+    double const preroll_seconds = speech_preroll_seconds ? atof(speech_preroll_seconds) : 0.0;
+    // The recording buffers are swapped with the pre-roll ring, so they can't be streamed or kept in files.
+    if (preroll_seconds > 0 && (speech_record_dir || record_compressed || persist_recordings))
+      THROW_ALERT("SPEECH_PREROLL_SECONDS can't be combined with SPEECH_RECORD_DIR, SPEECH_RECORD_COMPRESSED or SPEECH_PERSIST_RECORDINGS.");
+    if (speech_record_dir)
+    {
+      boost::filesystem::create_directories(speech_record_dir);
+      char const* speech_record_direct_io = getenv("SPEECH_RECORD_DIRECT_IO");
+      jack_client.record_to_disk(speech_record_dir, speech_record_direct_io && atoi(speech_record_direct_io));
+    }
+    else if (record_compressed)
+      jack_client.record_compressed(prefetch_seconds);
+    else
+    {
+      // SPEECH_RECORDING_SLOTS is a comma separated list of names of recording slots, for example "A,B"; the default is a single slot.
+      char const* speech_recording_slots = getenv("SPEECH_RECORDING_SLOTS");
+      if (speech_recording_slots)
+      {
+        std::vector<std::string> names;
+        std::istringstream slots(speech_recording_slots);
+        for (std::string name; std::getline(slots, name, ',');)
+          names.push_back(name);
+        jack_client.set_recording_slots(names);
+      }
+      if (preroll_seconds > 0)
+        jack_client.set_preroll(preroll_seconds);
+      else if (persist_recordings)
+      {
+        // Keep the recording buffer in files in SPEECH_RECORDING_STORE (default: the config directory), so that it survives a restart.
+        char const* speech_recording_store = getenv("SPEECH_RECORDING_STORE");
+        try
+        {
+          jack_client.persist_recordings(speech_recording_store ? std::string(speech_recording_store) : config_dir.string());
+        }
+        catch (AIAlert::Error const& error)
+        {
+          // Not fatal; the recording just isn't kept.
+          std::cerr << error << std::endl;
+        }
+      }
+    }
+    // Play back SPEECH_PLAYBACK_FILE, if set, instead of the recording.
+    char const* speech_playback_file = getenv("SPEECH_PLAYBACK_FILE");
+    if (speech_playback_file)
+      jack_client.play_from_disk(speech_playback_file, prefetch_seconds);
 
     // Create the UIWindow before activating the jack client, because it
     // creates a dispatcher that theoretically could be called from the jack client.